@@ -0,0 +1,232 @@
+#pragma once
+#include <string>
+#include <algorithm>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <zlib.h>
+#ifdef VITAL_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+// Compression backends under GZMapReader, GZBuffer and GZWriter.
+// The zlib implementation itself is chosen at build time (system zlib, the bundled
+// zlib128 or a zlib-ng compat build, see CMakeLists.txt). The backend is chosen at
+// runtime by the VITAL_CODEC environment variable or by the caller.
+// Streaming zlib is the default. libdeflate (VITAL_CODEC=libdeflate, only in builds
+// that found the library) inflates a whole file at once, which pays off where its
+// inflate beats zlib's (see vital_codec_bench) and a file of up to CODEC_BULK_MAX bytes
+// may be held in memory per open reader or writer.
+#define CODEC_ZLIB 0	   // zlib, streaming one chunk at a time
+#define CODEC_LIBDEFLATE 1 // libdeflate whole-buffer inflate and deflate
+#define CODEC_COUNT 2
+
+// uncompressed bytes a whole-buffer codec keeps in memory at once. a larger input is
+// read by streaming zlib instead, and a larger output is written as several gzip members
+#ifndef CODEC_BULK_MAX
+#define CODEC_BULK_MAX ((size_t)256 << 20)
+#endif
+
+inline const char *codec_name(int codec)
+{
+	switch (codec)
+	{
+	case CODEC_ZLIB:
+		return "zlib";
+	case CODEC_LIBDEFLATE:
+		return "libdeflate";
+	}
+	return "";
+}
+
+// -1 if unknown
+inline int codec_by_name(const std::string &name)
+{
+	for (int i = 0; i < CODEC_COUNT; i++)
+		if (name == codec_name(i))
+			return i;
+	return -1;
+}
+
+// compiled into this build
+inline bool codec_available(int codec)
+{
+#ifndef VITAL_LIBDEFLATE
+	if (codec == CODEC_LIBDEFLATE)
+		return false;
+#endif
+	return codec >= 0 && codec < CODEC_COUNT;
+}
+
+// the whole file is decompressed into memory (and compressed at close)
+inline bool codec_whole_buffer(int codec)
+{
+	return codec != CODEC_ZLIB;
+}
+
+// backend named by VITAL_CODEC, or streaming zlib
+inline int codec_default()
+{
+	// initialized once, also when files are opened on several threads
+	static const int codec = []
+	{
+		const char *env = getenv("VITAL_CODEC");
+		int c = env ? codec_by_name(env) : CODEC_ZLIB;
+		return codec_available(c) ? c : CODEC_ZLIB;
+	}();
+	return codec;
+}
+
+// size of the last member as stored in the gzip trailer (mod 4 GB). used as an initial guess
+inline size_t gzip_isize(const unsigned char *in, size_t inlen)
+{
+	if (inlen < 18)
+		return 0;
+	std::uint32_t isize;
+	memcpy(&isize, in + inlen - 4, 4);
+	return isize;
+}
+
+// inflate every gzip member of 'in' into 'out', up to max_out bytes.
+// false on a broken or truncated stream, or on more data than max_out; 'out' then
+// holds what could be inflated
+inline bool codec_inflate_all(int codec, const unsigned char *in, size_t inlen, std::vector<unsigned char> &out, size_t max_out = CODEC_BULK_MAX)
+{
+	out.clear();
+	size_t guess = gzip_isize(in, inlen);
+	if (guess < inlen * 4)
+		guess = inlen * 4;
+	if (guess < 65536)
+		guess = 65536;
+	out.resize(std::min(guess, max_out));
+	size_t inpos = 0, outpos = 0;
+	bool ret = false;
+
+#ifdef VITAL_LIBDEFLATE
+	if (codec == CODEC_LIBDEFLATE)
+	{
+		libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+		if (!d)
+			return false;
+		while (inpos < inlen)
+		{
+			if (inlen - inpos < 2 || in[inpos] != 0x1f || in[inpos + 1] != 0x8b)
+				break; // trailing garbage is ignored, like gzread
+			size_t in_used = 0, out_used = 0;
+			libdeflate_result res = libdeflate_gzip_decompress_ex(d, in + inpos, inlen - inpos, &out[outpos], out.size() - outpos, &in_used, &out_used);
+			if (res == LIBDEFLATE_INSUFFICIENT_SPACE && out.size() < max_out)
+			{
+				out.resize(std::min(out.size() * 2, max_out));
+				continue;
+			}
+			if (res != LIBDEFLATE_SUCCESS)
+			{
+				inpos = 0; // no partial output from libdeflate
+				break;
+			}
+			inpos += in_used;
+			outpos += out_used;
+		}
+		libdeflate_free_decompressor(d);
+		out.resize(outpos);
+		return inpos > 0;
+	}
+#endif
+
+	if (codec != CODEC_ZLIB)
+		return false;
+	z_stream strm = {};
+	if (inflateInit2(&strm, MAX_WBITS + 32) != Z_OK)
+		return false;
+	while (true)
+	{
+		if (outpos == out.size())
+		{
+			if (out.size() >= max_out)
+				break; // too large to hold
+			out.resize(std::min(out.size() * 2, max_out));
+		}
+		// avail_in and avail_out are only 32 bits
+		uInt inlen32 = (uInt)std::min<size_t>(inlen - inpos, 1u << 30);
+		uInt outlen32 = (uInt)std::min<size_t>(out.size() - outpos, 1u << 30);
+		strm.next_in = (Bytef *)in + inpos;
+		strm.avail_in = inlen32;
+		strm.next_out = &out[outpos];
+		strm.avail_out = outlen32;
+		int zret = inflate(&strm, Z_NO_FLUSH);
+		inpos += inlen32 - strm.avail_in;
+		outpos += outlen32 - strm.avail_out;
+		if (zret == Z_STREAM_END)
+		{
+			// another member follows (concatenated streams)
+			if (inlen - inpos < 2 || in[inpos] != 0x1f || in[inpos + 1] != 0x8b)
+			{
+				ret = true;
+				break;
+			}
+			if (inflateReset2(&strm, MAX_WBITS + 32) != Z_OK)
+				break;
+		}
+		else if (zret == Z_BUF_ERROR && inpos == inlen)
+			break; // truncated
+		else if (zret != Z_OK && zret != Z_BUF_ERROR)
+			break;
+	}
+	inflateEnd(&strm);
+	out.resize(outpos);
+	return ret;
+}
+
+// gzip-compress 'in' into 'out' as a single member
+inline bool codec_deflate_all(int codec, const unsigned char *in, size_t inlen, std::vector<unsigned char> &out, int level)
+{
+#ifdef VITAL_LIBDEFLATE
+	if (codec == CODEC_LIBDEFLATE)
+	{
+		libdeflate_compressor *c = libdeflate_alloc_compressor(level < 0 ? 6 : level);
+		if (!c)
+			return false;
+		out.resize(libdeflate_gzip_compress_bound(c, inlen));
+		size_t len = libdeflate_gzip_compress(c, in, inlen, out.data(), out.size());
+		libdeflate_free_compressor(c);
+		out.resize(len);
+		return len > 0;
+	}
+#endif
+
+	if (codec != CODEC_ZLIB)
+		return false;
+	z_stream strm = {};
+	if (deflateInit2(&strm, level, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	out.resize(deflateBound(&strm, (uLong)inlen) + 64);
+	size_t inpos = 0, outpos = 0;
+	int zret = Z_OK;
+	while (zret == Z_OK || zret == Z_BUF_ERROR)
+	{
+		if (outpos == out.size())
+			out.resize(out.size() * 2);
+		uInt inlen32 = (uInt)std::min<size_t>(inlen - inpos, 1u << 30);
+		uInt outlen32 = (uInt)std::min<size_t>(out.size() - outpos, 1u << 30);
+		strm.next_in = (Bytef *)in + inpos;
+		strm.avail_in = inlen32;
+		strm.next_out = &out[outpos];
+		strm.avail_out = outlen32;
+		zret = deflate(&strm, (inpos + inlen32 == inlen) ? Z_FINISH : Z_NO_FLUSH);
+		inpos += inlen32 - strm.avail_in;
+		outpos += outlen32 - strm.avail_out;
+	}
+	deflateEnd(&strm);
+	out.resize(outpos);
+	return zret == Z_STREAM_END;
+}
+
+// compression level of a gzopen mode string such as "w1b"
+inline int codec_mode_level(const char *mode)
+{
+	for (const char *p = mode; *p; p++)
+		if (*p >= '0' && *p <= '9')
+			return *p - '0';
+	return Z_DEFAULT_COMPRESSION;
+}
@@ -0,0 +1,181 @@
+#pragma once
+#define EDIT_INFLATE_MAX (64 << 20) // members up to this size are inflated from memory to cut a fragment
+#include "GZParWriter.h"
+#include "GZMapReader.h"
+
+// Multi-member GZParWriter for tools that only change a few packets of a file.
+// Unchanged byte ranges of the source are passed with keep() instead of write().
+// At close, every source member that lies entirely inside a kept range is copied
+// as it is, without inflating or deflating it. Only the new bytes and the edges
+// of the kept ranges are compressed again, so editing a file that was written
+// by this class costs little more than copying it.
+// A file written by gzwrite is a single member and is compressed again as a whole
+// the first time; the output is then multi-member.
+class GZEditWriter : public GZParWriter
+{
+public:
+	// src must be read from the start to the end (without seek) before close
+	GZEditWriter(const char *path, GZMapReader &src, const char *mode = "w1b", unsigned nthreads = 0)
+		: GZParWriter(path, mode, nthreads, true), m_src(src) {}
+
+	virtual ~GZEditWriter()
+	{
+		close();
+	}
+
+protected:
+	struct Piece
+	{
+		bool keep;			// a range of the source, or bytes in m_new
+		std::uint64_t off;
+		std::uint64_t len;
+	};
+
+	GZMapReader &m_src;
+	std::vector<Piece> m_pieces;
+	std::vector<unsigned char> m_new;
+	std::uint64_t m_pending = 0; // bytes written or kept, not yet compressed
+	bool m_emitted = false;
+
+	std::vector<GZMapReader::Member> m_members;
+	size_t m_cached = (size_t)-1; // member inflated into m_cache
+	std::vector<unsigned char> m_cache;
+	bool m_rewound = false;
+
+	void add_piece(bool keep, std::uint64_t off, std::uint64_t len)
+	{
+		if (!len)
+			return;
+		m_pending += len;
+		// merge with the previous piece when contiguous
+		if (!m_pieces.empty())
+		{
+			Piece &last = m_pieces.back();
+			if (last.keep == keep && last.off + last.len == off)
+			{
+				last.len += len;
+				return;
+			}
+		}
+		m_pieces.push_back(Piece{keep, off, len});
+	}
+
+	// compress [off, off + len) of the source again
+	bool copy_range(std::uint64_t off, std::uint64_t len, const GZMapReader::Member *m)
+	{
+		if (m && m->outlen <= EDIT_INFLATE_MAX)
+		{
+			// the member is a gzip stream of its own
+			size_t idx = m - m_members.data();
+			if (m_cached != idx)
+			{
+				if (!codec_inflate_all(CODEC_ZLIB, m_src.mapped() + m->in, (size_t)m->inlen, m_cache) || m_cache.size() != m->outlen)
+					return false;
+				m_cached = idx;
+			}
+			return GZParWriter::write(&m_cache[(size_t)(off - m->out)], (std::uint32_t)len);
+		}
+
+		// read it through the source. ranges come in file order, so only the first
+		// one has to go back to the start of the file
+		if (!m_rewound)
+		{
+			m_src.rewind();
+			m_rewound = true;
+		}
+		if (!m_src.seek(off))
+			return false;
+		std::vector<unsigned char> buf(len < PAR_MEMBER ? (size_t)len : PAR_MEMBER);
+		while (len)
+		{
+			std::uint32_t n = len < buf.size() ? (std::uint32_t)len : (std::uint32_t)buf.size();
+			if (m_src.read(&buf[0], n) != n || !GZParWriter::write(&buf[0], n))
+				return false;
+			len -= n;
+		}
+		return true;
+	}
+
+	bool emit_keep(std::uint64_t off, std::uint64_t len)
+	{
+		// the first member that ends after off
+		auto it = std::upper_bound(m_members.begin(), m_members.end(), off, [](std::uint64_t o, const GZMapReader::Member &m)
+								   { return o < m.out + m.outlen; });
+		std::uint64_t end = off + len;
+		while (off < end)
+		{
+			if (it == m_members.end())
+				return copy_range(off, end - off, nullptr);
+			std::uint64_t mend = it->out + it->outlen;
+			if (off == it->out && mend <= end)
+			{
+				if (!write_member(m_src.mapped() + it->in, (size_t)it->inlen, it->outlen))
+					return false;
+			}
+			else
+			{
+				std::uint64_t n = (mend < end ? mend : end) - off;
+				if (!copy_range(off, n, &*it))
+					return false;
+			}
+			off = mend;
+			++it;
+		}
+		return true;
+	}
+
+	// write every piece in order
+	void emit()
+	{
+		m_emitted = true;
+		// the member table is lost once the source seeks back
+		m_members = m_src.members();
+		for (auto &p : m_pieces)
+		{
+			bool ok = p.keep ? emit_keep(p.off, p.len) : GZParWriter::write(&m_new[(size_t)p.off], (std::uint32_t)p.len);
+			if (!ok)
+				m_ok = false;
+		}
+		m_pieces.clear();
+		m_pending = 0;
+		std::vector<unsigned char>().swap(m_new);
+		std::vector<unsigned char>().swap(m_cache);
+	}
+
+public:
+	// the next len bytes of the output equal the source from uncompressed offset off
+	void keep(std::uint64_t off, std::uint64_t len)
+	{
+		add_piece(true, off, len);
+	}
+
+	using GZWriter::write; // the typed overloads end up in the one below
+
+	bool write(const void *buf, std::uint32_t len) override
+	{
+		if (!m_fo || m_emitted)
+			return false;
+		add_piece(false, m_new.size(), len);
+		m_new.insert(m_new.end(), (const unsigned char *)buf, (const unsigned char *)buf + len);
+		return true;
+	}
+
+	size_t get_datasize() const override
+	{
+		return GZParWriter::get_datasize() + m_pending;
+	}
+
+	size_t get_compsize() override
+	{
+		if (m_fo && !m_emitted)
+			emit();
+		return GZParWriter::get_compsize();
+	}
+
+	void close() override
+	{
+		if (m_fo && !m_emitted)
+			emit();
+		GZParWriter::close();
+	}
+};
@@ -0,0 +1,202 @@
+#pragma once
+#define WINSIZE 32768			 // deflate window
+#define INDEX_SPAN (1 << 20) // uncompressed bytes between access points
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <zlib.h>
+#include <sys/stat.h>
+
+// zran-style random access index of a gzip file.
+// Each access point stores the inflate state at a deflate block boundary:
+// the compressed bit position and the last 32 KB of uncompressed output.
+class GZIndex
+{
+public:
+	struct Point
+	{
+		std::uint64_t out = 0; // uncompressed offset
+		std::uint64_t in = 0;  // compressed offset of the first full byte
+		int bits = 0;		   // bits of the previous byte that belong to this block
+		std::vector<unsigned char> window;
+	};
+
+	GZIndex(std::uint32_t span = INDEX_SPAN) : span(span) {}
+
+public:
+	std::uint32_t span;
+	std::vector<Point> points;
+
+	// identity of the indexed file, to reject stale sidecars
+	std::uint64_t file_size = 0;
+	std::int64_t file_mtime = 0;
+
+public:
+	bool empty() const
+	{
+		return points.empty();
+	}
+
+	void clear()
+	{
+		points.clear();
+	}
+
+	// uncompressed offset up to which the file has been indexed
+	std::uint64_t last_out() const
+	{
+		return points.empty() ? 0 : points.back().out;
+	}
+
+	// a new point is worth keeping at uncompressed offset 'out'
+	bool wants(std::uint64_t out) const
+	{
+		return points.empty() || (out > points.back().out + span);
+	}
+
+	void add(std::uint64_t out, std::uint64_t in, int bits, const unsigned char *window, std::uint32_t winlen)
+	{
+		Point p;
+		p.out = out;
+		p.in = in;
+		p.bits = bits;
+		p.window.assign(window, window + winlen);
+		points.push_back(std::move(p));
+	}
+
+	// last access point at or before 'out', or nullptr
+	const Point *find(std::uint64_t out) const
+	{
+		size_t lo = 0, hi = points.size();
+		while (lo < hi)
+		{
+			size_t mid = (lo + hi) / 2;
+			if (points[mid].out <= out)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		return lo ? &points[lo - 1] : nullptr;
+	}
+
+	static bool stat_file(const std::string &path, std::uint64_t &size, std::int64_t &mtime)
+	{
+		struct stat st;
+		if (::stat(path.c_str(), &st) != 0)
+			return false;
+		size = (std::uint64_t)st.st_size;
+		mtime = (std::int64_t)st.st_mtime;
+		return true;
+	}
+
+	// sidecar file next to the vital file
+	static std::string sidecar_path(const std::string &path)
+	{
+		return path + ".gzi";
+	}
+
+	// save to 'idxpath'. windows are deflated to keep the sidecar small
+	bool save(const std::string &idxpath) const
+	{
+		FILE *f = ::fopen(idxpath.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ret = true;
+		std::uint32_t npoints = (std::uint32_t)points.size();
+		ret &= fwrite("VGZI", 4, 1, f) == 1;
+		ret &= fwrite(&span, 4, 1, f) == 1;
+		ret &= fwrite(&file_size, 8, 1, f) == 1;
+		ret &= fwrite(&file_mtime, 8, 1, f) == 1;
+		ret &= fwrite(&npoints, 4, 1, f) == 1;
+		std::vector<unsigned char> comp(compressBound(WINSIZE));
+		for (auto &p : points)
+		{
+			if (!ret)
+				break;
+			uLongf complen = (uLongf)comp.size();
+			if (compress2(&comp[0], &complen, p.window.data(), (uLong)p.window.size(), Z_BEST_SPEED) != Z_OK)
+			{
+				ret = false;
+				break;
+			}
+			unsigned char bits = (unsigned char)p.bits;
+			std::uint32_t winlen = (std::uint32_t)p.window.size();
+			std::uint32_t clen = (std::uint32_t)complen;
+			ret &= fwrite(&p.out, 8, 1, f) == 1;
+			ret &= fwrite(&p.in, 8, 1, f) == 1;
+			ret &= fwrite(&bits, 1, 1, f) == 1;
+			ret &= fwrite(&winlen, 4, 1, f) == 1;
+			ret &= fwrite(&clen, 4, 1, f) == 1;
+			ret &= fwrite(&comp[0], clen, 1, f) == 1;
+		}
+		fclose(f);
+		return ret;
+	}
+
+	bool load(const std::string &idxpath)
+	{
+		FILE *f = ::fopen(idxpath.c_str(), "rb");
+		if (!f)
+			return false;
+		char sign[4];
+		std::uint32_t npoints = 0;
+		bool ret = fread(sign, 4, 1, f) == 1 && !strncmp(sign, "VGZI", 4) &&
+				   fread(&span, 4, 1, f) == 1 &&
+				   fread(&file_size, 8, 1, f) == 1 &&
+				   fread(&file_mtime, 8, 1, f) == 1 &&
+				   fread(&npoints, 4, 1, f) == 1;
+		points.clear();
+		std::vector<unsigned char> comp;
+		for (std::uint32_t i = 0; ret && i < npoints; i++)
+		{
+			Point p;
+			unsigned char bits = 0;
+			std::uint32_t winlen = 0, clen = 0;
+			ret = fread(&p.out, 8, 1, f) == 1 &&
+				  fread(&p.in, 8, 1, f) == 1 &&
+				  fread(&bits, 1, 1, f) == 1 &&
+				  fread(&winlen, 4, 1, f) == 1 &&
+				  fread(&clen, 4, 1, f) == 1 &&
+				  winlen <= WINSIZE && clen <= compressBound(WINSIZE);
+			if (!ret)
+				break;
+			comp.resize(clen);
+			p.window.resize(winlen);
+			uLongf destlen = winlen;
+			ret = (!clen || fread(&comp[0], clen, 1, f) == 1) &&
+				  (!winlen || (uncompress(p.window.data(), &destlen, comp.data(), clen) == Z_OK && destlen == winlen));
+			p.bits = bits;
+			points.push_back(std::move(p));
+		}
+		fclose(f);
+		if (!ret)
+			points.clear();
+		return ret;
+	}
+
+	// load the sidecar of 'path' if it still matches the file
+	bool load_for(const std::string &path)
+	{
+		std::uint64_t size;
+		std::int64_t mtime;
+		if (!stat_file(path, size, mtime))
+			return false;
+		if (!load(sidecar_path(path)))
+			return false;
+		if (file_size != size || file_mtime != mtime)
+		{
+			points.clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool save_for(const std::string &path)
+	{
+		if (!stat_file(path, file_size, file_mtime))
+			return false;
+		return save(sidecar_path(path));
+	}
+};
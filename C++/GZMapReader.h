@@ -0,0 +1,550 @@
+#pragma once
+#define MAPCHUNK (1 << 20) // decompressed bytes per inflate call
+#include "GZReader.h"
+#include "GZIndex.h"
+#include <new>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// GZReader backend that maps the compressed file into memory and inflates it
+// in large chunks instead of pulling 8 KB at a time through gzread.
+// read / skip / fetch / rewind / eof behave exactly like GZReader.
+// With libdeflate, the whole-buffer codec (see GZCodec.h), a file of up to CODEC_BULK_MAX bytes is
+// inflated in one go into memory.
+class GZMapReader : public GZReader
+{
+public:
+	// a gzip member of the file, found while reading it from the start
+	struct Member
+	{
+		std::uint64_t in = 0;  // compressed offset, header included
+		std::uint64_t inlen = 0;
+		std::uint64_t out = 0; // uncompressed offset
+		std::uint64_t outlen = 0;
+	};
+
+	GZMapReader(const char *path, std::uint32_t chunk = MAPCHUNK, int codec = codec_default())
+	{
+		if (!map(path))
+			return;
+		m_chunk = chunk < BUFLEN ? BUFLEN : chunk;
+		m_out = (unsigned char *)::operator new(m_chunk, std::align_val_t(64));
+		fi_ptr = m_out;
+		if (inflateInit2(&m_strm, MAX_WBITS + 32) != Z_OK) // gzip or zlib header
+		{
+			unmap();
+			return;
+		}
+		m_strm_init = true;
+		m_inpos = 0;
+		inflate_whole(codec);
+		if (!m_bulk)
+			std::vector<unsigned char>().swap(m_whole);
+	}
+
+	virtual ~GZMapReader()
+	{
+		if (m_strm_init)
+			inflateEnd(&m_strm);
+		if (m_out)
+			::operator delete(m_out, std::align_val_t(64));
+		unmap();
+	}
+
+protected:
+	const unsigned char *m_map = nullptr; // whole compressed file
+	size_t m_mapsize = 0;
+	size_t m_inpos = 0; // compressed bytes handed to zlib so far
+#ifdef _WIN32
+	HANDLE m_hfile = INVALID_HANDLE_VALUE;
+	HANDLE m_hmap = nullptr;
+#endif
+
+	z_stream m_strm = {};
+	bool m_strm_init = false;
+	bool m_end = false; // no more data can be inflated
+	bool m_err = false; // stopped on corrupt data
+	bool m_raw = false; // inflating raw deflate data after a jump to an access point
+
+	unsigned char *m_out = nullptr; // 64-byte aligned decompression buffer
+	std::uint32_t m_chunk = MAPCHUNK;
+	std::uint32_t m_outlen = 0;		// bytes inflated into m_out
+	std::uint64_t m_outstart = 0;	// uncompressed offset of m_out[0]
+
+	GZIndex *m_index = nullptr; // access points, collected while inflating
+	GZIndex m_own_index;
+
+	std::vector<Member> m_members; // members seen so far
+	Member m_member;			   // the member being inflated
+	bool m_members_ok = true;	   // every member since the start of the file is in m_members
+
+	bool m_bulk = false; // the whole file is already inflated into m_whole
+	std::vector<unsigned char> m_whole;
+
+	bool map(const char *path)
+	{
+#ifdef _WIN32
+		m_hfile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (m_hfile == INVALID_HANDLE_VALUE)
+			return false;
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(m_hfile, &size) || !size.QuadPart)
+			return false;
+		m_mapsize = (size_t)size.QuadPart;
+		m_hmap = CreateFileMappingA(m_hfile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (!m_hmap)
+			return false;
+		m_map = (const unsigned char *)MapViewOfFile(m_hmap, FILE_MAP_READ, 0, 0, 0);
+		return (m_map != nullptr);
+#else
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0)
+			return false;
+		struct stat st;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0)
+		{
+			::close(fd);
+			return false;
+		}
+		m_mapsize = (size_t)st.st_size;
+		void *p = mmap(nullptr, m_mapsize, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // the mapping keeps its own reference
+		if (p == MAP_FAILED)
+			return false;
+		madvise(p, m_mapsize, MADV_SEQUENTIAL);
+		m_map = (const unsigned char *)p;
+		return true;
+#endif
+	}
+
+	void unmap()
+	{
+#ifdef _WIN32
+		if (m_map)
+			UnmapViewOfFile(m_map);
+		if (m_hmap)
+			CloseHandle(m_hmap);
+		if (m_hfile != INVALID_HANDLE_VALUE)
+			CloseHandle(m_hfile);
+		m_hmap = nullptr;
+		m_hfile = INVALID_HANDLE_VALUE;
+#else
+		if (m_map)
+			munmap((void *)m_map, m_mapsize);
+#endif
+		m_map = nullptr;
+		m_mapsize = 0;
+	}
+
+	// hand zlib the next slice of the mapping (avail_in is only 32 bits)
+	void feed()
+	{
+		if (m_strm.avail_in || m_inpos >= m_mapsize)
+			return;
+		size_t len = m_mapsize - m_inpos;
+		if (len > (1u << 30))
+			len = (1u << 30);
+		m_strm.next_in = (Bytef *)(m_map + m_inpos);
+		m_strm.avail_in = (uInt)len;
+		m_inpos += len;
+	}
+
+	// compressed bytes not yet consumed by zlib
+	size_t in_left() const
+	{
+		return m_mapsize - m_inpos + m_strm.avail_in;
+	}
+
+	// compressed offset of the next byte zlib will consume
+	std::uint64_t in_pos() const
+	{
+		return m_inpos - m_strm.avail_in;
+	}
+
+	// continue the input at compressed offset 'pos'
+	void set_in_pos(std::uint64_t pos)
+	{
+		m_inpos = (size_t)pos;
+		m_strm.next_in = nullptr;
+		m_strm.avail_in = 0;
+	}
+
+	// another gzip member follows (concatenated streams, like gzread)
+	bool next_member()
+	{
+		if (m_raw)
+		{
+			// raw inflate stops before the gzip trailer (crc32 + isize)
+			if (in_left() < 8)
+				return false;
+			set_in_pos(in_pos() + 8);
+			m_raw = false;
+		}
+		if (in_left() < 2)
+			return false;
+		feed();
+		if (m_strm.avail_in < 2 || m_strm.next_in[0] != 0x1f || m_strm.next_in[1] != 0x8b)
+			return false;
+		return inflateReset2(&m_strm, MAX_WBITS + 32) == Z_OK;
+	}
+
+	// remember the inflate state if we stopped at a useful block boundary
+	void add_point(std::uint64_t out)
+	{
+		// 128: stopped at the end of a block or of the gzip header, 64: last block
+		if (!(m_strm.data_type & 128) || (m_strm.data_type & 64) || !m_index->wants(out))
+			return;
+		unsigned char window[WINSIZE];
+		uInt winlen = 0;
+		if (inflateGetDictionary(&m_strm, window, &winlen) != Z_OK)
+			return;
+		m_index->add(out, in_pos(), m_strm.data_type & 7, window, winlen);
+	}
+
+	// inflate the whole file into m_whole with a whole-buffer codec. a broken or truncated
+	// file, or one of more than CODEC_BULK_MAX bytes, is streamed instead, which keeps
+	// what can be read and at most one chunk in memory
+	void inflate_whole(int codec)
+	{
+		if (!codec_whole_buffer(codec) || m_mapsize > CODEC_BULK_MAX)
+			return;
+		if (codec_inflate_all(codec, m_map, m_mapsize, m_whole, CODEC_BULK_MAX))
+			m_bulk = true;
+		else
+			m_whole.clear();
+	}
+
+	// hand out the next slice of m_whole
+	bool underflow_bulk()
+	{
+		m_outstart += m_outlen;
+		m_outlen = 0;
+		if (m_outstart >= m_whole.size())
+		{
+			m_end = true;
+			return false;
+		}
+		std::uint64_t len = m_whole.size() - m_outstart;
+		if (len > (1u << 30))
+			len = (1u << 30);
+		m_outlen = (std::uint32_t)len;
+		m_end = (m_outstart + len == m_whole.size());
+		fi_ptr = &m_whole[m_outstart];
+		fi_remain = m_outlen;
+		return true;
+	}
+
+	// inflate up to cap bytes into out, whose first byte is at uncompressed offset start.
+	// fewer only at the end of the data
+	std::uint32_t inflate_to(unsigned char *out, std::uint32_t cap, std::uint64_t start)
+	{
+		m_strm.next_out = out;
+		m_strm.avail_out = cap;
+		while (m_strm.avail_out)
+		{
+			feed();
+			// stop at every block boundary only while there is something left to index
+			std::uint64_t pos = start + (cap - m_strm.avail_out);
+			bool indexing = m_index && pos >= m_index->last_out();
+			int ret = inflate(&m_strm, indexing ? Z_BLOCK : Z_NO_FLUSH);
+			if (indexing && ret == Z_OK)
+				add_point(start + (cap - m_strm.avail_out));
+			if (ret == Z_STREAM_END)
+			{
+				if (!m_raw)
+				{
+					// inflate has consumed the trailer too
+					m_member.inlen = in_pos() - m_member.in;
+					m_member.outlen = start + (cap - m_strm.avail_out) - m_member.out;
+					m_members.push_back(m_member);
+					m_member.in += m_member.inlen;
+					m_member.out += m_member.outlen;
+				}
+				else
+					m_members_ok = false;
+				if (!next_member())
+				{
+					m_end = true;
+					break;
+				}
+			}
+			else if (ret == Z_BUF_ERROR && !in_left())
+			{
+				m_end = true; // truncated file; gzread also returns what it has
+				break;
+			}
+			else if (ret != Z_OK && ret != Z_BUF_ERROR)
+			{
+				m_end = true;
+				m_err = true;
+				break;
+			}
+		}
+		return cap - m_strm.avail_out;
+	}
+
+	bool underflow() override
+	{
+		if (!m_strm_init || m_end)
+			return false;
+		if (m_bulk)
+			return underflow_bulk();
+		m_outstart += m_outlen;
+		m_outlen = inflate_to(m_out, m_chunk, m_outstart);
+		if (!m_outlen)
+			return false;
+		fi_ptr = m_out;
+		fi_remain = m_outlen;
+		return true;
+	}
+
+	// inflate and drop; skipping never needs more than one chunk in memory
+	bool forward(std::uint64_t len)
+	{
+		while (len)
+		{
+			if (!fi_remain && !underflow())
+				return false;
+			if (len <= fi_remain)
+			{
+				fi_ptr += len;
+				fi_remain -= (std::uint32_t)len;
+				return true;
+			}
+			len -= fi_remain;
+			fi_remain = 0;
+		}
+		return true;
+	}
+
+	bool discard(std::uint32_t len) override
+	{
+		// long skips can jump over whole spans through the index
+		if (m_index && len > m_index->span)
+			return seek(tell() + len);
+		return forward(len);
+	}
+
+	// restart inflation at an access point
+	bool restore(const GZIndex::Point &p)
+	{
+		if (inflateReset2(&m_strm, -MAX_WBITS) != Z_OK)
+			return false;
+		m_raw = true;
+		m_end = false;
+		m_err = false;
+		m_members_ok = false;
+		set_in_pos(p.in - (p.bits ? 1 : 0));
+		if (p.bits)
+		{
+			if (m_inpos >= m_mapsize)
+				return false;
+			int ch = m_map[m_inpos++];
+			if (inflatePrime(&m_strm, p.bits, ch >> (8 - p.bits)) != Z_OK)
+				return false;
+		}
+		if (!p.window.empty() && inflateSetDictionary(&m_strm, p.window.data(), (uInt)p.window.size()) != Z_OK)
+			return false;
+		m_outstart = p.out;
+		m_outlen = 0;
+		fi_ptr = m_out;
+		fi_remain = 0;
+		return true;
+	}
+
+public:
+	// read another file with the same decompression buffer and inflate state
+	// (inflateReset instead of a new inflateInit). false if it cannot be opened
+	bool reopen(const char *path, int codec = codec_default())
+	{
+		unmap();
+		m_bulk = false;
+		m_own_index.clear();
+		m_index = nullptr;
+		if (!map(path))
+			return false;
+		if (!m_out)
+			m_out = (unsigned char *)::operator new(m_chunk, std::align_val_t(64));
+		if (!m_strm_init)
+		{
+			if (inflateInit2(&m_strm, MAX_WBITS + 32) != Z_OK)
+			{
+				unmap();
+				return false;
+			}
+			m_strm_init = true;
+		}
+		rewind();
+		// m_whole keeps its capacity (at most CODEC_BULK_MAX) for the next file
+		inflate_whole(codec);
+		return true;
+	}
+
+	bool opened() const override
+	{
+		return m_strm_init && m_map;
+	}
+
+	bool eof() const override
+	{
+		return (m_end && (fi_remain == 0)) || !m_strm_init;
+	}
+
+	void rewind() override
+	{
+		if (!m_strm_init)
+			return;
+		if (m_bulk)
+		{
+			seek(0);
+			return;
+		}
+		inflateReset2(&m_strm, MAX_WBITS + 32);
+		set_in_pos(0);
+		m_raw = false;
+		m_end = false;
+		m_err = false;
+		m_members.clear();
+		m_member = Member();
+		m_members_ok = true;
+		m_outstart = 0;
+		m_outlen = 0;
+		fi_remain = 0;
+		fi_ptr = m_out;
+	}
+
+	std::uint64_t tell() const override
+	{
+		return m_outstart + m_outlen - fi_remain;
+	}
+
+	// move to an uncompressed offset. with an index, this inflates at most one span
+	bool seek(std::uint64_t off) override
+	{
+		if (!m_strm_init)
+			return false;
+		// still in the current chunk
+		if (m_bulk)
+		{
+			if (off > m_whole.size())
+				return false;
+			m_outstart = off;
+			m_outlen = 0;
+			fi_remain = 0;
+			m_end = false;
+			return true;
+		}
+		if (off >= m_outstart && off <= m_outstart + m_outlen)
+		{
+			fi_ptr = m_out + (off - m_outstart);
+			fi_remain = (std::uint32_t)(m_outstart + m_outlen - off);
+			return true;
+		}
+		std::uint64_t cur = m_outstart + m_outlen; // where inflate stands now
+		const GZIndex::Point *p = m_index ? m_index->find(off) : nullptr;
+		if (p && (off < cur || p->out > cur))
+		{
+			if (!restore(*p))
+				return false;
+			cur = p->out;
+		}
+		else if (off < cur)
+		{
+			rewind();
+			cur = 0;
+		}
+		else
+		{
+			fi_ptr = m_out + m_outlen;
+			fi_remain = 0;
+		}
+		return forward(off - cur);
+	}
+
+	// like read(), but once the chunk buffer is used up inflate writes straight into buf
+	// instead of going through it. for callers that keep the data in their own blocks
+	std::uint32_t read_direct(unsigned char *buf, std::uint32_t len)
+	{
+		if (m_bulk || fi_remain >= len)
+			return read(buf, len);
+		std::uint32_t n = 0;
+		if (fi_remain)
+			n = read(buf, fi_remain);
+		if (!m_strm_init || m_end)
+			return n;
+		// the chunk buffer is empty; the inflated bytes only exist in buf
+		m_outstart += m_outlen;
+		m_outlen = 0;
+		std::uint32_t k = inflate_to(buf + n, len - n, m_outstart);
+		m_outstart += k;
+		fi_ptr = m_out;
+		return n + k;
+	}
+
+	// collect access points while reading. pass nullptr to use an internal index
+	void enable_index(GZIndex *idx = nullptr)
+	{
+		m_index = idx ? idx : &m_own_index;
+	}
+
+	GZIndex *index() const
+	{
+		return m_index;
+	}
+
+	// read the whole file once to complete the index, then go back to the start
+	bool build_index()
+	{
+		if (!m_index)
+			enable_index();
+		if (!seek(m_index->last_out()))
+			return false;
+		while (underflow())
+			;
+		rewind();
+		return true;
+	}
+
+	// compressed size of the mapped file
+	size_t compsize() const
+	{
+		return m_mapsize;
+	}
+
+	// inflate stopped on corrupt data rather than at the end of the file
+	bool failed() const
+	{
+		return m_err;
+	}
+
+	// gzip members of the file. complete once the whole file was read from the start
+	// without a jump; otherwise empty
+	std::vector<Member> members() const
+	{
+		if (!m_members_ok || m_bulk || !m_end || m_err || m_member.in != m_mapsize)
+			return std::vector<Member>();
+		return m_members;
+	}
+
+	// the compressed file in memory
+	const unsigned char *mapped() const
+	{
+		return m_map;
+	}
+
+	// the file was inflated in one go by a whole-buffer codec
+	bool bulk() const
+	{
+		return m_bulk;
+	}
+};
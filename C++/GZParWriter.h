@@ -0,0 +1,285 @@
+#pragma once
+#define PAR_BLOCK (1 << 17)	// uncompressed bytes per deflate job, as in pigz
+#define PAR_MEMBER (1 << 20) // uncompressed bytes per gzip member in multi-member mode
+#define WINSIZE 32768		// deflate window
+#include "GZReader.h"
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// pigz-style GZWriter: the data is cut into blocks that are deflated on a thread pool.
+// Each block is primed with the last 32 KB of the previous one and ends on a byte
+// boundary, so the concatenated blocks form one ordinary gzip member.
+// In multi-member mode every block is a complete gzip member instead, so that
+// unchanged members can later be copied as they are (see GZEditWriter).
+class GZParWriter : public GZWriter
+{
+public:
+	// nthreads = 0 uses every hardware thread. one thread deflates inline
+	GZParWriter(const char *path, const char *mode = "w1b", unsigned nthreads = 0, bool multi = false) : GZWriter(), m_multi(multi)
+	{
+		m_fo = ::fopen(path, "wb");
+		if (!m_fo)
+		{
+			m_ok = false;
+			return;
+		}
+		m_level = codec_mode_level(mode);
+		m_blocksize = multi ? PAR_MEMBER : PAR_BLOCK;
+		if (!nthreads)
+			nthreads = std::thread::hardware_concurrency();
+		if (nthreads > 1)
+			for (unsigned i = 0; i < nthreads; i++)
+				m_workers.emplace_back(&GZParWriter::work, this);
+		m_maxjobs = 2 * (nthreads ? nthreads : 1);
+		m_cur = std::make_shared<Job>();
+		m_cur->in.reserve(m_blocksize);
+		if (!m_multi)
+			write_header();
+	}
+
+	virtual ~GZParWriter()
+	{
+		close();
+	}
+
+protected:
+	struct Job
+	{
+		std::vector<unsigned char> in;
+		std::vector<unsigned char> dict; // last 32 KB before 'in'
+		std::vector<unsigned char> out;	 // raw deflate data
+		uLong crc = 0;
+		bool last = false;
+		bool done = false;
+		bool ok = false;
+	};
+
+	bool m_multi;
+	std::uint32_t m_blocksize = PAR_BLOCK;
+	std::shared_ptr<Job> m_cur;				  // being filled by write()
+	std::deque<std::shared_ptr<Job>> m_jobs;  // submitted, in file order
+	std::deque<std::shared_ptr<Job>> m_todo;  // waiting for a worker
+	std::vector<std::thread> m_workers;
+	std::mutex m_mutex;
+	std::condition_variable m_cv_todo; // a job was queued, or quit
+	std::condition_variable m_cv_done; // a job was finished
+	bool m_quit = false;
+	size_t m_maxjobs = 2;
+
+	uLong m_crc = 0;
+	std::uint64_t m_insize = 0;
+	std::uint64_t m_outsize = 0;
+	bool m_ok = true;
+
+	void deflate_job(Job &job) const
+	{
+		job.crc = crc32(0L, job.in.data(), (uInt)job.in.size());
+		z_stream strm = {};
+		// a whole gzip member, or raw deflate data inside the single member
+		if (deflateInit2(&strm, m_level, Z_DEFLATED, m_multi ? MAX_WBITS + 16 : -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+			return;
+		if (!job.dict.empty())
+			deflateSetDictionary(&strm, job.dict.data(), (uInt)job.dict.size());
+		job.out.resize(deflateBound(&strm, (uLong)job.in.size()) + 16);
+		strm.next_in = job.in.data();
+		strm.avail_in = (uInt)job.in.size();
+		strm.next_out = job.out.data();
+		strm.avail_out = (uInt)job.out.size();
+		// sync flush ends the block on a byte boundary so the next one can follow it
+		bool finish = job.last || m_multi;
+		int ret = deflate(&strm, finish ? Z_FINISH : Z_SYNC_FLUSH);
+		job.ok = finish ? (ret == Z_STREAM_END) : (ret == Z_OK && !strm.avail_in);
+		job.out.resize(job.out.size() - strm.avail_out);
+		deflateEnd(&strm);
+	}
+
+	void work()
+	{
+		while (true)
+		{
+			std::shared_ptr<Job> job;
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				m_cv_todo.wait(lock, [this]
+							   { return m_quit || !m_todo.empty(); });
+				if (m_todo.empty())
+					return;
+				job = m_todo.front();
+				m_todo.pop_front();
+			}
+			deflate_job(*job);
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				job->done = true;
+			}
+			m_cv_done.notify_all();
+		}
+	}
+
+	void write_header()
+	{
+		// no name, no mtime. xfl tells the level like zlib does, os = unknown
+		unsigned char hdr[10] = {0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 255};
+		hdr[8] = m_level == 1 ? 4 : (m_level == 9 ? 2 : 0);
+		m_ok &= fwrite(hdr, 10, 1, m_fo) == 1;
+		m_outsize += 10;
+	}
+
+	// write out the oldest job once it is compressed
+	void pop_job()
+	{
+		std::shared_ptr<Job> job = m_jobs.front();
+		m_jobs.pop_front();
+		if (!m_workers.empty())
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_cv_done.wait(lock, [&job]
+						   { return job->done; });
+		}
+		m_ok &= job->ok;
+		if (!job->out.empty())
+			m_ok &= fwrite(job->out.data(), job->out.size(), 1, m_fo) == 1;
+		m_outsize += job->out.size();
+		m_crc = crc32_combine(m_crc, job->crc, (z_off_t)job->in.size());
+	}
+
+	void submit(bool last)
+	{
+		auto job = m_cur;
+		job->last = last;
+		m_insize += job->in.size();
+
+		// the next block is primed with the tail of this one
+		m_cur = std::make_shared<Job>();
+		m_cur->in.reserve(m_blocksize);
+		if (!m_multi)
+		{
+			// (only the last block is shorter than the window)
+			size_t dictlen = job->in.size() < WINSIZE ? job->in.size() : WINSIZE;
+			m_cur->dict.assign(job->in.end() - dictlen, job->in.end());
+		}
+
+		m_jobs.push_back(job);
+		if (m_workers.empty())
+			deflate_job(*job);
+		else
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_todo.push_back(job);
+			}
+			m_cv_todo.notify_one();
+		}
+
+		// back-pressure: keep at most a couple of jobs per thread in memory
+		while (m_jobs.size() >= m_maxjobs || (last && !m_jobs.empty()))
+			pop_job();
+	}
+
+public:
+	size_t get_datasize() const override
+	{
+		return m_insize + (m_cur ? m_cur->in.size() : 0);
+	}
+
+	// finishes the stream, like GZWriter does
+	size_t get_compsize() override
+	{
+		finish();
+		return m_outsize;
+	}
+
+	using GZWriter::write; // the typed overloads end up in the one below
+
+	bool write(const void *buf, std::uint32_t len) override
+	{
+		if (!m_fo || !m_cur)
+			return false;
+		const unsigned char *p = (const unsigned char *)buf;
+		while (len)
+		{
+			std::uint32_t copy = m_blocksize - (std::uint32_t)m_cur->in.size();
+			if (copy > len)
+				copy = len;
+			m_cur->in.insert(m_cur->in.end(), p, p + copy);
+			p += copy;
+			len -= copy;
+			if (m_cur->in.size() == m_blocksize)
+				submit(false);
+		}
+		return m_ok;
+	}
+
+	// multi-member mode: close the current member early
+	void end_member()
+	{
+		if (m_multi && m_cur && !m_cur->in.empty())
+			submit(false);
+	}
+
+	// multi-member mode: append a complete gzip member that is already compressed
+	bool write_member(const unsigned char *comp, size_t complen, std::uint64_t rawlen)
+	{
+		if (!m_multi || !m_fo || !m_cur)
+			return false;
+		end_member();
+		while (!m_jobs.empty())
+			pop_job();
+		if (complen)
+			m_ok &= fwrite(comp, complen, 1, m_fo) == 1;
+		m_outsize += complen;
+		m_insize += rawlen;
+		return m_ok;
+	}
+
+	// compress what is left and write the gzip trailer
+	void finish()
+	{
+		if (!m_fo || !m_cur)
+			return;
+		if (m_multi)
+		{
+			end_member();
+			while (!m_jobs.empty())
+				pop_job();
+			m_cur.reset();
+			return;
+		}
+		submit(true);
+		m_cur.reset();
+		unsigned char trailer[8];
+		std::uint32_t crc = (std::uint32_t)m_crc, isize = (std::uint32_t)m_insize;
+		memcpy(trailer, &crc, 4);
+		memcpy(trailer + 4, &isize, 4);
+		m_ok &= fwrite(trailer, 8, 1, m_fo) == 1;
+		m_outsize += 8;
+	}
+
+	void close() override
+	{
+		if (!m_fo)
+			return;
+		finish();
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_quit = true;
+		}
+		m_cv_todo.notify_all();
+		for (auto &t : m_workers)
+			t.join();
+		m_workers.clear();
+		// the last buffered bytes only reach the disk here
+		if (fclose(m_fo) != 0)
+			m_ok = false;
+		m_fo = nullptr;
+	}
+
+	// the file was opened and every write reached it so far, the last ones after close()
+	bool good() const
+	{
+		return m_ok;
+	}
+};
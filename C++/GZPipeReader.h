@@ -0,0 +1,271 @@
+#pragma once
+#define PIPE_SLOTS 4		   // blocks in flight between the threads
+#define PIPE_BLOCK (1 << 20) // decompressed bytes per block
+#ifndef PIPE_THREADED
+#define PIPE_THREADED 0 // 1 to inflate on the producer thread by default (cmake -DVITAL_PIPE_THREAD=ON)
+#endif
+#include "GZMapReader.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// GZReader that inflates on a producer thread while the caller parses.
+// The producer inflates straight into a single-producer single-consumer ring of large
+// blocks; it sleeps while the ring is full and marks the end of data (or an error) when done.
+// A block changes hands under a mutex, and either side sleeps on a condition variable
+// that the other notifies on each block.
+// The producer thread is opt-in: by default, and on a single hardware thread, the blocks
+// are inflated inline in the calling thread. vital_bench's pipe scan times the threaded mode.
+class GZPipeReader : public GZReader
+{
+public:
+	// threaded = false inflates inline, e.g. when the caller already runs one file per core
+	GZPipeReader(const char *path, std::uint32_t block = PIPE_BLOCK, bool threaded = PIPE_THREADED && std::thread::hardware_concurrency() > 1)
+		: m_src(path), m_block(block), m_threaded(threaded)
+	{
+		if (!m_src.opened())
+			return;
+		for (auto &slot : m_slots)
+			slot.buf = (unsigned char *)::operator new(m_block, std::align_val_t(64));
+		start();
+	}
+
+	virtual ~GZPipeReader()
+	{
+		stop();
+		for (auto &slot : m_slots)
+			if (slot.buf)
+				::operator delete(slot.buf, std::align_val_t(64));
+	}
+
+protected:
+	struct Slot
+	{
+		unsigned char *buf = nullptr;
+		std::uint32_t len = 0;
+		std::uint64_t off = 0; // uncompressed offset of buf[0]
+	};
+
+	GZMapReader m_src; // only touched by the producer while it runs
+	std::uint32_t m_block;
+	bool m_threaded;
+	Slot m_slots[PIPE_SLOTS];
+	std::thread m_thread;
+
+	// blocks produced / released. the consumer reads slot m_tail while it holds it
+	std::atomic<std::uint64_t> m_head{0};
+	std::atomic<std::uint64_t> m_tail{0};
+	std::atomic<bool> m_done{false};  // producer has published its last block
+	std::atomic<bool> m_error{false}; // producer stopped on an error
+	std::atomic<bool> m_stop{false};  // consumer asks the producer to quit
+
+	// wakes the producer when a slot is released, and the consumer when a block is published
+	mutable std::mutex m_mutex;
+	mutable std::condition_variable m_cv;
+
+	bool m_holding = false; // consumer owns slot m_tail
+	std::uint64_t m_curoff = 0;
+	std::uint32_t m_curlen = 0;
+
+	void produce()
+	{
+		try
+		{
+			while (!m_stop.load(std::memory_order_relaxed))
+			{
+				std::uint64_t head = m_head.load(std::memory_order_relaxed);
+				// back-pressure: wait for the consumer to release a slot
+				if (head - m_tail.load(std::memory_order_acquire) >= PIPE_SLOTS)
+				{
+					std::unique_lock<std::mutex> lock(m_mutex);
+					m_cv.wait(lock, [&]
+							  { return m_stop.load() || head - m_tail.load() < PIPE_SLOTS; });
+					continue;
+				}
+				Slot &slot = m_slots[head % PIPE_SLOTS];
+				slot.off = m_src.tell();
+				slot.len = m_src.read_direct(slot.buf, m_block);
+				if (slot.len)
+					publish(m_head, head + 1);
+				if (slot.len < m_block)
+					break;
+			}
+			if (m_src.failed())
+				m_error = true;
+		}
+		catch (...)
+		{
+			m_error = true;
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_done.store(true, std::memory_order_release);
+		m_cv.notify_all();
+	}
+
+	// a store the other thread may be sleeping on
+	template <typename T, typename V>
+	void publish(std::atomic<T> &a, V v) const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		a.store(v, std::memory_order_release);
+		m_cv.notify_all();
+	}
+
+	// the consumer sleeps until the producer has published past 'tail' or is done
+	void wait_block(std::uint64_t tail) const
+	{
+		if (m_head.load(std::memory_order_acquire) != tail || m_done.load(std::memory_order_acquire))
+			return;
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cv.wait(lock, [&]
+				  { return m_head.load() != tail || m_done.load(); });
+	}
+
+	void start()
+	{
+		m_head = 0;
+		m_tail = 0;
+		m_done = false;
+		m_error = false;
+		m_stop = false;
+		m_holding = false;
+		if (m_threaded)
+			m_thread = std::thread(&GZPipeReader::produce, this);
+	}
+
+	void stop()
+	{
+		publish(m_stop, true);
+		if (m_thread.joinable())
+			m_thread.join();
+	}
+
+	// restart the producer at an uncompressed offset
+	bool restart(std::uint64_t off)
+	{
+		stop();
+		fi_remain = 0;
+		bool ret = m_src.seek(off);
+		m_curoff = m_src.tell(); // the end of the data if 'off' is beyond it
+		m_curlen = 0;
+		start();
+		return ret;
+	}
+
+	bool underflow() override
+	{
+		if (!m_src.opened())
+			return false;
+		if (!m_threaded)
+		{
+			Slot &slot = m_slots[0];
+			slot.off = m_src.tell();
+			slot.len = m_src.read_direct(slot.buf, m_block);
+			m_curoff = slot.off;
+			m_curlen = slot.len;
+			m_holding = slot.len > 0;
+			fi_ptr = slot.buf;
+			fi_remain = slot.len;
+			return m_holding;
+		}
+		std::uint64_t tail = m_tail.load(std::memory_order_relaxed);
+		if (m_holding)
+		{
+			// give the current block back to the producer
+			m_holding = false;
+			m_curoff += m_curlen;
+			m_curlen = 0;
+			publish(m_tail, ++tail);
+		}
+		// the last block is published before m_done
+		wait_block(tail);
+		if (m_head.load(std::memory_order_acquire) == tail)
+			return false;
+		Slot &slot = m_slots[tail % PIPE_SLOTS];
+		m_holding = true;
+		m_curoff = slot.off;
+		m_curlen = slot.len;
+		fi_ptr = slot.buf;
+		fi_remain = slot.len;
+		return true;
+	}
+
+	bool discard(std::uint32_t len) override
+	{
+		// within the blocks already in flight, or jump the producer ahead
+		if (len > PIPE_SLOTS * (std::uint64_t)m_block)
+			return seek(tell() + len);
+		while (len)
+		{
+			if (!fi_remain && !underflow())
+				return false;
+			std::uint32_t n = len < fi_remain ? len : fi_remain;
+			fi_ptr += n;
+			fi_remain -= n;
+			len -= n;
+		}
+		return true;
+	}
+
+public:
+	bool opened() const override
+	{
+		return m_src.opened();
+	}
+
+	// waits until the producer has either another block or nothing more
+	bool eof() const override
+	{
+		if (fi_remain || !m_src.opened())
+			return !m_src.opened();
+		if (!m_threaded)
+			return m_src.eof();
+		std::uint64_t next = m_tail.load(std::memory_order_relaxed) + (m_holding ? 1 : 0);
+		wait_block(next);
+		return m_head.load(std::memory_order_acquire) == next;
+	}
+
+	void rewind() override
+	{
+		restart(0);
+	}
+
+	std::uint64_t tell() const override
+	{
+		return m_curoff + m_curlen - fi_remain;
+	}
+
+	bool seek(std::uint64_t off) override
+	{
+		if (!m_src.opened())
+			return false;
+		// still in the current block
+		if (m_holding && off >= m_curoff && off <= m_curoff + m_curlen)
+		{
+			fi_ptr = m_slots[m_threaded ? m_tail % PIPE_SLOTS : 0].buf + (off - m_curoff);
+			fi_remain = (std::uint32_t)(m_curoff + m_curlen - off);
+			return true;
+		}
+		return restart(off);
+	}
+
+	// jump through a zran index (such as a loaded .gzi sidecar) on long skips
+	void enable_index(GZIndex *idx)
+	{
+		if (!m_src.opened())
+			return;
+		std::uint64_t off = tell();
+		stop();
+		m_src.enable_index(idx);
+		restart(off);
+	}
+
+	// the producer stopped on a broken stream rather than at the end of the data
+	bool failed() const
+	{
+		if (!m_threaded)
+			return m_src.failed();
+		return m_error.load(std::memory_order_acquire) && eof();
+	}
+};
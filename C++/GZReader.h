@@ -1,10 +1,12 @@
 #pragma once
 #define BUFLEN 8192
 #include <string>
+#include <cstring>
 #include <vector>
 #include <zlib.h>
 #include <type_traits>
 #include <cstdint> // for std::uint32_t, etc.
+#include "GZCodec.h"
 
 class GZBuffer
 {
@@ -12,13 +14,15 @@ private:
 	unsigned char buf_in[BUFLEN];
 	unsigned int buf_in_pos = 0;
 	unsigned char buf_out[BUFLEN];
-	z_stream strm = {0};
+	z_stream strm = {};
+	int m_codec;
+	std::vector<unsigned char> m_raw; // uncompressed data for the whole-buffer codecs
 
 public:
 	std::vector<unsigned char> m_comp; // compressed data
 
 public:
-	GZBuffer()
+	GZBuffer(int codec = codec_default()) : m_codec(codec)
 	{
 		deflateInit2(&strm, Z_BEST_SPEED, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
 	}
@@ -30,6 +34,16 @@ public:
 public:
 	void flush()
 	{
+		if (codec_whole_buffer(m_codec))
+		{
+			if (m_raw.empty())
+				return;
+			std::vector<unsigned char> comp;
+			if (codec_deflate_all(m_codec, m_raw.data(), m_raw.size(), comp, Z_BEST_SPEED))
+				m_comp.insert(m_comp.end(), comp.begin(), comp.end());
+			m_raw.clear();
+			return;
+		}
 		// finish deflation if any data remains
 		if (buf_in_pos)
 		{
@@ -65,6 +79,14 @@ public:
 
 	bool write(const void *buf, std::uint32_t len)
 	{
+		if (codec_whole_buffer(m_codec))
+		{
+			// a gzip member of its own every CODEC_BULK_MAX bytes
+			if (m_raw.size() + len > CODEC_BULK_MAX)
+				flush();
+			m_raw.insert(m_raw.end(), (const unsigned char *)buf, (const unsigned char *)buf + len);
+			return true;
+		}
 		std::uint32_t bufpos = 0;
 		while (bufpos < len)
 		{
@@ -124,8 +146,16 @@ public:
 class GZWriter
 {
 public:
-	GZWriter(const char *path, const char *mode = "w1b")
+	GZWriter(const char *path, const char *mode = "w1b", int codec = codec_default()) : m_codec(codec)
 	{
+		if (codec_whole_buffer(codec))
+		{
+			// compressed in one go, a gzip member per CODEC_BULK_MAX bytes
+			m_fo = ::fopen(path, "wb");
+			m_level = codec_mode_level(mode);
+			m_fi = nullptr;
+			return;
+		}
 		m_fi = gzopen(path, mode);
 	}
 
@@ -134,34 +164,91 @@ public:
 		close();
 	}
 
+protected:
+	// for the other backends, which do not own a gzFile
+	GZWriter() : m_fi(nullptr), m_codec(CODEC_ZLIB) {}
+
 public:
-	size_t get_datasize() const
+	virtual size_t get_datasize() const
 	{
+		if (m_fo)
+			return m_datasize;
 		return gztell(m_fi);
 	}
-	size_t get_compsize() const
+	virtual size_t get_compsize()
 	{
+		if (m_fo)
+		{
+			finish();
+			return m_compsize;
+		}
 		gzflush(m_fi, Z_FINISH);
 		return gzoffset(m_fi) + 20; // approximate overhead
 	}
 
-	void close()
+	virtual void close()
 	{
-		if (m_fi)
+		if (m_fo)
+		{
+			finish();
+			fclose(m_fo);
+			m_fo = nullptr;
+		}
+		else if (m_fi)
 			gzclose(m_fi);
 		m_fi = nullptr;
 	}
 
 protected:
 	gzFile m_fi;
+	int m_codec;
+
+	// whole-buffer codecs
+	FILE *m_fo = nullptr;
+	int m_level = Z_DEFAULT_COMPRESSION;
+	std::vector<unsigned char> m_raw;  // not yet compressed, at most CODEC_BULK_MAX bytes
+	std::vector<unsigned char> m_comp; // the last member
+	size_t m_datasize = 0;
+	size_t m_compsize = 0;
+	bool m_finished = false;
+
+	// compress what is buffered as a gzip member and write it out
+	void write_member()
+	{
+		codec_deflate_all(m_codec, m_raw.data(), m_raw.size(), m_comp, m_level);
+		if (!m_comp.empty())
+			fwrite(m_comp.data(), m_comp.size(), 1, m_fo);
+		m_compsize += m_comp.size();
+		m_raw.clear();
+	}
+
+	void finish()
+	{
+		if (m_finished)
+			return;
+		// an empty file still gets one (empty) member
+		if (!m_raw.empty() || !m_compsize)
+			write_member();
+		m_finished = true;
+	}
 
 public:
 	bool write(const std::string &s)
 	{
-		return gzwrite(m_fi, s.data(), (unsigned)s.size()) > 0;
+		return write(s.data(), (std::uint32_t)s.size());
 	}
-	bool write(const void *buf, std::uint32_t len)
+	virtual bool write(const void *buf, std::uint32_t len)
 	{
+		if (m_fo)
+		{
+			if (m_finished)
+				return false;
+			if (!m_raw.empty() && m_raw.size() + len > CODEC_BULK_MAX)
+				write_member();
+			m_raw.insert(m_raw.end(), (const unsigned char *)buf, (const unsigned char *)buf + len);
+			m_datasize += len;
+			return len > 0;
+		}
 		return gzwrite(m_fi, buf, len) > 0;
 	}
 	bool write(const double &f)
@@ -188,11 +275,19 @@ public:
 	{
 		return write(&v, sizeof(v));
 	}
-	bool write(long &b)
+	bool write(std::int32_t &v)
+	{
+		return write(&v, sizeof(v));
+	}
+	bool write(std::uint32_t &v)
+	{
+		return write(&v, sizeof(v));
+	}
+	bool write(std::int64_t &b)
 	{
 		return write(&b, sizeof(b));
 	}
-	bool write(unsigned long &b)
+	bool write(std::uint64_t &b)
 	{
 		return write(&b, sizeof(b));
 	}
@@ -206,7 +301,7 @@ public:
 
 	bool opened() const
 	{
-		return (m_fi != nullptr);
+		return (m_fi != nullptr) || (m_fo != nullptr);
 	}
 };
 
@@ -225,10 +320,33 @@ public:
 	}
 
 protected:
+	// for the other backends, which do not own a gzFile
+	GZReader() : m_fi(nullptr) {}
+
 	gzFile m_fi;
 	std::uint32_t fi_remain = 0; // how many bytes are left in fi_buf
 	unsigned char fi_buf[BUFLEN];
 	const unsigned char *fi_ptr = fi_buf;
+	std::vector<unsigned char> fi_stage; // for view() across a refill
+
+	// refill fi_ptr and fi_remain with the next decompressed chunk
+	// returns false at the end of file or on error
+	virtual bool underflow()
+	{
+		int unzippedBytes = gzread(m_fi, fi_buf, BUFLEN);
+		if (unzippedBytes <= 0)
+			return false;
+		fi_remain = (std::uint32_t)unzippedBytes;
+		fi_ptr = fi_buf;
+		return true;
+	}
+
+	// drop 'len' bytes beyond the buffered data
+	virtual bool discard(std::uint32_t len)
+	{
+		z_off_t nskip = gzseek(m_fi, len, SEEK_CUR);
+		return (nskip != -1);
+	}
 
 public:
 	// read up to 'len' bytes into 'dest'; returns how many bytes were read
@@ -261,11 +379,8 @@ public:
 				fi_remain = 0;
 			}
 			// need to read more from file
-			int unzippedBytes = gzread(m_fi, fi_buf, BUFLEN);
-			if (unzippedBytes <= 0)
+			if (!underflow())
 				return nread; // end of file or error
-			fi_remain = (std::uint32_t)unzippedBytes;
-			fi_ptr = fi_buf;
 		}
 		return nread;
 	}
@@ -288,8 +403,7 @@ public:
 				fi_remain = 0;
 			}
 			// now seek forward in the gzip
-			z_off_t nskip = gzseek(m_fi, len, SEEK_CUR);
-			return (nskip != -1);
+			return discard(len);
 		}
 	}
 
@@ -313,8 +427,7 @@ public:
 				remain -= fi_remain;
 				fi_remain = 0;
 			}
-			z_off_t nskip = gzseek(m_fi, len, SEEK_CUR);
-			if (nskip == -1)
+			if (!discard(len))
 				return false;
 			remain -= len;
 			return true;
@@ -343,8 +456,7 @@ public:
 				remain -= fi_remain;
 				fi_remain = 0;
 			}
-			z_off_t nskip = gzseek(m_fi, len, SEEK_CUR);
-			if (nskip == -1)
+			if (!discard(len))
 				return false;
 			remain -= len;
 			return true;
@@ -436,6 +548,23 @@ public:
 		return (nread == strlen32);
 	}
 
+	// pointer to the next 'len' bytes, valid until the next call on this reader.
+	// points into the decompression buffer unless the bytes straddle a refill
+	const unsigned char *view(std::uint32_t len)
+	{
+		if (len <= fi_remain)
+		{
+			const unsigned char *p = fi_ptr;
+			fi_ptr += len;
+			fi_remain -= len;
+			return p;
+		}
+		fi_stage.resize(len);
+		if (read(&fi_stage[0], len) != len)
+			return nullptr;
+		return &fi_stage[0];
+	}
+
 	// This version is used in your code to parse a “string with length”:
 	bool fetch_with_len(std::string &x, std::uint32_t &remain)
 	{
@@ -455,23 +584,37 @@ public:
 		return (nread == strLen32);
 	}
 
-	bool opened() const
+	virtual bool opened() const
 	{
 		return (m_fi != nullptr);
 	}
 
-	bool eof() const
+	virtual bool eof() const
 	{
 		// if gzread has returned 0 or negative and no leftover in fi_remain, we are at EOF
 		return (gzeof(m_fi) && (fi_remain == 0));
 	}
 
-	void rewind()
+	virtual void rewind()
 	{
 		gzrewind(m_fi);
 		fi_remain = 0;
 		fi_ptr = fi_buf;
 	}
+
+	// uncompressed offset of the next byte to be read
+	virtual std::uint64_t tell() const
+	{
+		return (std::uint64_t)gztell(m_fi) - fi_remain;
+	}
+
+	// move to an uncompressed offset. gzseek inflates from the start for backward seeks
+	virtual bool seek(std::uint64_t off)
+	{
+		fi_remain = 0;
+		fi_ptr = fi_buf;
+		return gzseek(m_fi, (z_off_t)off, SEEK_SET) != -1;
+	}
 };
 
 // A simple buffer class (unchanged except for 32-bit adjustments if needed)
@@ -515,6 +658,27 @@ public:
 		pos += sizeof(x);
 		return true;
 	}
+	bool fetch(std::uint16_t &x)
+	{
+		if (this->size() < pos + sizeof(x))
+		{
+			pos = (std::uint32_t)this->size();
+			return false;
+		}
+		memcpy(&x, &(*this)[pos], sizeof(x));
+		pos += sizeof(x);
+		return true;
+	}
+	bool fetch(std::uint8_t &x)
+	{
+		if (this->size() < pos + sizeof(x))
+		{
+			pos = (std::uint32_t)this->size();
+			return false;
+		}
+		x = (*this)[pos++];
+		return true;
+	}
 	bool fetch(float &x)
 	{
 		if (this->size() < pos + sizeof(x))
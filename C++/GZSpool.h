@@ -0,0 +1,172 @@
+#pragma once
+#define SPOOL_CHUNK (1 << 20) // bytes read back from the temp file at a time
+#include "GZReader.h"
+#include <cstdio>
+
+#ifdef _WIN32
+#define spool_seek(f, off) _fseeki64(f, (long long)(off), SEEK_SET) // off_t is 32 bits there
+#else
+#define spool_seek(f, off) fseeko(f, (off_t)(off), SEEK_SET)
+#endif
+
+// GZReader over bytes that the caller appends first and reads back afterwards.
+// Up to 'memmax' bytes stay in memory; the rest goes to an anonymous temp file that is
+// deleted when the spool is. Whatever the size, at most memmax + one chunk is in memory.
+// Reading starts at rewind(); appending after that is not supported.
+class GZSpool : public GZReader
+{
+public:
+	GZSpool(size_t memmax, std::uint32_t chunk = SPOOL_CHUNK) : m_memmax(memmax), m_chunk(chunk) {}
+
+	virtual ~GZSpool()
+	{
+		if (m_file)
+			fclose(m_file);
+	}
+
+	GZSpool(const GZSpool &) = delete;
+	GZSpool &operator=(const GZSpool &) = delete;
+
+protected:
+	size_t m_memmax;
+	std::uint32_t m_chunk;
+	std::vector<unsigned char> m_mem; // the bytes after the ones in the file
+	FILE *m_file = nullptr;
+	std::uint64_t m_filesize = 0;
+	std::vector<unsigned char> m_buf; // read buffer for the file part
+	std::uint64_t m_pos = 0;		  // bytes handed to fi_ptr so far
+	bool m_err = false;
+
+	std::uint64_t total() const
+	{
+		return m_filesize + m_mem.size();
+	}
+
+	// move the bytes in memory to the end of the file
+	bool spill()
+	{
+		if (!m_file && !(m_file = tmpfile()))
+			return false;
+		if (!m_mem.empty() && fwrite(m_mem.data(), m_mem.size(), 1, m_file) != 1)
+			return false;
+		m_filesize += m_mem.size();
+		m_mem.clear();
+		return true;
+	}
+
+	bool underflow() override
+	{
+		if (m_pos < m_filesize)
+		{
+			std::uint64_t len = m_filesize - m_pos;
+			if (len > m_chunk)
+				len = m_chunk;
+			m_buf.resize((size_t)len);
+			if (spool_seek(m_file, m_pos) != 0 || fread(m_buf.data(), (size_t)len, 1, m_file) != 1)
+			{
+				m_err = true;
+				return false;
+			}
+			fi_ptr = m_buf.data();
+			fi_remain = (std::uint32_t)len;
+			m_pos += len;
+			return true;
+		}
+		if (m_pos >= total())
+			return false;
+		std::uint64_t len = total() - m_pos;
+		if (len > (1u << 30)) // fi_remain is only 32 bits
+			len = (1u << 30);
+		fi_ptr = m_mem.data() + (m_pos - m_filesize);
+		fi_remain = (std::uint32_t)len;
+		m_pos += len;
+		return true;
+	}
+
+	bool discard(std::uint32_t len) override
+	{
+		if (len > total() - m_pos)
+		{
+			m_pos = total();
+			return false;
+		}
+		m_pos += len;
+		return true;
+	}
+
+public:
+	// false if the temp file cannot be written
+	bool append(const void *data, size_t len)
+	{
+		if (m_err)
+			return false;
+		if (m_mem.size() + len > m_memmax)
+		{
+			if (!spill())
+			{
+				m_err = true;
+				return false;
+			}
+			if (len > m_memmax)
+			{
+				if (len && fwrite(data, len, 1, m_file) != 1)
+				{
+					m_err = true;
+					return false;
+				}
+				m_filesize += len;
+				return true;
+			}
+		}
+		m_mem.insert(m_mem.end(), (const unsigned char *)data, (const unsigned char *)data + len);
+		return true;
+	}
+
+	// bytes appended
+	std::uint64_t size() const
+	{
+		return total();
+	}
+
+	// some of it is on disk
+	bool spilled() const
+	{
+		return m_filesize > 0;
+	}
+
+	// a write or a read of the temp file failed
+	bool failed() const
+	{
+		return m_err;
+	}
+
+	bool opened() const override
+	{
+		return true;
+	}
+
+	bool eof() const override
+	{
+		return (m_pos >= total()) && (fi_remain == 0);
+	}
+
+	void rewind() override
+	{
+		m_pos = 0;
+		fi_remain = 0;
+	}
+
+	std::uint64_t tell() const override
+	{
+		return m_pos - fi_remain;
+	}
+
+	bool seek(std::uint64_t off) override
+	{
+		if (off > total())
+			return false;
+		m_pos = off;
+		fi_remain = 0;
+		return true;
+	}
+};
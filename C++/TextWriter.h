@@ -0,0 +1,226 @@
+#pragma once
+#include "GZReader.h"
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <functional>
+#include <string_view>
+#include <vector>
+#include <fcntl.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// Buffered text output of the csv exporters. Numbers are formatted by std::to_chars
+// straight into a 1 MB buffer, which goes out with one write(2), or one GZWriter::write,
+// each time it fills. The number formats are the printf ones the tools have always
+// printed: fixed() is "%f" and general() is "%g", to the same digits.
+class TextWriter
+{
+	static const std::size_t BUFSIZE = 1 << 20;
+	static const std::size_t MAXNUM = 400; // longest number, "%f" of -DBL_MAX
+
+	std::vector<char> m_buf;
+	std::size_t m_len = 0;
+	int m_fd = -1;
+	bool m_own = false; // close m_fd at the end
+	GZWriter *m_gz = nullptr;
+	std::function<bool(const char *, std::size_t)> m_sink;
+	bool m_ok = true;
+
+	bool out(const char *p, std::size_t len)
+	{
+		if (m_gz)
+			return m_gz->write(p, (std::uint32_t)len) || !len;
+		if (m_sink)
+			return m_sink(p, len);
+		while (len)
+		{
+#ifdef _WIN32
+			int n = _write(m_fd, p, (unsigned)(len > (1u << 30) ? (1u << 30) : len));
+#else
+			ssize_t n = ::write(m_fd, p, len);
+#endif
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return false;
+			p += n;
+			len -= (std::size_t)n;
+		}
+		return true;
+	}
+
+	// room for n more bytes
+	char *room(std::size_t n)
+	{
+		if (m_len + n > BUFSIZE)
+			flush();
+		return m_buf.data() + m_len;
+	}
+
+	// the slow way, for what to_chars found no room for
+	void printf_num(const char *fmt, int prec, double v)
+	{
+		int n = snprintf(nullptr, 0, fmt, prec, v);
+		if (n <= 0)
+			return;
+		std::vector<char> tmp(n + 1);
+		snprintf(tmp.data(), tmp.size(), fmt, prec, v);
+		put(std::string_view(tmp.data(), n));
+	}
+
+public:
+	// stdout is TextWriter(1)
+	explicit TextWriter(int fd) : m_buf(BUFSIZE), m_fd(fd) {}
+
+	// a new file, truncated
+	explicit TextWriter(const char *path) : m_buf(BUFSIZE), m_own(true)
+	{
+#ifdef _WIN32
+		m_fd = _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_TEXT, 0644);
+#else
+		m_fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+		m_ok = m_fd >= 0;
+	}
+
+	// into a compressed file. the caller closes it after this writer
+	explicit TextWriter(GZWriter &gz) : m_buf(BUFSIZE), m_gz(&gz) {}
+
+	// each full buffer is handed to sink(p, len), e.g. to another thread
+	explicit TextWriter(std::function<bool(const char *, std::size_t)> sink) : m_buf(BUFSIZE), m_sink(std::move(sink)) {}
+
+	TextWriter(const TextWriter &) = delete;
+	TextWriter &operator=(const TextWriter &) = delete;
+
+	~TextWriter()
+	{
+		close();
+	}
+
+	// false once a write failed or the file could not be opened
+	bool good() const
+	{
+		return m_ok;
+	}
+
+	bool flush()
+	{
+		if (m_len && m_ok)
+			m_ok = out(m_buf.data(), m_len);
+		m_len = 0;
+		return m_ok;
+	}
+
+	bool close()
+	{
+		flush();
+		if (m_own && m_fd >= 0)
+		{
+#ifdef _WIN32
+			_close(m_fd);
+#else
+			::close(m_fd);
+#endif
+		}
+		m_fd = -1;
+		m_own = false;
+		return m_ok;
+	}
+
+	void put(char c)
+	{
+		*room(1) = c;
+		m_len++;
+	}
+
+	void put(std::string_view s)
+	{
+		if (s.size() > BUFSIZE)
+		{
+			flush();
+			if (m_ok)
+				m_ok = out(s.data(), s.size());
+			return;
+		}
+		memcpy(room(s.size()), s.data(), s.size());
+		m_len += s.size();
+	}
+
+	// "%.*f"
+	void fixed(double v, int prec = 6)
+	{
+		char *p = room(MAXNUM);
+		auto r = std::to_chars(p, m_buf.data() + BUFSIZE, v, std::chars_format::fixed, prec);
+		if (r.ec == std::errc())
+			m_len = r.ptr - m_buf.data();
+		else // a precision too long for the rest of the buffer
+			printf_num("%.*f", prec, v);
+	}
+
+	// "%g"
+	void general(double v)
+	{
+		char *p = room(MAXNUM);
+		auto r = std::to_chars(p, m_buf.data() + BUFSIZE, v, std::chars_format::general, 6);
+		if (r.ec == std::errc())
+			m_len = r.ptr - m_buf.data();
+		else
+			printf_num("%.*g", 6, v);
+	}
+
+	// "%d", "%llu" etc., or "%0*d" with a width
+	template <typename T>
+	void integer(T v, int width = 0)
+	{
+		char *p = room(MAXNUM);
+		char *end = m_buf.data() + BUFSIZE;
+		if (width > 0)
+		{
+			char tmp[24] = {};
+			auto r = std::to_chars(tmp, tmp + sizeof(tmp), v);
+			int len = (int)(r.ptr - tmp);
+			int sign = v < 0;
+			if (sign)
+				*p++ = '-';
+			for (int i = len; i < width && i < 64; i++)
+				*p++ = '0';
+			memcpy(p, tmp + sign, len - sign);
+			m_len = p + len - sign - m_buf.data();
+			return;
+		}
+		auto r = std::to_chars(p, end, v);
+		m_len = r.ptr - m_buf.data();
+	}
+
+	// a csv field, escaped like escape_csv() in Util.h: the first quote is doubled and a
+	// field with a comma or a line break is quoted. the scan for those is one branch-free pass
+	void csv(std::string_view s)
+	{
+		unsigned char special = 0;
+		for (char c : s)
+			special |= (c == ',') | (c == '\n') | (c == '\r') | (c == '"');
+		if (!special)
+		{
+			put(s);
+			return;
+		}
+		bool quote = s.find_first_of(",\n\r") != std::string_view::npos;
+		if (quote)
+			put('"');
+		std::size_t qpos = s.find('"');
+		if (qpos != std::string_view::npos)
+		{
+			put(s.substr(0, qpos));
+			put('"');
+			put(s.substr(qpos));
+		}
+		else
+			put(s);
+		if (quote)
+			put('"');
+	}
+};
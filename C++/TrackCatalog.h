@@ -0,0 +1,200 @@
+#pragma once
+#include "VitalPacket.h"
+#include "VitalIndex.h"
+#include "VitalDecode.h"
+#include <cfloat>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+// One track of a TrackCatalog. Names are indices into the catalog's string table,
+// so that the descriptor stays small and the whole table is one array.
+struct TrackDesc
+{
+	bool info = false;		  // a trkinfo was read. false for tids only seen in recs
+	bool full = false;		  // every trkinfo field up to did was present
+	std::uint8_t rectype = 0; // 1: wav, 2: num, 5: str
+	std::uint8_t recfmt = 0;  // 1: float, 2: double, 3: char, 4: byte, 5: short, 6: word, 7: long, 8: dword
+	std::uint8_t fmtsize = 4; // bytes per wav sample
+	std::uint8_t montype = 0;
+	float srate = 0.f;
+	double gain = 1.0;
+	double offset = 0.0;
+	float mindisp = 0.f;
+	float maxdisp = 0.f;
+	std::uint32_t col = 0; // color
+	std::uint32_t did = 0;
+	std::uint32_t tname = 0; // string table
+	std::uint32_t unit = 0;
+	std::uint32_t dname = 0; // device name when the trkinfo was read
+
+	// free for the tools
+	double dtstart = 0.0;	// time range of the recs seen. reset to DBL_MAX, 0 by each trkinfo
+	double dtend = 0.0;
+	std::int32_t slot = -1; // output column, file etc. of the track
+};
+
+// The tracks and devices of a vital file, indexed by tid. Replaces the std::map
+// per field that the tools used to keep: a rec finds its track with one indexed load.
+class TrackCatalog
+{
+	std::vector<TrackDesc> m_trks; // grows to the largest tid
+	std::vector<std::string> m_strs{std::string()}; // [0] is ""
+	std::map<std::string, std::uint32_t, std::less<>> m_strids; // index of each string in m_strs
+	struct Device
+	{
+		std::uint32_t did;
+		std::uint32_t dname;
+	};
+	std::vector<Device> m_devs;
+	static const TrackDesc &none()
+	{
+		static const TrackDesc desc;
+		return desc;
+	}
+
+	std::uint32_t str(std::string_view s)
+	{
+		if (s.empty())
+			return 0;
+		// a file repeats the same trkinfo and devinfo, so each string is stored once
+		auto it = m_strids.find(s);
+		if (it != m_strids.end())
+			return it->second;
+		m_strs.emplace_back(s);
+		std::uint32_t id = (std::uint32_t)m_strs.size() - 1;
+		m_strids.emplace(m_strs.back(), id);
+		return id;
+	}
+
+	// a new trkinfo of tid. the slot of the tool stays
+	TrackDesc &reset(std::uint16_t tid)
+	{
+		TrackDesc &t = at(tid);
+		std::int32_t slot = t.slot;
+		t = TrackDesc();
+		t.info = true;
+		t.dtstart = DBL_MAX;
+		t.slot = slot;
+		return t;
+	}
+
+public:
+	// read only. a tid that was never added reads as a track without trkinfo
+	const TrackDesc &operator[](std::uint16_t tid) const
+	{
+		return tid < m_trks.size() ? m_trks[tid] : none();
+	}
+
+	// writable, created without trkinfo if needed
+	TrackDesc &at(std::uint16_t tid)
+	{
+		if (tid >= m_trks.size())
+			m_trks.resize((std::size_t)tid + 1);
+		return m_trks[tid];
+	}
+
+	// one past the largest tid
+	std::size_t size() const
+	{
+		return m_trks.size();
+	}
+
+	bool has(std::uint16_t tid) const
+	{
+		return (*this)[tid].info;
+	}
+
+	// tids of the tracks with a trkinfo, in order
+	std::vector<std::uint16_t> tids() const
+	{
+		std::vector<std::uint16_t> ret;
+		for (std::size_t tid = 0; tid < m_trks.size(); tid++)
+			if (m_trks[tid].info)
+				ret.push_back((std::uint16_t)tid);
+		return ret;
+	}
+
+	const std::string &tname(std::uint16_t tid) const
+	{
+		return m_strs[(*this)[tid].tname];
+	}
+	const std::string &dname(std::uint16_t tid) const
+	{
+		return m_strs[(*this)[tid].dname];
+	}
+	const std::string &unit(std::uint16_t tid) const
+	{
+		return m_strs[(*this)[tid].unit];
+	}
+
+	// a devinfo packet. a repeated did replaces the name
+	void add_device(const DevInfoView &di)
+	{
+		for (auto &d : m_devs)
+		{
+			if (d.did == di.did)
+			{
+				d.dname = str(di.dname);
+				return;
+			}
+		}
+		m_devs.push_back({di.did, str(di.dname)});
+	}
+
+	// name of a device, "" if there was no devinfo for it
+	const std::string &device(std::uint32_t did) const
+	{
+		for (auto &d : m_devs)
+			if (d.did == did)
+				return m_strs[d.dname];
+		return m_strs[0];
+	}
+
+	// a trkinfo packet. the device name is taken from the devinfos read so far
+	TrackDesc &add(const TrkInfoView &ti)
+	{
+		TrackDesc &t = reset(ti.tid);
+		t.full = ti.full;
+		t.rectype = ti.rectype;
+		t.recfmt = ti.recfmt;
+		t.fmtsize = (std::uint8_t)recfmt_size(ti.recfmt);
+		t.montype = ti.montype;
+		t.srate = ti.srate;
+		t.gain = ti.adc_gain;
+		t.offset = ti.adc_offset;
+		t.mindisp = ti.mindisp;
+		t.maxdisp = ti.maxdisp;
+		t.col = ti.col;
+		t.did = ti.did;
+		t.tname = str(ti.tname);
+		t.unit = str(ti.unit);
+		for (auto &d : m_devs)
+			if (d.did == ti.did)
+				t.dname = d.dname;
+		return t;
+	}
+
+	// a track of a sidecar index, with the device name it recorded
+	TrackDesc &add(const VitalIndex::Track &trk)
+	{
+		TrackDesc &t = reset(trk.tid);
+		t.full = trk.full;
+		t.rectype = trk.rectype;
+		t.recfmt = trk.recfmt;
+		t.fmtsize = (std::uint8_t)recfmt_size(trk.recfmt);
+		t.montype = trk.montype;
+		t.srate = trk.srate;
+		t.gain = trk.gain;
+		t.offset = trk.offset;
+		t.mindisp = trk.mindisp;
+		t.maxdisp = trk.maxdisp;
+		t.col = trk.col;
+		t.did = trk.did;
+		t.tname = str(trk.tname);
+		t.unit = str(trk.unit);
+		t.dname = str(trk.dname);
+		return t;
+	}
+};
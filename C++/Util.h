@@ -1,9 +1,12 @@
 #pragma once
 #include <string>
+#include <cstring>
 #include <memory>
 #include <stdarg.h>
 #include <regex>
 #include <time.h>
+#include <vector>
+#include <filesystem>
 using namespace std;
 
 inline bool is_numeric(string s)
@@ -82,6 +85,32 @@ string basename(string path)
     return path;
 }
 
+inline bool is_vital(const string &path)
+{
+    return path.size() > 6 && path.compare(path.size() - 6, 6, ".vital") == 0;
+}
+
+// recursively collect the vital files in a directory. names starting with a dot are skipped
+inline void scan_vital_files(vector<string> &out, const string &dir)
+{
+    error_code ec;
+    for (filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+    {
+        string name = it->path().filename().string();
+        if (name[0] == '.')
+            continue;
+        string path = dir + "/" + name;
+        error_code ec_stat;
+        bool is_dir = filesystem::is_directory(path, ec_stat); // follows links
+        if (ec_stat)
+            continue;
+        if (is_dir)
+            scan_vital_files(out, path);
+        else if (is_vital(path))
+            out.push_back(path);
+    }
+}
+
 std::string string_format(const std::string fmt_str, ...)
 {
     int final_n, n = ((int)fmt_str.size()) * 2; // Reserve two times as much as the length of the fmt_str
@@ -0,0 +1,311 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define VITAL_SSE2
+#endif
+#if defined(VITAL_SSE2) && defined(__GNUC__)
+#include <immintrin.h>
+#define VITAL_AVX2 // compiled for avx2 per function and picked at run time
+#endif
+
+// Wave samples of a rec packet to floats. float and double samples are taken
+// as they are; integer samples become float(v) * gain + offset, in float
+// arithmetic like vital_recs. The SIMD kernels give the same bits as the scalar one.
+
+// bytes per sample. unknown formats are read as float like before
+inline std::uint32_t recfmt_size(std::uint8_t recfmt)
+{
+	switch (recfmt)
+	{
+	case 2:
+		return 8;
+	case 3:
+	case 4:
+		return 1;
+	case 5:
+	case 6:
+		return 2;
+	}
+	return 4;
+}
+
+template <typename T>
+inline T load_sample(const unsigned char *p)
+{
+	T v;
+	memcpy(&v, p, sizeof(T));
+	return v;
+}
+
+// one sample, as vital_recs reads it one at a time: float and double as they are,
+// integers as float(v) * gain + offset in float arithmetic. decode_samples gives
+// float() of this for every sample
+inline double sample_value(const unsigned char *p, std::uint8_t recfmt, float gain, float offset)
+{
+	switch (recfmt)
+	{
+	case 2:
+		return load_sample<double>(p);
+	case 3:
+		return float(load_sample<std::int8_t>(p)) * gain + offset;
+	case 4:
+		return float(load_sample<std::uint8_t>(p)) * gain + offset;
+	case 5:
+		return float(load_sample<std::int16_t>(p)) * gain + offset;
+	case 6:
+		return float(load_sample<std::uint16_t>(p)) * gain + offset;
+	case 7:
+		return float(load_sample<std::int32_t>(p)) * gain + offset;
+	case 8:
+		return float(load_sample<std::uint32_t>(p)) * gain + offset;
+	}
+	return load_sample<float>(p);
+}
+
+inline void decode_samples_scalar(const unsigned char *src, std::uint32_t n, std::uint8_t recfmt, float gain, float offset, float *dst)
+{
+	std::uint32_t i = 0;
+	switch (recfmt)
+	{
+	case 2:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<double>(src + i * 8));
+		break;
+	case 3:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<std::int8_t>(src + i)) * gain + offset;
+		break;
+	case 4:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<std::uint8_t>(src + i)) * gain + offset;
+		break;
+	case 5:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<std::int16_t>(src + i * 2)) * gain + offset;
+		break;
+	case 6:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<std::uint16_t>(src + i * 2)) * gain + offset;
+		break;
+	case 7:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<std::int32_t>(src + i * 4)) * gain + offset;
+		break;
+	case 8:
+		for (; i < n; i++)
+			dst[i] = float(load_sample<std::uint32_t>(src + i * 4)) * gain + offset;
+		break;
+	default:
+		memcpy(dst, src, n * sizeof(float));
+		break;
+	}
+}
+
+#ifdef VITAL_SSE2
+// whole steps of 8 (4 for dword) samples. returns how many were done; the caller finishes the tail
+inline std::uint32_t decode_samples_sse2(const unsigned char *src, std::uint32_t n, std::uint8_t recfmt, float gain, float offset, float *dst)
+{
+	const __m128 g = _mm_set1_ps(gain);
+	const __m128 o = _mm_set1_ps(offset);
+	const __m128i zero = _mm_setzero_si128();
+	auto store = [&](float *p, __m128i lo, __m128i hi)
+	{
+		_mm_storeu_ps(p, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(lo), g), o));
+		_mm_storeu_ps(p + 4, _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(hi), g), o));
+	};
+	// 8 int16 lanes to two int32 halves
+	auto widen_s16 = [&](float *p, __m128i x)
+	{
+		store(p, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16), _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+	};
+	auto widen_u16 = [&](float *p, __m128i x)
+	{
+		store(p, _mm_unpacklo_epi16(x, zero), _mm_unpackhi_epi16(x, zero));
+	};
+
+	std::uint32_t i = 0;
+	switch (recfmt)
+	{
+	case 2:
+		for (; i + 8 <= n; i += 8)
+		{
+			const double *p = (const double *)(src + i * 8);
+			for (int j = 0; j < 8; j += 4)
+			{
+				__m128 a = _mm_cvtpd_ps(_mm_loadu_pd(p + j));
+				__m128 b = _mm_cvtpd_ps(_mm_loadu_pd(p + j + 2));
+				_mm_storeu_ps(dst + i + j, _mm_movelh_ps(a, b));
+			}
+		}
+		break;
+	case 3:
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i x = _mm_loadl_epi64((const __m128i *)(src + i));
+			widen_s16(dst + i, _mm_srai_epi16(_mm_unpacklo_epi8(x, x), 8));
+		}
+		break;
+	case 4:
+		for (; i + 8 <= n; i += 8)
+		{
+			__m128i x = _mm_loadl_epi64((const __m128i *)(src + i));
+			widen_u16(dst + i, _mm_unpacklo_epi8(x, zero));
+		}
+		break;
+	case 5:
+		for (; i + 8 <= n; i += 8)
+			widen_s16(dst + i, _mm_loadu_si128((const __m128i *)(src + i * 2)));
+		break;
+	case 6:
+		for (; i + 8 <= n; i += 8)
+			widen_u16(dst + i, _mm_loadu_si128((const __m128i *)(src + i * 2)));
+		break;
+	case 7:
+		for (; i + 8 <= n; i += 8)
+			store(dst + i, _mm_loadu_si128((const __m128i *)(src + i * 4)), _mm_loadu_si128((const __m128i *)(src + i * 4 + 16)));
+		break;
+	case 8:
+		// no unsigned conversion in sse2: float(hi 16 bits) * 65536 + float(lo 16 bits) rounds once, like float(v)
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128i x = _mm_loadu_si128((const __m128i *)(src + i * 4));
+			__m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(x, 16)), _mm_set1_ps(65536.f));
+			__m128 lo = _mm_cvtepi32_ps(_mm_and_si128(x, _mm_set1_epi32(0xffff)));
+			_mm_storeu_ps(dst + i, _mm_add_ps(_mm_mul_ps(_mm_add_ps(hi, lo), g), o));
+		}
+		break;
+	}
+	return i;
+}
+#endif
+
+#ifdef VITAL_AVX2
+__attribute__((target("avx2"))) inline std::uint32_t decode_samples_avx2(const unsigned char *src, std::uint32_t n, std::uint8_t recfmt, float gain, float offset, float *dst)
+{
+	const __m256 g = _mm256_set1_ps(gain);
+	const __m256 o = _mm256_set1_ps(offset);
+	// separate mul and add: a fused multiply-add would round differently from the scalar code
+	auto store = [&](float *p, __m256i x) __attribute__((target("avx2")))
+	{
+		_mm256_storeu_ps(p, _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(x), g), o));
+	};
+	auto load8 = [](const unsigned char *p) __attribute__((target("avx2")))
+	{
+		return _mm_loadl_epi64((const __m128i *)p);
+	};
+	auto load16 = [](const unsigned char *p) __attribute__((target("avx2")))
+	{
+		return _mm_loadu_si128((const __m128i *)p);
+	};
+
+	std::uint32_t i = 0;
+	switch (recfmt)
+	{
+	case 2:
+		for (; i + 8 <= n; i += 8)
+		{
+			const double *p = (const double *)(src + i * 8);
+			__m128 a = _mm256_cvtpd_ps(_mm256_loadu_pd(p));
+			__m128 b = _mm256_cvtpd_ps(_mm256_loadu_pd(p + 4));
+			_mm256_storeu_ps(dst + i, _mm256_insertf128_ps(_mm256_castps128_ps256(a), b, 1));
+		}
+		break;
+	case 3:
+		for (; i + 8 <= n; i += 8)
+			store(dst + i, _mm256_cvtepi8_epi32(load8(src + i)));
+		break;
+	case 4:
+		for (; i + 8 <= n; i += 8)
+			store(dst + i, _mm256_cvtepu8_epi32(load8(src + i)));
+		break;
+	case 5:
+		for (; i + 8 <= n; i += 8)
+			store(dst + i, _mm256_cvtepi16_epi32(load16(src + i * 2)));
+		break;
+	case 6:
+		for (; i + 8 <= n; i += 8)
+			store(dst + i, _mm256_cvtepu16_epi32(load16(src + i * 2)));
+		break;
+	case 7:
+		for (; i + 8 <= n; i += 8)
+			store(dst + i, _mm256_loadu_si256((const __m256i *)(src + i * 4)));
+		break;
+	case 8:
+		for (; i + 8 <= n; i += 8)
+		{
+			__m256i x = _mm256_loadu_si256((const __m256i *)(src + i * 4));
+			__m256 hi = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(x, 16)), _mm256_set1_ps(65536.f));
+			__m256 lo = _mm256_cvtepi32_ps(_mm256_and_si256(x, _mm256_set1_epi32(0xffff)));
+			_mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(hi, lo), g), o));
+		}
+		break;
+	}
+	return i;
+}
+
+inline bool cpu_has_avx2()
+{
+	static const bool has = __builtin_cpu_supports("avx2");
+	return has;
+}
+#endif
+
+// decode n samples of 'recfmt' at src into dst. src needs n * recfmt_size(recfmt) bytes
+inline void decode_samples(const unsigned char *src, std::uint32_t n, std::uint8_t recfmt, float gain, float offset, float *dst)
+{
+	std::uint32_t done = 0;
+	if (recfmt >= 2 && recfmt <= 8)
+	{
+#ifdef VITAL_AVX2
+		if (cpu_has_avx2())
+			done = decode_samples_avx2(src, n, recfmt, gain, offset, dst);
+		else
+#endif
+#ifdef VITAL_SSE2
+			done = decode_samples_sse2(src, n, recfmt, gain, offset, dst);
+#endif
+	}
+	decode_samples_scalar(src + done * recfmt_size(recfmt), n - done, recfmt, gain, offset, dst + done);
+}
+
+// vital_s3 calibrates every format, float and double too: float(v) * gain + offset
+// in double arithmetic, with the gain kept as a double. n samples of src into dst
+inline void calibrate_samples(const unsigned char *src, std::uint32_t n, std::uint8_t recfmt, double gain, float offset, float *dst)
+{
+	std::uint32_t size = recfmt_size(recfmt);
+	for (std::uint32_t i = 0; i < n; i++)
+	{
+		const unsigned char *p = src + i * size;
+		float fval;
+		switch (recfmt)
+		{
+		case 2:
+			fval = float(load_sample<double>(p));
+			break;
+		case 3:
+			fval = float(load_sample<std::int8_t>(p));
+			break;
+		case 4:
+			fval = float(load_sample<std::uint8_t>(p));
+			break;
+		case 5:
+			fval = float(load_sample<std::int16_t>(p));
+			break;
+		case 6:
+			fval = float(load_sample<std::uint16_t>(p));
+			break;
+		case 7:
+			fval = float(load_sample<std::int32_t>(p));
+			break;
+		case 8:
+			fval = float(load_sample<std::uint32_t>(p));
+			break;
+		default:
+			fval = load_sample<float>(p);
+			break;
+		}
+		dst[i] = float(fval * gain + offset);
+	}
+}
@@ -0,0 +1,252 @@
+#pragma once
+#include "GZParWriter.h"
+#include "VitalPacket.h"
+#include <cmath>
+#include <random>
+
+// Synthetic vital files for benchmarks: a chosen mix of wave, numeric and string
+// tracks with one wave record per track per second, like Vital Recorder writes them.
+// The same spec always gives the same file.
+struct VitalGenSpec
+{
+	double hours = 1.0;
+	unsigned nwav = 4;
+	unsigned nnum = 8;
+	unsigned nstr = 1;
+	double srate = 500; // wave tracks, 100 - 4000 Hz
+	std::vector<std::uint8_t> recfmts = {1}; // cycled over the wave tracks. 1: float ... 8: dword
+	double num_interval = 2.0; // sec between numeric values
+	double str_interval = 600.0; // sec between events
+	std::uint32_t seed = 1;
+	double dtstart = 1600000000.0;
+};
+
+struct VitalGenStats
+{
+	std::uint64_t recs = 0;  // rec packets
+	std::uint64_t bytes = 0; // uncompressed file size
+};
+
+class VitalGen
+{
+	GZParWriter &m_fw;
+	VitalGenStats &m_stats;
+
+	void packet(std::uint8_t type, const std::vector<unsigned char> &data)
+	{
+		std::uint32_t len = (std::uint32_t)data.size();
+		unsigned char hdr[PacketHead::size];
+		PacketHead::encode(hdr, type, len);
+		m_fw.write(hdr, PacketHead::size);
+		m_fw.write(data.data(), len);
+		m_stats.bytes += PacketHead::size + len;
+		if (type == 1)
+			m_stats.recs++;
+	}
+
+	template <typename T>
+	static void put(std::vector<unsigned char> &v, T x)
+	{
+		v.insert(v.end(), (const unsigned char *)&x, (const unsigned char *)&x + sizeof(T));
+	}
+
+	static std::uint32_t fmtsize(std::uint8_t recfmt)
+	{
+		switch (recfmt)
+		{
+		case 2:
+			return 8;
+		case 3:
+		case 4:
+			return 1;
+		case 5:
+		case 6:
+			return 2;
+		}
+		return 4;
+	}
+
+	// one sample of a signal in -1 .. 1 stored in 'recfmt' with gain 1/100 (integers only)
+	static void put_sample(std::vector<unsigned char> &v, std::uint8_t recfmt, double x)
+	{
+		switch (recfmt)
+		{
+		case 1:
+			put(v, (float)x);
+			break;
+		case 2:
+			put(v, x);
+			break;
+		case 3:
+			put(v, (std::int8_t)std::lround(x * 100));
+			break;
+		case 4:
+			put(v, (std::uint8_t)std::lround(x * 100 + 128));
+			break;
+		case 5:
+			put(v, (std::int16_t)std::lround(x * 100));
+			break;
+		case 6:
+			put(v, (std::uint16_t)std::lround(x * 100 + 32768));
+			break;
+		case 7:
+			put(v, (std::int32_t)std::lround(x * 100));
+			break;
+		default:
+			put(v, (std::uint32_t)std::lround(x * 100 + 32768));
+			break;
+		}
+	}
+
+public:
+	VitalGen(GZParWriter &fw, VitalGenStats &stats) : m_fw(fw), m_stats(stats) {}
+
+	void write(const VitalGenSpec &spec)
+	{
+		std::mt19937 rnd(spec.seed);
+		std::normal_distribution<double> noise(0.0, 0.02);
+		double dtend = spec.dtstart + spec.hours * 3600;
+
+		// header: dgmt, inst_id, prog_ver, dtstart, dtend
+		std::vector<unsigned char> hdr;
+		put(hdr, (std::int16_t)-540);
+		put(hdr, (std::uint32_t)0);
+		put(hdr, (std::uint32_t)0);
+		put(hdr, spec.dtstart);
+		put(hdr, dtend);
+		std::uint32_t ver = 3;
+		std::uint16_t hdrlen = (std::uint16_t)hdr.size();
+		m_fw.write("VITA", 4);
+		m_fw.write(&ver, 4);
+		m_fw.write(&hdrlen, 2);
+		m_fw.write(hdr.data(), hdrlen);
+		m_stats.bytes += 10 + hdrlen;
+
+		const char *devs[] = {"", "WaveDev", "NumDev"};
+		const char *ports[] = {"", "COM1", "COM2"};
+		for (std::uint32_t did = 1; did <= 2; did++)
+		{
+			DevInfoView di;
+			di.did = did;
+			di.dtype = di.dname = devs[did];
+			di.port = ports[did];
+			std::vector<unsigned char> d;
+			di.encode(d);
+			packet(9, d);
+		}
+
+		struct Trk
+		{
+			std::uint16_t tid;
+			std::uint8_t rectype, recfmt;
+			double phase;
+		};
+		std::vector<Trk> trks;
+		std::uint16_t tid = 1;
+		for (unsigned i = 0; i < spec.nwav + spec.nnum + spec.nstr; i++, tid++)
+		{
+			Trk t{tid, 1, 1, 0.37 * i};
+			std::string tname;
+			std::uint32_t did = 1;
+			double gain = 1, offset = 0;
+			if (i < spec.nwav)
+			{
+				t.recfmt = spec.recfmts.empty() ? 1 : spec.recfmts[i % spec.recfmts.size()];
+				tname = "WAV" + std::to_string(i + 1);
+				if (t.recfmt > 2)
+				{
+					gain = 0.01;
+					offset = t.recfmt == 4 ? -1.28 : (t.recfmt == 6 || t.recfmt == 8) ? -327.68 : 0.0;
+				}
+			}
+			else if (i < spec.nwav + spec.nnum)
+			{
+				t.rectype = 2;
+				tname = "NUM" + std::to_string(i - spec.nwav + 1);
+				did = 2;
+			}
+			else
+			{
+				t.rectype = 5;
+				t.recfmt = 0;
+				tname = "EVT" + std::to_string(i - spec.nwav - spec.nnum + 1);
+				did = 0;
+			}
+			TrkInfoView ti;
+			ti.tid = t.tid;
+			ti.rectype = t.rectype;
+			ti.recfmt = t.recfmt;
+			ti.tname = tname;
+			ti.unit = t.rectype == 2 ? "/min" : "";
+			ti.mindisp = -1.0f;
+			ti.maxdisp = 1.0f;
+			ti.col = 0xff00ff00;
+			ti.srate = (float)(t.rectype == 1 ? spec.srate : 0);
+			ti.adc_gain = gain;
+			ti.adc_offset = offset;
+			ti.did = did;
+			ti.full = true;
+			std::vector<unsigned char> d;
+			ti.encode(d);
+			packet(0, d);
+			trks.push_back(t);
+		}
+
+		// records, second by second
+		std::uint64_t nsec = (std::uint64_t)std::ceil(spec.hours * 3600);
+		std::uint64_t num_every = (std::uint64_t)std::max(1.0, spec.num_interval);
+		std::uint64_t str_every = (std::uint64_t)std::max(1.0, spec.str_interval);
+		std::vector<unsigned char> d;
+		for (std::uint64_t sec = 0; sec < nsec; sec++)
+		{
+			double dt = spec.dtstart + sec;
+			for (auto &t : trks)
+			{
+				d.clear();
+				if (t.rectype == 1)
+				{
+					// a whole number of samples per record, also for fractional rates
+					std::uint32_t first = (std::uint32_t)std::floor(sec * spec.srate);
+					std::uint32_t nsamp = (std::uint32_t)std::floor((sec + 1) * spec.srate) - first;
+					RecHead::append(d, 10, dt + (first - sec * spec.srate) / spec.srate, t.tid);
+					put(d, nsamp);
+					d.reserve(d.size() + nsamp * fmtsize(t.recfmt));
+					for (std::uint32_t i = 0; i < nsamp; i++)
+					{
+						double x = 0.8 * std::sin(2 * M_PI * 1.2 * (first + i) / spec.srate + t.phase) + noise(rnd);
+						put_sample(d, t.recfmt, std::max(-1.0, std::min(1.0, x)));
+					}
+				}
+				else if (t.rectype == 2)
+				{
+					if ((sec + t.tid) % num_every)
+						continue;
+					RecHead::append(d, 10, dt + 0.5, t.tid);
+					put(d, (float)std::lround(80 + 20 * std::sin(sec / 600.0 + t.phase) + noise(rnd) * 50));
+				}
+				else
+				{
+					if ((sec + 7) % str_every)
+						continue;
+					static const char *evts[] = {"Case started", "Propofol", "Intubation", "Remi", "Incision"};
+					RecHead::append(d, 10, dt, t.tid);
+					put(d, (std::uint32_t)0);
+					append_str(d, evts[(sec / str_every) % 5]);
+				}
+				packet(1, d);
+			}
+		}
+	}
+};
+
+// write a synthetic file. false if it cannot be written
+inline bool vital_gen(const std::string &path, const VitalGenSpec &spec, VitalGenStats &stats)
+{
+	GZParWriter fw(path.c_str(), "w1b");
+	if (!fw.opened())
+		return false;
+	stats = VitalGenStats();
+	VitalGen(fw, stats).write(spec);
+	fw.close();
+	return fw.good();
+}
@@ -0,0 +1,460 @@
+#pragma once
+#include "GZIndex.h"
+#include "VitalPacket.h"
+#include <algorithm>
+#include <cfloat>
+#include <map>
+
+// Sidecar index of a vital file (file.vital.idx), filled in a single scan.
+// It holds the header, the device map, the track catalog with per-track time
+// bounds and value statistics, and the uncompressed offsets of the rec packets
+// of every track, so that tools can skip their metadata pass and jump to the
+// records they need. Like the .gzi sidecar, it is rejected when the size or
+// mtime of the vital file changed. Built in bulk by vital_index.
+class VitalIndex
+{
+public:
+	struct Device
+	{
+		std::uint32_t did = 0;
+		std::string dtype;
+		std::string dname; // dtype when empty in the file
+		std::string port;
+	};
+
+	struct Track
+	{
+		// the last trkinfo of the track. info is false if the tid only appeared in recs
+		bool info = false;
+		bool full = false; // every trkinfo field up to did was present
+		std::uint16_t tid = 0;
+		std::uint8_t rectype = 0; // 1: wav, 2: num, 5: str
+		std::uint8_t recfmt = 0;
+		std::string tname;
+		std::string unit;
+		float mindisp = 0.f;
+		float maxdisp = 0.f;
+		std::uint32_t col = 0;
+		float srate = 0.f;
+		double gain = 1.0;
+		double offset = 0.0;
+		std::uint8_t montype = 0;
+		std::uint32_t did = 0;
+		std::string dname; // device name when the trkinfo was read
+
+		// over the recs with a non-zero time. a wav rec ends nsamp / srate after its start
+		double dtstart = DBL_MAX;
+		double dtend = 0.0;
+		std::uint64_t first = 0; // offset of the first of these recs
+		std::uint64_t nsamp = 0; // wav samples
+
+		// over the recs that follow the trkinfo, as parseVitalFile counts them
+		std::uint64_t count = 0; // num values
+		double sum = 0.0;
+		float minval = 0.f;
+		float maxval = 0.f;
+		std::string firstval; // first num value, or the str values joined by append_firstval
+
+		std::vector<std::uint64_t> recs; // offset of every rec packet, in file order
+
+		bool has_data() const
+		{
+			return dtstart != DBL_MAX;
+		}
+	};
+
+public:
+	// vital header
+	std::uint32_t format_ver = 0;
+	std::int16_t dgmt = 0; // minutes
+	double dtstart = 0.0;
+	double dtend = 0.0;
+	std::uint64_t body = 0; // offset of the first packet
+	double lag = 0.0;		// seconds the most out of order record starts before the end of the ones ahead of it
+
+	std::map<std::uint32_t, Device> devs;
+	std::map<std::uint16_t, Track> trks;
+
+	// identity of the indexed file, to reject stale sidecars
+	std::uint64_t file_size = 0;
+	std::int64_t file_mtime = 0;
+
+protected:
+	static constexpr std::uint32_t VERSION = 4; // 3: firstval keeps repeated str values, 4: lag
+
+	static bool printable(char c)
+	{
+		return (c >= 32 && c < 127) || c == 10 || c == 13 || c == 9;
+	}
+
+	// little-endian image of the index
+	struct Out : std::vector<unsigned char>
+	{
+		template <typename T>
+		void put(const T &x)
+		{
+			insert(end(), (const unsigned char *)&x, (const unsigned char *)&x + sizeof(T));
+		}
+		void put_str(const std::string &s)
+		{
+			put((std::uint32_t)s.size());
+			insert(end(), s.begin(), s.end());
+		}
+		void put_var(std::uint64_t x)
+		{
+			while (x >= 128)
+			{
+				push_back((unsigned char)(x | 128));
+				x >>= 7;
+			}
+			push_back((unsigned char)x);
+		}
+	};
+
+	struct In : PacketCursor
+	{
+		using PacketCursor::PacketCursor;
+		bool get_str(std::string &s)
+		{
+			std::uint32_t len = 0;
+			if (!get(len) || remain() < len)
+				return false;
+			s.assign((const char *)ptr(), len);
+			return skip(len);
+		}
+		bool get_var(std::uint64_t &x)
+		{
+			x = 0;
+			for (int shift = 0; shift < 64; shift += 7)
+			{
+				std::uint8_t b;
+				if (!get(b))
+					return false;
+				x |= (std::uint64_t)(b & 127) << shift;
+				if (!(b & 128))
+					return true;
+			}
+			return false;
+		}
+	};
+
+public:
+	void clear()
+	{
+		format_ver = 0;
+		dgmt = 0;
+		dtstart = dtend = 0.0;
+		body = 0;
+		lag = 0.0;
+		devs.clear();
+		trks.clear();
+	}
+
+	// scan a vital file from its start. false if it is not a vital file
+	bool build(GZReader &gz)
+	{
+		clear();
+		char sign[4];
+		std::uint16_t headerlen = 0;
+		if (gz.read(sign, 4) != 4 || strncmp(sign, "VITA", 4) != 0)
+			return false;
+		if (gz.read(&format_ver, 4) != 4 || gz.read(&headerlen, 2) != 2)
+			return false;
+		std::vector<unsigned char> header(headerlen);
+		if (headerlen && gz.read(header.data(), headerlen) != headerlen)
+			return false;
+		if (headerlen >= 2)
+			memcpy(&dgmt, &header[0], 2);
+		if (headerlen >= 26)
+		{
+			memcpy(&dtstart, &header[10], 8);
+			memcpy(&dtend, &header[18], 8);
+		}
+		body = 10 + headerlen;
+
+		PacketReader pr(gz);
+		PacketView pkt;
+		std::uint64_t pos = gz.tell();
+		double dt_last_end = 0.0; // the latest end of the recs so far
+		for (; pr.next(pkt); pos = gz.tell())
+		{
+			if (pkt.type == 9)
+			{
+				DevInfoView di;
+				if (!di.parse(pkt))
+					continue;
+				Device &dev = devs[di.did];
+				dev.did = di.did;
+				dev.dtype = std::string(di.dtype);
+				dev.dname = std::string(di.dname);
+				dev.port = std::string(di.port);
+			}
+			else if (pkt.type == 0)
+			{
+				TrkInfoView ti;
+				if (!ti.parse(pkt))
+					continue;
+				Track &trk = trks[ti.tid];
+				trk.info = true;
+				trk.full = ti.full;
+				trk.tid = ti.tid;
+				trk.rectype = ti.rectype;
+				trk.recfmt = ti.recfmt;
+				trk.tname = std::string(ti.tname);
+				trk.unit = std::string(ti.unit);
+				trk.mindisp = ti.mindisp;
+				trk.maxdisp = ti.maxdisp;
+				trk.col = ti.col;
+				trk.srate = ti.srate;
+				trk.gain = ti.adc_gain;
+				trk.offset = ti.adc_offset;
+				trk.montype = ti.montype;
+				trk.did = ti.did;
+				auto it = devs.find(ti.did);
+				trk.dname = it != devs.end() ? it->second.dname : std::string();
+			}
+			else if (pkt.type == 1)
+			{
+				RecView rec;
+				if (!rec.parse(pkt))
+					continue;
+				Track &trk = trks[rec.tid];
+				trk.tid = rec.tid;
+				trk.recs.push_back(pos);
+
+				double dt_rec_end = rec.dt;
+				if (trk.rectype == 1)
+				{
+					std::uint32_t nsamp = 0;
+					const unsigned char *samples;
+					if (!rec.wav(nsamp, samples))
+						continue;
+					trk.nsamp += nsamp;
+					if (trk.srate > 0)
+						dt_rec_end += nsamp / trk.srate;
+				}
+				if (rec.dt)
+				{
+					if (dt_last_end - rec.dt > lag)
+						lag = dt_last_end - rec.dt;
+					if (dt_last_end < dt_rec_end)
+						dt_last_end = dt_rec_end;
+					if (!trk.has_data())
+						trk.first = pos;
+					if (trk.dtstart > rec.dt)
+						trk.dtstart = rec.dt;
+					if (trk.dtend < dt_rec_end)
+						trk.dtend = dt_rec_end;
+				}
+
+				if (!trk.info)
+					continue;
+				if (trk.rectype == 2)
+				{
+					float fval;
+					if (!rec.num(fval))
+						continue;
+					if (!trk.count)
+					{
+						trk.minval = trk.maxval = fval;
+						char buf[64];
+						snprintf(buf, sizeof(buf), "%f", fval);
+						trk.firstval = buf;
+					}
+					else
+					{
+						if (fval < trk.minval)
+							trk.minval = fval;
+						if (fval > trk.maxval)
+							trk.maxval = fval;
+					}
+					trk.count++;
+					trk.sum += fval;
+				}
+				else if (trk.rectype == 5 && trk.firstval.size() < FIRSTVAL_MAX)
+				{
+					std::string_view sv;
+					if (!rec.str(sv))
+						continue;
+					std::string sval;
+					for (char c : sv)
+						if (printable(c))
+							sval += c;
+					append_firstval(trk.firstval, sval);
+				}
+			}
+		}
+		return true;
+	}
+
+	// sidecar file next to the vital file
+	static std::string sidecar_path(const std::string &path)
+	{
+		return path + ".idx";
+	}
+
+	bool save(const std::string &idxpath) const
+	{
+		Out o;
+		o.insert(o.end(), {'V', 'I', 'D', 'X'});
+		o.put(VERSION);
+		o.put(file_size);
+		o.put(file_mtime);
+		o.put(format_ver);
+		o.put(dgmt);
+		o.put(dtstart);
+		o.put(dtend);
+		o.put(body);
+		o.put(lag);
+		o.put((std::uint32_t)devs.size());
+		for (auto &it : devs)
+		{
+			auto &dev = it.second;
+			o.put(dev.did);
+			o.put_str(dev.dtype);
+			o.put_str(dev.dname);
+			o.put_str(dev.port);
+		}
+		o.put((std::uint32_t)trks.size());
+		for (auto &it : trks)
+		{
+			auto &trk = it.second;
+			o.put(trk.tid);
+			o.put((std::uint8_t)trk.info);
+			o.put((std::uint8_t)trk.full);
+			o.put(trk.rectype);
+			o.put(trk.recfmt);
+			o.put_str(trk.tname);
+			o.put_str(trk.unit);
+			o.put(trk.mindisp);
+			o.put(trk.maxdisp);
+			o.put(trk.col);
+			o.put(trk.srate);
+			o.put(trk.gain);
+			o.put(trk.offset);
+			o.put(trk.montype);
+			o.put(trk.did);
+			o.put_str(trk.dname);
+			o.put(trk.dtstart);
+			o.put(trk.dtend);
+			o.put(trk.first);
+			o.put(trk.nsamp);
+			o.put(trk.count);
+			o.put(trk.sum);
+			o.put(trk.minval);
+			o.put(trk.maxval);
+			o.put_str(trk.firstval);
+			// packet offsets grow, so the gaps are stored as varints
+			o.put((std::uint64_t)trk.recs.size());
+			std::uint64_t prev = 0;
+			for (auto off : trk.recs)
+			{
+				o.put_var(off - prev);
+				prev = off;
+			}
+		}
+
+		FILE *f = ::fopen(idxpath.c_str(), "wb");
+		if (!f)
+			return false;
+		bool ret = fwrite(o.data(), o.size(), 1, f) == 1;
+		ret &= fclose(f) == 0;
+		return ret;
+	}
+
+	bool load(const std::string &idxpath)
+	{
+		clear();
+		FILE *f = ::fopen(idxpath.c_str(), "rb");
+		if (!f)
+			return false;
+		std::vector<unsigned char> buf;
+		unsigned char chunk[65536];
+		size_t n;
+		while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+			buf.insert(buf.end(), chunk, chunk + n);
+		fclose(f);
+
+		In c(buf.data(), (std::uint32_t)buf.size());
+		std::uint32_t version = 0, ndevs = 0, ntrks = 0;
+		bool ret = buf.size() >= 4 && !memcmp(buf.data(), "VIDX", 4) && c.skip(4) &&
+				   c.get(version) && version == VERSION &&
+				   c.get(file_size) && c.get(file_mtime) && c.get(format_ver) && c.get(dgmt) &&
+				   c.get(dtstart) && c.get(dtend) && c.get(body) && c.get(lag) && c.get(ndevs);
+		for (std::uint32_t i = 0; ret && i < ndevs; i++)
+		{
+			Device dev;
+			ret = c.get(dev.did) && c.get_str(dev.dtype) && c.get_str(dev.dname) && c.get_str(dev.port);
+			devs[dev.did] = std::move(dev);
+		}
+		ret = ret && c.get(ntrks);
+		for (std::uint32_t i = 0; ret && i < ntrks; i++)
+		{
+			Track trk;
+			std::uint8_t info = 0, full = 0;
+			std::uint64_t nrecs = 0;
+			ret = c.get(trk.tid) && c.get(info) && c.get(full) && c.get(trk.rectype) && c.get(trk.recfmt) &&
+				  c.get_str(trk.tname) && c.get_str(trk.unit) && c.get(trk.mindisp) && c.get(trk.maxdisp) &&
+				  c.get(trk.col) && c.get(trk.srate) && c.get(trk.gain) && c.get(trk.offset) &&
+				  c.get(trk.montype) && c.get(trk.did) && c.get_str(trk.dname) &&
+				  c.get(trk.dtstart) && c.get(trk.dtend) && c.get(trk.first) && c.get(trk.nsamp) &&
+				  c.get(trk.count) && c.get(trk.sum) && c.get(trk.minval) && c.get(trk.maxval) &&
+				  c.get_str(trk.firstval) && c.get(nrecs) && nrecs <= c.remain();
+			trk.info = info != 0;
+			trk.full = full != 0;
+			if (ret)
+				trk.recs.resize((size_t)nrecs);
+			std::uint64_t off = 0;
+			for (std::uint64_t j = 0; ret && j < nrecs; j++)
+			{
+				std::uint64_t gap;
+				ret = c.get_var(gap);
+				off += gap;
+				trk.recs[(size_t)j] = off;
+			}
+			trks[trk.tid] = std::move(trk);
+		}
+		if (!ret)
+			clear();
+		return ret;
+	}
+
+	// load the sidecar of 'path' if it still matches the file
+	bool load_for(const std::string &path)
+	{
+		std::uint64_t size;
+		std::int64_t mtime;
+		if (!GZIndex::stat_file(path, size, mtime))
+			return false;
+		if (!load(sidecar_path(path)))
+			return false;
+		if (file_size != size || file_mtime != mtime)
+		{
+			clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool save_for(const std::string &path)
+	{
+		if (!GZIndex::stat_file(path, file_size, file_mtime))
+			return false;
+		return save(sidecar_path(path));
+	}
+
+	// offsets of the rec packets of the given tracks, in file order
+	std::vector<std::uint64_t> recs_of(const std::vector<std::uint16_t> &tids) const
+	{
+		std::vector<std::uint64_t> ret;
+		for (auto tid : tids)
+		{
+			auto it = trks.find(tid);
+			if (it != trks.end())
+				ret.insert(ret.end(), it->second.recs.begin(), it->second.recs.end());
+		}
+		std::sort(ret.begin(), ret.end());
+		ret.erase(std::unique(ret.begin(), ret.end()), ret.end());
+		return ret;
+	}
+};
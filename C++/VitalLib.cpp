@@ -1,7 +1,12 @@
 #include "VitalLib.h"
-#include "GZReader.h" // Your custom GZ reader (as in your original code)
+#include "GZPipeReader.h"
+#include "GZMapReader.h" // Your custom GZ reader (as in your original code)
+#include "VitalPacket.h"
+#include "VitalIndex.h"
+#include "VitalDecode.h"
 #include "Util.h"     // If you have string_format, escape_csv, etc. in here
 #include <algorithm>
+#include <cmath>
 #include <fstream>
 #include <iostream>
 #include <iomanip>
@@ -9,9 +14,11 @@
 
 // Example of the library function to save waveforms
 void save_waveforms_to_csv(const std::string &filename,
-                           const std::vector<double> &timestamps1, const std::vector<float> &waveform1, const std::string &name1,
-                           const std::vector<double> &timestamps2, const std::vector<float> &waveform2, const std::string &name2)
+                           const TrackInfo &track1, const std::string &name1,
+                           const TrackInfo &track2, const std::string &name2)
 {
+    const std::vector<float> &waveform1 = track1.waveform;
+    const std::vector<float> &waveform2 = track2.waveform;
     size_t max_samples = std::max(waveform1.size(), waveform2.size());
 
     std::ofstream csv_file(filename);
@@ -28,10 +35,10 @@ void save_waveforms_to_csv(const std::string &filename,
     {
         // Get timestamp (use available timestamp or fallback to zero)
         double timestamp = 0.0;
-        if (i < timestamps1.size())
-            timestamp = timestamps1[i];
-        else if (i < timestamps2.size())
-            timestamp = timestamps2[i];
+        if (i < waveform1.size())
+            timestamp = track1.sampleTime(i);
+        else if (i < waveform2.size())
+            timestamp = track2.sampleTime(i);
 
         csv_file << timestamp << ",";
 
@@ -50,6 +57,115 @@ void save_waveforms_to_csv(const std::string &filename,
               << " (" << max_samples << " samples)\n";
 }
 
+// The segment holding sample i: the last one that starts at or before it
+static std::vector<WaveSegment>::const_iterator segmentOf(const std::vector<WaveSegment> &segs, std::uint64_t i)
+{
+    auto it = std::upper_bound(segs.begin(), segs.end(), i,
+                               [](std::uint64_t i, const WaveSegment &seg)
+                               { return i < seg.sampleOffset; });
+    return it == segs.begin() ? segs.end() : it - 1;
+}
+
+double TrackInfo::sampleTime(std::size_t i) const
+{
+    auto seg = segmentOf(waveformSegments, i);
+    if (seg == waveformSegments.end())
+        return 0.0;
+    return seg->dtStart + static_cast<double>(i - seg->sampleOffset) / seg->srate;
+}
+
+std::size_t TrackInfo::sampleIndex(double dt) const
+{
+    // the last segment that starts at or before dt
+    auto it = std::upper_bound(waveformSegments.begin(), waveformSegments.end(), dt,
+                               [](double dt, const WaveSegment &seg)
+                               { return dt < seg.dtStart; });
+    if (it == waveformSegments.begin())
+        return waveformSegments.empty() ? waveform.size() : waveformSegments.front().sampleOffset;
+    const WaveSegment &seg = *(it - 1);
+    if (seg.srate > 0)
+    {
+        // the estimate can be one off; settle it with the same arithmetic as sampleTime
+        auto time = [&seg](double k)
+        { return seg.dtStart + k / seg.srate; };
+        double pos = std::max(0.0, std::ceil((dt - seg.dtStart) * seg.srate));
+        if (pos > 0 && time(pos - 1) >= dt)
+            pos--;
+        else if (time(pos) < dt)
+            pos++;
+        if (pos < seg.count)
+            return seg.sampleOffset + static_cast<std::uint64_t>(pos);
+    }
+    // dt is after this segment: the next one starts later
+    return it == waveformSegments.end() ? waveform.size() : it->sampleOffset;
+}
+
+StringDict::StringDict(const StringDict &other)
+{
+    *this = other;
+}
+
+StringDict &StringDict::operator=(const StringDict &other)
+{
+    if (this == &other)
+        return *this;
+    clear();
+    for (std::string_view v : other.dict)
+        push_back(v);
+    codes = other.codes;
+    return *this;
+}
+
+std::uint32_t StringDict::push_back(std::string_view s, bool *added)
+{
+    auto it = lookup.find(s);
+    bool found = it != lookup.end();
+    if (added)
+        *added = !found;
+    if (found)
+    {
+        codes.push_back(it->second);
+        return it->second;
+    }
+
+    // copy the value into the arena. a value longer than a block gets its own
+    char *p;
+    if (s.size() > BLOCK)
+    {
+        // before the current block, which stays the one being filled
+        std::unique_ptr<char[]> big(new char[s.size()]);
+        p = big.get();
+        blocks.insert(blocks.empty() ? blocks.end() : blocks.end() - 1, std::move(big));
+    }
+    else
+    {
+        if (BLOCK - blockUsed < s.size())
+        {
+            blocks.emplace_back(new char[BLOCK]);
+            blockUsed = 0;
+        }
+        p = blocks.back().get() + blockUsed;
+        blockUsed += s.size();
+    }
+    memcpy(p, s.data(), s.size());
+
+    std::uint32_t code = static_cast<std::uint32_t>(dict.size());
+    std::string_view stored(p, s.size());
+    dict.push_back(stored);
+    lookup.emplace(stored, code);
+    codes.push_back(code);
+    return code;
+}
+
+void StringDict::clear()
+{
+    blocks.clear();
+    blockUsed = BLOCK;
+    dict.clear();
+    lookup.clear();
+    codes.clear();
+}
+
 // Example function to check if a character is not printable
 bool isNotPrintable(char c)
 {
@@ -122,220 +238,634 @@ static bool readVitalHeader(GZReader &gz, double &tzBias, double &dtStart, doubl
     return true; // success
 }
 
-// The main function that actually parses a .vital file
-VitalFileData parseVitalFile(const std::string &filename, bool isShort)
+// Decode one record of a known track and pass it to the visitor.
+// samples is scratch space for wave blocks
+static void visitRecord(const TrackInfo &track, const RecView &rec, VitalVisitor &visitor, std::vector<float> &samples)
 {
-    VitalFileData result;
-    result.tzBias = 0.0;
-    result.dtStart = 0.0;
-    result.dtEnd = 0.0;
-
-    GZReader gz(filename.c_str());
-    if (!gz.opened())
-    {
-        throw std::runtime_error("File does not exist: " + filename);
+    if (track.recType == 2)
+    { // numeric
+        float fval = 0.f;
+        if (rec.num(fval))
+            visitor.onNumeric(rec.tid, rec.dt, fval);
+    }
+    else if (track.recType == 5)
+    { // string
+        std::string_view sv;
+        if (rec.str(sv))
+            visitor.onString(rec.tid, rec.dt, sv);
+    }
+    else if (track.recType == 1)
+    { // WAV
+        // Fetch the number of samples (first 4 bytes of the record data)
+        std::uint32_t num_samples = 0;
+        const unsigned char *data = nullptr;
+        if (!rec.wav(num_samples, data))
+            return;
+
+        // a short payload keeps only the complete samples
+        std::uint32_t avail = (rec.len - 4) / recfmt_size(track.recFmt);
+        if (num_samples > avail)
+            num_samples = avail;
+        samples.resize(num_samples);
+        decode_samples(data, num_samples, track.recFmt, float(track.adcGain), float(track.adcOffset), samples.data());
+        visitor.onWaveBlock(rec.tid, rec.dt, samples.data(), num_samples);
     }
+}
 
-    // 1) Read header
+// A map node of a track, kept by VitalParser to be filled again by the next file
+typedef std::map<std::uint16_t, TrackInfo>::node_type TrackNode;
+
+// The entry of tid in tracks. A new one reuses a spare node and the capacity of its vectors
+static TrackInfo &trackSlot(std::map<std::uint16_t, TrackInfo> &tracks, std::uint16_t tid, std::vector<TrackNode> *spare)
+{
+    auto it = tracks.find(tid);
+    if (it != tracks.end())
+        return it->second;
+    if (!spare || spare->empty())
+        return tracks[tid];
+
+    TrackNode node = std::move(spare->back());
+    spare->pop_back();
+    node.key() = tid;
+    TrackInfo &old = node.mapped();
+    TrackInfo fresh{};
+    old.numericValues.clear();
+    old.recordTimestamps.clear();
+    old.waveform.clear();
+    old.waveformSegments.clear();
+    old.stringValues.clear();
+    fresh.numericValues.swap(old.numericValues);
+    fresh.recordTimestamps.swap(old.recordTimestamps);
+    fresh.waveform.swap(old.waveform);
+    fresh.waveformSegments.swap(old.waveformSegments);
+    fresh.stringValues = std::move(old.stringValues);
+    old = std::move(fresh);
+    return tracks.insert(std::move(node)).position->second;
+}
+
+// Hand every track of tracks over to spare
+static void recycleTracks(std::map<std::uint16_t, TrackInfo> &tracks, std::vector<TrackNode> &spare)
+{
+    while (!tracks.empty())
+        spare.push_back(tracks.extract(tracks.begin()));
+}
 
-    if (!readVitalHeader(gz, result.tzBias, result.dtStart, result.dtEnd))
+// What the streaming pass needs besides the reader. VitalParser keeps it between files
+struct VitalScratch
+{
+    // Maps for device id → device name, and the track catalog
+    std::map<std::uint32_t, std::string> did_dnames;
+    std::map<std::uint16_t, TrackInfo> tracks;
+    std::vector<TrackNode> spare;
+    std::vector<float> samples; // decoded wave block
+};
+
+// The single streaming pass behind every parse: header, then packet by packet.
+// Only the track catalog is kept; records go to the visitor as they are read.
+template <typename Reader>
+static void visitVital(Reader &gz, const std::string &filename, VitalVisitor &visitor, VitalScratch &scratch)
+{
+    // 1) Read header
+    double tzBias = 0.0, dtStart = 0.0, dtEnd = 0.0;
+    if (!readVitalHeader(gz, tzBias, dtStart, dtEnd))
     {
         throw std::runtime_error("Invalid vital file header: " + filename);
     }
+    visitor.onHeader(tzBias, dtStart, dtEnd);
 
-    // Maps for device id → device name
-    std::map<std::uint32_t, std::string> did_dnames;
+    std::map<std::uint32_t, std::string> &did_dnames = scratch.did_dnames;
+    std::map<std::uint16_t, TrackInfo> &tracks = scratch.tracks;
+    did_dnames.clear();
+    recycleTracks(tracks, scratch.spare);
 
-    while (!gz.eof())
+    // Records are parsed up to their tid first. The data of the records the visitor
+    // does not want is skipped by the packet length without being decoded.
+    const TrackInfo *track = nullptr;
+    auto keep = [&](const RecView &rec)
+    {
+        auto it = tracks.find(rec.tid);
+        if (it == tracks.end())
+            return false; // We never had track info for this tid
+        track = &it->second;
+        // a wave record lasts at most as long as the samples its length allows
+        double dt_rec_end = rec.dt;
+        if (track->recType == 1 && track->sampleRate > 0 && rec.len >= 4)
+            dt_rec_end += (rec.len - 4) / recfmt_size(track->recFmt) / double(track->sampleRate);
+        return visitor.wantRecord(*track, rec.dt, dt_rec_end);
+    };
+
+    std::vector<float> &samples = scratch.samples;
+    PacketReader pr(gz);
+    PacketView pkt;
+    RecView rec;
+    while (pr.next(pkt, rec, keep))
     {
-        std::uint8_t type = 0;
-        if (!gz.read(&type, 1))
-            break;
-
-        std::uint32_t datalen = 0;
-        if (!gz.read(&datalen, 4))
-            break;
-        if (datalen > 1000000)
-        { // sanity check
-            std::cerr << "Suspiciously large datalen, abort parse.\n";
-            break;
-        }
-
         // type = 0 => track info
         // type = 1 => record
         // type = 9 => device info
-        if (type == 9)
+        if (pkt.type == 9)
         { // devinfo
-            std::uint32_t did = 0;
-            if (!gz.fetch(did, datalen))
-                goto skipPacket;
-
-            std::string dtype;
-            if (!gz.fetch_with_len(dtype, datalen))
-                goto skipPacket;
-            std::string dname;
-            if (!gz.fetch_with_len(dname, datalen))
-                goto skipPacket;
-            if (dname.empty())
-                dname = dtype;
-
-            did_dnames[did] = dname;
+            DevInfoView di;
+            if (!di.parse(pkt))
+                continue;
+            did_dnames[di.did] = std::string(di.dname);
+            visitor.onDevice(di.did, did_dnames[di.did]);
         }
-        else if (type == 0)
+        else if (pkt.type == 0)
         { // track info
-            std::uint16_t tid = 0;
-            if (!gz.fetch(tid, datalen))
-                goto skipPacket;
-            std::uint8_t rectype = 0;
-            if (!gz.fetch(rectype, datalen))
-                goto skipPacket;
-            std::uint8_t recfmt = 0;
-            if (!gz.fetch(recfmt, datalen))
-                goto skipPacket;
-
-            std::string tname;
-            if (!gz.fetch_with_len(tname, datalen))
-                goto skipPacket;
-
-            // Some optional fields
-            std::string unit;
-            float minval = 0.f, maxval = 0.f, srate = 0.f;
-            double adc_gain = 1.0, adc_offset = 0.0;
-            std::uint8_t montype = 0;
-            std::uint32_t did = 0;
-
-            if (!gz.fetch_with_len(unit, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(minval, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(maxval, datalen))
-                goto trackInfoDone;
-            std::uint32_t col;
-            if (!gz.fetch(col, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(srate, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(adc_gain, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(adc_offset, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(montype, datalen))
-                goto trackInfoDone;
-            if (!gz.fetch(did, datalen))
-                goto trackInfoDone;
-
-        trackInfoDone:
-            // Insert into result
-            TrackInfo &tr = result.tracks[tid];
-            tr.tid = tid;
-            tr.trackName = tname;
-            tr.deviceId = did;
-            tr.deviceName = (did_dnames.count(did) ? did_dnames[did] : "");
-            tr.recType = rectype;
-            tr.sampleRate = srate;
+            TrkInfoView ti;
+            if (!ti.parse(pkt))
+                continue;
+
+            TrackInfo &tr = trackSlot(tracks, ti.tid, &scratch.spare);
+            tr.tid = ti.tid;
+            tr.trackName = std::string(ti.tname);
+            tr.deviceId = ti.did;
+            tr.deviceName = (did_dnames.count(ti.did) ? did_dnames[ti.did] : "");
+            tr.recType = ti.rectype;
+            tr.recFmt = ti.recfmt;
+            tr.adcGain = ti.adc_gain;
+            tr.adcOffset = ti.adc_offset;
+            tr.sampleRate = ti.srate;
             // minval, maxval, etc. can be stored if you wish
+            visitor.onTrack(tr);
         }
-        else if (type == 1)
-        { // record
-            std::uint16_t infolen = 0;
-            if (!gz.fetch(infolen, datalen))
-                goto skipPacket;
-
-            double dt = 0.0;
-            if (!gz.fetch(dt, datalen))
-                goto skipPacket;
-
-            std::uint16_t tid = 0;
-            if (!gz.fetch(tid, datalen))
-                goto skipPacket;
-
-            // If user only wants short list, skip
-            if (isShort)
-            {
-                goto skipPacket;
-            }
+        else if (pkt.type == 1)
+        { // record of 'track', which keep() found and the visitor wants
+            visitRecord(*track, rec, visitor, samples);
+        }
+    }
+    if (pr.bad())
+        std::cerr << "Suspiciously large datalen, abort parse.\n";
+    else if (gz.failed())
+        std::cerr << "Corrupt compressed data, parse stopped early.\n";
+}
+
+void parseVitalFile(const std::string &filename, VitalVisitor &visitor)
+{
+    GZPipeReader gz(filename.c_str()); // inflates on its own thread while we parse if built with PIPE_THREADED
+    if (!gz.opened())
+    {
+        throw std::runtime_error("File does not exist: " + filename);
+    }
+    VitalScratch scratch;
+    visitVital(gz, filename, visitor, scratch);
+}
+
+// A track selector of parseVitalFile: "DNAME/TNAME", or "TNAME" for any device
+struct TrackSelector
+{
+    std::string dname;
+    std::string tname;
+};
+
+// The visitor behind parseVitalFile, which keeps everything in a VitalFileData.
+// With selectors, only the matching tracks are kept. t0 and t1 bound the records when not 0
+class VitalCollector : public VitalVisitor
+{
+public:
+    VitalFileData result;
+
+    VitalCollector(bool isShort, const std::vector<TrackSelector> *selectors, double t0, double t1,
+                   std::vector<TrackNode> *spare = nullptr)
+        : isShort(isShort), selectors(selectors), t0(t0), t1(t1), windowed(t0 || t1), spare(spare)
+    {
+        result.tzBias = 0.0;
+        result.dtStart = 0.0;
+        result.dtEnd = 0.0;
+    }
+
+    void onHeader(double tzBias, double dtStart, double dtEnd) override
+    {
+        result.tzBias = tzBias;
+        result.dtStart = dtStart;
+        result.dtEnd = dtEnd;
+    }
 
-            // Otherwise, fetch data
-            if (result.tracks.count(tid) == 0)
+    void onTrack(const TrackInfo &ti) override
+    {
+        // Tracks that no selector matches are left out, and so are their records
+        if (selectors && std::none_of(selectors->begin(), selectors->end(), [&](const TrackSelector &sel)
+                                      { return sel.tname == ti.trackName && (sel.dname.empty() || sel.dname == ti.deviceName); }))
+            return;
+
+        // Insert into result. a repeated trkinfo keeps the data read so far
+        TrackInfo &tr = trackSlot(result.tracks, ti.tid, spare);
+        tr.tid = ti.tid;
+        tr.trackName = ti.trackName;
+        tr.deviceId = ti.deviceId;
+        tr.deviceName = ti.deviceName;
+        tr.recType = ti.recType;
+        tr.recFmt = ti.recFmt;
+        tr.adcGain = ti.adcGain;
+        tr.adcOffset = ti.adcOffset;
+        tr.sampleRate = ti.sampleRate;
+    }
+
+    bool wantRecord(const TrackInfo &track, double dt, double dtEnd) override
+    {
+        if (isShort)
+            return false; // the short list has no records
+        if (!result.tracks.count(track.tid))
+            return false; // not selected
+        return !windowed || ((!t1 || dt < t1) && (dt >= t0 || dtEnd > t0));
+    }
+
+    void onNumeric(std::uint16_t tid, double dt, float fval) override
+    {
+        TrackInfo &track = result.tracks[tid];
+        if (!inWindow(dt))
+            return;
+        updateRange(track, dt, dt);
+
+        track.numericValues.push_back(fval);
+        track.recordTimestamps.push_back(dt);
+
+        // Update stats
+        if (track.count == 0)
+        {
+            track.minVal = track.maxVal = fval;
+        }
+        else
+        {
+            if (fval < track.minVal)
+                track.minVal = fval;
+            if (fval > track.maxVal)
+                track.maxVal = fval;
+        }
+        track.count++;
+        track.sum += fval;
+
+        if (track.firstVal.empty())
+        {
+            track.firstVal = string_format("%f", fval);
+        }
+    }
+
+    void onString(std::uint16_t tid, double dt, std::string_view sv) override
+    {
+        TrackInfo &track = result.tracks[tid];
+        if (!inWindow(dt))
+            return;
+        updateRange(track, dt, dt);
+
+        sval.assign(sv);
+        sval.erase(std::remove_if(sval.begin(), sval.end(), isNotPrintable), sval.end());
+        track.stringValues.push_back(sval);
+        track.recordTimestamps.push_back(dt);
+        append_firstval(track.firstVal, sval);
+    }
+
+    void onWaveBlock(std::uint16_t tid, double dt, const float *samples, std::size_t count) override
+    {
+        TrackInfo &track = result.tracks[tid];
+
+        // time range of the record. a wave record lasts num_samples / srate
+        std::uint32_t first = 0, last = static_cast<std::uint32_t>(count); // the samples we keep
+        double dt_rec_start = dt;
+        double dt_rec_end = dt;
+        if (track.sampleRate > 0)
+            dt_rec_end += last / track.sampleRate;
+
+        // only the samples in [t0, t1)
+        if (windowed && track.sampleRate > 0)
+        {
+            double srate = track.sampleRate;
+            // the first sample at or after t. the estimate can be one off; settle it with
+            // the same arithmetic as TrackInfo::sampleTime, like TrackInfo::sampleIndex
+            auto time = [dt, srate](double k)
+            { return dt + k / srate; };
+            auto index = [&](double t)
             {
-                // We never had track info for this tid— skip or handle error
-                goto skipPacket;
-            }
-            TrackInfo &track = result.tracks[tid];
-
-            if (track.recType == 2)
-            { // numeric
-                float fval = 0.f;
-                if (!gz.fetch(fval, datalen))
-                    goto skipPacket;
-
-                track.numericValues.push_back(fval);
-                track.recordTimestamps.push_back(dt);
-
-                // Update stats
-                if (track.count == 0)
-                {
-                    track.minVal = track.maxVal = fval;
-                }
-                else
-                {
-                    if (fval < track.minVal)
-                        track.minVal = fval;
-                    if (fval > track.maxVal)
-                        track.maxVal = fval;
-                }
-                track.count++;
-                track.sum += fval;
-
-                if (track.firstVal.empty())
-                {
-                    track.firstVal = string_format("%f", fval);
-                }
-            }
-            else if (track.recType == 5)
-            { // string
-                // skip 4 bytes
-                if (!gz.skip(4, datalen))
-                    goto skipPacket;
-                std::string sval;
-                if (!gz.fetch_with_len(sval, datalen))
-                    goto skipPacket;
-                sval.erase(std::remove_if(sval.begin(), sval.end(), isNotPrintable), sval.end());
-                track.stringValues.push_back(sval);
-                track.recordTimestamps.push_back(dt);
-                if (track.firstVal.empty())
-                    track.firstVal = sval;
-                else
-                    track.firstVal += " | " + sval;
-            }
-            else if (track.recType == 1)
-            { // WAV
-                // Fetch the number of samples (first 4 bytes of the record data)
-                std::uint32_t num_samples = 0;
-                if (!gz.fetch(num_samples, datalen))
-                    goto skipPacket;
-
-                // Now fetch each float sample (assuming recfmt indicates float)
-                for (std::uint32_t i = 0; i < num_samples; i++)
-                {
-                    float sample;
-                    if (!gz.fetch(sample, datalen))
-                        goto skipPacket;
-                    track.waveform.push_back(sample);
-
-                    // Compute sample timestamp
-                    double sampleDt = dt + static_cast<double>(i) / track.sampleRate;
-                    track.waveformTimestamps.push_back(sampleDt);
-                }
-            }
+                double pos = std::max(0.0, std::ceil((t - dt) * srate));
+                if (pos > 0 && time(pos - 1) >= t)
+                    pos--;
+                else if (time(pos) < t)
+                    pos++;
+                return static_cast<std::uint32_t>(std::min<double>(count, pos));
+            };
+            if (t0 > dt)
+                first = index(t0);
+            if (t1 && t1 < dt_rec_end)
+                last = index(t1);
+            if (first >= last)
+                return;
+            dt_rec_start = time(first);
+            dt_rec_end = time(last);
         }
+        else if (!inWindow(dt))
+            return;
+        updateRange(track, dt_rec_start, dt_rec_end);
 
-    skipPacket:
-        // skip the rest of this packet if any left
-        if (!gz.skip(datalen))
-            break;
+        std::uint32_t n = last - first;
+        size_t offset = track.waveform.size();
+        track.waveform.insert(track.waveform.end(), samples + first, samples + last);
+
+        // Sample times are computed on demand from the segment
+        if (n)
+            track.waveformSegments.push_back({dt_rec_start, track.sampleRate, offset, n});
     }
 
+private:
+    bool isShort;
+    std::string sval; // scratch for onString
+    const std::vector<TrackSelector> *selectors;
+    double t0, t1;
+    bool windowed;
+    std::vector<TrackNode> *spare; // nodes to reuse for new tracks
+
+    bool inWindow(double dt) const
+    {
+        return !windowed || (dt >= t0 && (!t1 || dt < t1));
+    }
+
+    // time range of the track. records without a time do not count
+    static void updateRange(TrackInfo &track, double dt_rec_start, double dt_rec_end)
+    {
+        if (!dt_rec_start)
+            return;
+        if (!track.dtStart || dt_rec_start < track.dtStart)
+            track.dtStart = dt_rec_start;
+        if (dt_rec_end > track.dtEnd)
+            track.dtEnd = dt_rec_end;
+    }
+};
+
+// The metadata of a track from the sidecar index, as a trkinfo packet gives it
+static void trackFromIndex(const VitalIndex::Track &ti, TrackInfo &tr)
+{
+    tr.tid = ti.tid;
+    tr.trackName = ti.tname;
+    tr.deviceId = ti.did;
+    tr.deviceName = ti.dname;
+    tr.recType = ti.rectype;
+    tr.recFmt = ti.recfmt;
+    tr.adcGain = ti.gain;
+    tr.adcOffset = ti.offset;
+    tr.sampleRate = ti.srate;
+}
+
+// The short list from a fresh sidecar index, which already has the track catalog
+static bool catalogFromIndex(const std::string &filename, VitalFileData &result)
+{
+    VitalIndex idx;
+    if (!idx.load_for(filename))
+        return false;
+    result.tzBias = idx.dgmt / 60.0;
+    if (idx.body >= 10 + 26)
+    {
+        result.dtStart = idx.dtstart;
+        result.dtEnd = idx.dtend;
+    }
+    for (auto &kv : idx.trks)
+    {
+        if (kv.second.info)
+            trackFromIndex(kv.second, result.tracks[kv.first]);
+    }
+    return true;
+}
+
+static std::vector<TrackSelector> parseSelectors(const std::set<std::string> &selectors)
+{
+    std::vector<TrackSelector> sels;
+    for (const std::string &sel : selectors)
+    {
+        auto pos = sel.find('/');
+        if (pos == std::string::npos)
+            sels.push_back({"", sel});
+        else
+            sels.push_back({sel.substr(0, pos), sel.substr(pos + 1)});
+    }
+    return sels;
+}
+
+// The main function that actually parses a .vital file
+VitalFileData parseVitalFile(const std::string &filename, bool isShort)
+{
+    VitalCollector collector(isShort, nullptr, 0.0, 0.0);
+    VitalFileData &result = collector.result;
+
+    if (isShort && catalogFromIndex(filename, result))
+        return std::move(result);
+
+    parseVitalFile(filename, collector);
+
     // Return the entire dataset
-    return result;
+    return std::move(result);
+}
+
+VitalFileData parseVitalFile(const std::string &filename, const std::set<std::string> &selectors, double t0, double t1)
+{
+    std::vector<TrackSelector> sels = parseSelectors(selectors);
+    VitalCollector collector(false, sels.empty() ? nullptr : &sels, t0, t1);
+    parseVitalFile(filename, collector);
+    return std::move(collector.result);
+}
+
+// What a VitalParser keeps from one file to the next
+struct VitalParser::Impl
+{
+    // inflates in the calling thread; reopen() resets the stream and keeps its buffers
+    std::unique_ptr<GZMapReader> gz;
+    VitalScratch scratch;
+    VitalFileData result;
+
+    void open(const std::string &filename)
+    {
+        bool ok;
+        if (gz)
+            ok = gz->reopen(filename.c_str());
+        else
+        {
+            gz.reset(new GZMapReader(filename.c_str()));
+            ok = gz->opened();
+        }
+        if (!ok)
+        {
+            throw std::runtime_error("File does not exist: " + filename);
+        }
+    }
+
+    VitalFileData &collect(const std::string &filename, bool isShort, const std::vector<TrackSelector> *selectors, double t0, double t1)
+    {
+        // the tracks of the last result become the spare nodes of this one
+        recycleTracks(result.tracks, scratch.spare);
+        VitalCollector collector(isShort, selectors, t0, t1, &scratch.spare);
+        std::swap(collector.result.tracks, result.tracks);
+        if (!isShort || !catalogFromIndex(filename, collector.result))
+        {
+            open(filename);
+            visitVital(*gz, filename, collector, scratch);
+        }
+        result = std::move(collector.result);
+        return result;
+    }
+};
+
+VitalParser::VitalParser() : impl(new Impl) {}
+
+VitalParser::~VitalParser() = default;
+
+VitalFileData &VitalParser::parse(const std::string &filename, bool isShort)
+{
+    return impl->collect(filename, isShort, nullptr, 0.0, 0.0);
+}
+
+VitalFileData &VitalParser::parse(const std::string &filename, const std::set<std::string> &selectors, double t0, double t1)
+{
+    std::vector<TrackSelector> sels = parseSelectors(selectors);
+    return impl->collect(filename, false, sels.empty() ? nullptr : &sels, t0, t1);
+}
+
+void VitalParser::parse(const std::string &filename, VitalVisitor &visitor)
+{
+    impl->open(filename);
+    visitVital(*impl->gz, filename, visitor, impl->scratch);
+}
+
+void VitalParser::release()
+{
+    impl.reset(new Impl);
+}
+
+VitalParserPool::Lease VitalParserPool::acquire()
+{
+    std::unique_ptr<VitalParser> parser;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!parsers.empty())
+        {
+            parser = std::move(parsers.back());
+            parsers.pop_back();
+        }
+    }
+    if (!parser)
+        parser.reset(new VitalParser);
+    return Lease(this, std::move(parser));
+}
+
+std::size_t VitalParserPool::idle() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return parsers.size();
+}
+
+void VitalParserPool::clear()
+{
+    std::vector<std::unique_ptr<VitalParser>> freed;
+    std::lock_guard<std::mutex> lock(mtx);
+    freed.swap(parsers);
+}
+
+void VitalParserPool::release(std::unique_ptr<VitalParser> parser)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    parsers.push_back(std::move(parser));
+}
+
+// Everything LazyVitalFile needs to reach the records of a track later
+struct LazyVitalFile::Impl
+{
+    VitalIndex idx;  // catalog and rec offsets
+    GZIndex gzi;     // access points, so that a track can be reached without inflating from the start
+    std::unique_ptr<GZMapReader> gz;
+    std::set<std::uint16_t> loaded;
+};
+
+LazyVitalFile::LazyVitalFile(const std::string &filename) : impl(new Impl)
+{
+    // the seekable streaming reader collects access points as it goes
+    impl->gz.reset(new GZMapReader(filename.c_str(), MAPCHUNK, CODEC_ZLIB));
+    if (!impl->gz->opened())
+    {
+        throw std::runtime_error("File does not exist: " + filename);
+    }
+    bool sidecar = impl->idx.load_for(filename);
+    if (sidecar)
+        impl->gzi.load_for(filename);
+    impl->gz->enable_index(&impl->gzi);
+
+    // without a fresh sidecar, one scan without decoding finds the catalog and the rec offsets
+    if (!sidecar && !impl->idx.build(*impl->gz))
+    {
+        throw std::runtime_error("Invalid vital file header: " + filename);
+    }
+
+    const VitalIndex &idx = impl->idx;
+    tzBias = idx.dgmt / 60.0;
+    dtStart = dtEnd = 0.0;
+    if (idx.body >= 10 + 26)
+    {
+        dtStart = idx.dtstart;
+        dtEnd = idx.dtend;
+    }
+    for (auto &kv : idx.trks)
+    {
+        const VitalIndex::Track &ti = kv.second;
+        if (!ti.info)
+            continue;
+        TrackInfo &tr = catalog[ti.tid];
+        trackFromIndex(ti, tr);
+        if (ti.has_data())
+        {
+            tr.dtStart = ti.dtstart;
+            tr.dtEnd = ti.dtend;
+        }
+        tr.count = ti.count;
+        tr.sum = ti.sum;
+        tr.minVal = ti.minval;
+        tr.maxVal = ti.maxval;
+        tr.firstVal = ti.firstval;
+    }
+}
+
+LazyVitalFile::~LazyVitalFile() = default;
+
+bool LazyVitalFile::isLoaded(std::uint16_t tid) const
+{
+    return impl->loaded.count(tid) > 0;
+}
+
+const TrackInfo &LazyVitalFile::track(std::uint16_t tid)
+{
+    auto it = catalog.find(tid);
+    if (it == catalog.end())
+    {
+        throw std::out_of_range("No such track: " + std::to_string(tid));
+    }
+    if (isLoaded(tid))
+        return it->second;
+
+    // seek to each rec of the track and decode only those
+    VitalCollector collector(false, nullptr, 0.0, 0.0);
+    collector.onTrack(it->second);
+    GZMapReader &gz = *impl->gz;
+    PacketReader pr(gz);
+    PacketView pkt;
+    RecView rec;
+    std::vector<float> samples;
+    for (std::uint64_t off : impl->idx.trks[tid].recs)
+    {
+        if (!gz.seek(off) || !pr.next(pkt))
+            break;
+        if (pkt.type == 1 && rec.parse(pkt) && rec.tid == tid)
+            visitRecord(it->second, rec, collector, samples);
+    }
+    it->second = std::move(collector.result.tracks[tid]);
+    impl->loaded.insert(tid);
+    return it->second;
+}
+
+void LazyVitalFile::unload(std::uint16_t tid)
+{
+    auto it = catalog.find(tid);
+    if (it == catalog.end() || !impl->loaded.erase(tid))
+        return;
+    // back to the catalog entry
+    TrackInfo &tr = it->second;
+    tr.numericValues = std::vector<float>();
+    tr.recordTimestamps = std::vector<double>();
+    tr.stringValues = StringDict();
+    tr.waveform = std::vector<float>();
+    tr.waveformSegments = std::vector<WaveSegment>();
 }
@@ -1,11 +1,111 @@
 #ifndef VITAL_LIB_H
 #define VITAL_LIB_H
 
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <set>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * One wave record: samples [sampleOffset, sampleOffset + count) of TrackInfo::waveform,
+ * the first at dtStart and the next ones 1 / srate apart.
+ */
+struct WaveSegment
+{
+    double dtStart;
+    float srate;
+    std::uint64_t sampleOffset;
+    std::uint32_t count;
+};
+
+/**
+ * The values of a STR track. Event, alarm and drug name tracks repeat a few strings
+ * thousands of times, so each distinct value is stored once in an arena and the
+ * records keep its code. Reads like a vector of strings.
+ */
+class StringDict
+{
+public:
+    StringDict() = default;
+    StringDict(const StringDict &other);
+    StringDict &operator=(const StringDict &other);
+    StringDict(StringDict &&) = default;
+    StringDict &operator=(StringDict &&) = default;
+
+    /** Number of records */
+    std::size_t size() const { return codes.size(); }
+    bool empty() const { return codes.empty(); }
+    /** Value of record i, valid as long as the dictionary */
+    std::string_view operator[](std::size_t i) const { return dict[codes[i]]; }
+    /** Code of record i, an index into the distinct values */
+    std::uint32_t code(std::size_t i) const { return codes[i]; }
+    /** Number of distinct values */
+    std::size_t distinct() const { return dict.size(); }
+    std::string_view value(std::uint32_t code) const { return dict[code]; }
+
+    /**
+     * @brief Append a record.
+     * @param added Set to whether the value was not in the dictionary yet.
+     * @return The code of the value.
+     */
+    std::uint32_t push_back(std::string_view s, bool *added = nullptr);
+    void clear();
+
+    /** Walks the records in order, yielding each value as a string_view into the dictionary */
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = const std::string_view &;
+
+        const_iterator() = default;
+        reference operator*() const { return d->dict[d->codes[i]]; }
+        reference operator[](difference_type n) const { return d->dict[d->codes[i + n]]; }
+        const_iterator &operator++() { ++i; return *this; }
+        const_iterator operator++(int) { const_iterator t = *this; ++i; return t; }
+        const_iterator &operator--() { --i; return *this; }
+        const_iterator operator--(int) { const_iterator t = *this; --i; return t; }
+        const_iterator &operator+=(difference_type n) { i += n; return *this; }
+        const_iterator &operator-=(difference_type n) { i -= n; return *this; }
+        const_iterator operator+(difference_type n) const { return const_iterator(d, i + n); }
+        const_iterator operator-(difference_type n) const { return const_iterator(d, i - n); }
+        difference_type operator-(const const_iterator &o) const { return (difference_type)i - (difference_type)o.i; }
+        bool operator==(const const_iterator &o) const { return i == o.i; }
+        bool operator!=(const const_iterator &o) const { return i != o.i; }
+        bool operator<(const const_iterator &o) const { return i < o.i; }
+        bool operator>(const const_iterator &o) const { return i > o.i; }
+        bool operator<=(const const_iterator &o) const { return i <= o.i; }
+        bool operator>=(const const_iterator &o) const { return i >= o.i; }
+
+    private:
+        friend class StringDict;
+        const_iterator(const StringDict *d, std::size_t i) : d(d), i(i) {}
+        const StringDict *d = nullptr;
+        std::size_t i = 0;
+    };
+    using iterator = const_iterator;
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, codes.size()); }
+
+private:
+    static constexpr std::size_t BLOCK = 64 * 1024;
+    std::vector<std::unique_ptr<char[]>> blocks; // the arena
+    std::size_t blockUsed = BLOCK;
+    std::vector<std::string_view> dict;
+    std::unordered_map<std::string_view, std::uint32_t> lookup;
+    std::vector<std::uint32_t> codes;
+};
 
 /**
  * A small struct to hold all your track information. You can expand or rename as needed.
@@ -17,6 +117,9 @@ struct TrackInfo
     std::string deviceName;
     std::uint32_t deviceId;
     std::uint8_t recType;
+    std::uint8_t recFmt;  // Sample format of WAV records, 1: float ... 8: dword
+    double adcGain;       // Integer WAV samples are scaled by adcGain and shifted by adcOffset
+    double adcOffset;
     double dtStart;
     double dtEnd;
     float sampleRate;
@@ -24,14 +127,25 @@ struct TrackInfo
     float maxVal;
     std::uint64_t count;
     double sum;
-    std::string firstVal;
+    std::string firstVal; // First NUM value, or all STR values joined by " | ", cut at 4 KB
     // For numeric data
     std::vector<float> numericValues;
     std::vector<double> recordTimestamps;  // Stores dt for NUM and STR
-    std::vector<std::string> stringValues; // Stores STR values
-    // For waveform data
+    StringDict stringValues;               // Stores STR values
+    // For waveform data, decoded to float whatever recFmt is
     std::vector<float> waveform;
-    std::vector<double> waveformTimestamps; // Stores per-sample timestamps for WAV
+    std::vector<WaveSegment> waveformSegments; // One per WAV record, in file order
+
+    /**
+     * @brief Time of waveform[i], computed from its segment.
+     */
+    double sampleTime(std::size_t i) const;
+
+    /**
+     * @brief Index of the first waveform sample at or after dt, or waveform.size() if there is none.
+     *        Segments are expected in time order, as Vital Recorder writes them.
+     */
+    std::size_t sampleIndex(double dt) const;
 };
 
 /**
@@ -41,7 +155,7 @@ struct TrackInfo
 struct VitalFileData
 {
     // Global or top-level info
-    double tzBias;
+    double tzBias; // the header's dgmt in hours (minutes / 60)
     double dtStart;
     double dtEnd;
 
@@ -49,18 +163,116 @@ struct VitalFileData
     std::map<std::uint16_t, TrackInfo> tracks;
 };
 
+/**
+ * A .vital file opened for lazy reading. Opening reads only the header and the track
+ * catalog and notes where the records of each track are; the values of a track are
+ * decoded the first time track() asks for it. A fresh sidecar index (vital_index)
+ * makes opening independent of the file size. Not thread safe.
+ */
+class LazyVitalFile
+{
+public:
+    /**
+     * @brief Open a vital file.
+     * @throws std::runtime_error if the file cannot be opened or has no vital header.
+     */
+    explicit LazyVitalFile(const std::string &filename);
+    ~LazyVitalFile();
+    LazyVitalFile(const LazyVitalFile &) = delete;
+    LazyVitalFile &operator=(const LazyVitalFile &) = delete;
+
+    double tzBias;
+    double dtStart;
+    double dtEnd;
+
+    /**
+     * @brief All tracks, keyed by track id. Tracks that were not loaded have their metadata,
+     *        time range and statistics but no values.
+     */
+    const std::map<std::uint16_t, TrackInfo> &tracks() const { return catalog; }
+
+    /**
+     * @brief A track with its values, decoded on first access.
+     * @throws std::out_of_range if there is no such track.
+     */
+    const TrackInfo &track(std::uint16_t tid);
+
+    bool isLoaded(std::uint16_t tid) const;
+
+    /**
+     * @brief Free the values of a track. They are decoded again on the next access.
+     */
+    void unload(std::uint16_t tid);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+    std::map<std::uint16_t, TrackInfo> catalog;
+};
+
+/**
+ * Receives the contents of a .vital file from parseVitalFile(filename, visitor) in one
+ * streaming pass, so files larger than memory can be processed. Override the events
+ * you need; the others do nothing. Strings and samples are only valid during the call.
+ */
+class VitalVisitor
+{
+public:
+    virtual ~VitalVisitor() = default;
+
+    /**
+     * @brief The file header, before any packet.
+     */
+    virtual void onHeader(double /*tzBias*/, double /*dtStart*/, double /*dtEnd*/) {}
+
+    /**
+     * @brief A device info packet.
+     */
+    virtual void onDevice(std::uint32_t /*did*/, const std::string & /*deviceName*/) {}
+
+    /**
+     * @brief A track info packet. Only the metadata of track is filled in, not its values.
+     */
+    virtual void onTrack(const TrackInfo & /*track*/) {}
+
+    /**
+     * @brief Whether to read a record of track. Records that are not wanted are skipped
+     *        without being decoded.
+     *
+     * @param dt Start time of the record.
+     * @param dtEnd Latest time the record can reach: dt, or for waves the end of as many
+     *              samples as the packet length allows.
+     */
+    virtual bool wantRecord(const TrackInfo & /*track*/, double /*dt*/, double /*dtEnd*/) { return true; }
+
+    /**
+     * @brief A numeric record.
+     */
+    virtual void onNumeric(std::uint16_t /*tid*/, double /*dt*/, float /*value*/) {}
+
+    /**
+     * @brief A string record, as it is stored in the file.
+     */
+    virtual void onString(std::uint16_t /*tid*/, double /*dt*/, std::string_view /*value*/) {}
+
+    /**
+     * @brief A wave record decoded to floats. The samples are 1 / sampleRate apart from dt.
+     */
+    virtual void onWaveBlock(std::uint16_t /*tid*/, double /*dt*/, const float * /*samples*/, std::size_t /*count*/) {}
+};
+
 /**
  * @brief Saves two waveforms to a CSV file with high precision.
  *
  * @param filename The CSV file to create.
- * @param waveform1 Vector of samples for first waveform.
+ * @param track1 First waveform track. Its samples give the time column.
  * @param name1 Column name for first waveform.
- * @param waveform2 Vector of samples for second waveform.
+ * @param track2 Second waveform track.
  * @param name2 Column name for second waveform.
  */
 void save_waveforms_to_csv(const std::string &filename,
-                           const std::vector<double> &timestamps1, const std::vector<float> &waveform1, const std::string &name1,
-                           const std::vector<double> &timestamps2, const std::vector<float> &waveform2, const std::string &name2);
+                           const TrackInfo &track1, const std::string &name1,
+                           const TrackInfo &track2, const std::string &name2);
 
 /**
  * @brief Whether a character is not printable ASCII (excluding tab, CR, LF).
@@ -77,4 +289,124 @@ bool isNotPrintable(char c);
  */
 VitalFileData parseVitalFile(const std::string &filename, bool isShort);
 
+/**
+ * @brief Parse only some tracks of a .vital file, optionally within a time window.
+ *        Records of the other tracks and records outside the window are skipped
+ *        by their packet length without being decoded.
+ *
+ * @param filename The path to the vital file (gzipped).
+ * @param selectors Tracks to load as "DNAME/TNAME", or "TNAME" for any device, like vital_recs.
+ *                  If empty, every track is loaded.
+ * @param t0 Start of the window in unix time, inclusive. 0 means the start of the file.
+ * @param t1 End of the window, exclusive. 0 means the end of the file.
+ * @return Only the selected tracks. Their samples, values, time ranges and statistics
+ *         cover the window; wave records are cut at its edges.
+ */
+VitalFileData parseVitalFile(const std::string &filename, const std::set<std::string> &selectors,
+                             double t0 = 0.0, double t1 = 0.0);
+
+/**
+ * @brief Read a .vital file in one streaming pass and pass its contents to a visitor.
+ *        Memory use does not grow with the file: only the track catalog is kept.
+ *        parseVitalFile(filename, isShort) is itself a visitor that keeps everything.
+ *
+ * @param filename The path to the vital file (gzipped).
+ * @param visitor Receives the header, devices, tracks and records in file order.
+ * @throws std::runtime_error if the file cannot be opened or has no vital header.
+ */
+void parseVitalFile(const std::string &filename, VitalVisitor &visitor);
+
+/**
+ * @brief Parses many files one after another with the same state: the inflate stream,
+ *        the read buffers, the track table and the capacity of the value vectors are
+ *        reused instead of being allocated again for every file. Not thread safe;
+ *        use one per thread, or take them from a VitalParserPool.
+ */
+class VitalParser
+{
+public:
+    VitalParser();
+    ~VitalParser();
+    VitalParser(const VitalParser &) = delete;
+    VitalParser &operator=(const VitalParser &) = delete;
+
+    /**
+     * @brief Like parseVitalFile(filename, isShort). The result belongs to the parser
+     *        and stays valid until the next parse; move from it to keep it longer.
+     * @throws std::runtime_error if the file cannot be opened or has no vital header.
+     */
+    VitalFileData &parse(const std::string &filename, bool isShort = false);
+
+    /**
+     * @brief Like parseVitalFile(filename, selectors, t0, t1), with the result kept as above.
+     */
+    VitalFileData &parse(const std::string &filename, const std::set<std::string> &selectors,
+                         double t0 = 0.0, double t1 = 0.0);
+
+    /**
+     * @brief Like parseVitalFile(filename, visitor).
+     */
+    void parse(const std::string &filename, VitalVisitor &visitor);
+
+    /**
+     * @brief Free the result and everything kept for the next file.
+     */
+    void release();
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+/**
+ * @brief Idle VitalParsers for worker threads. A thread leases a parser for a file or a
+ *        batch of files, and the parser goes back to the pool with its buffers when the
+ *        lease ends, so the pool grows only to the number of threads parsing at once.
+ */
+class VitalParserPool
+{
+public:
+    class Lease
+    {
+    public:
+        Lease(Lease &&other) noexcept : pool(other.pool), parser(std::move(other.parser)) {}
+        Lease(const Lease &) = delete;
+        Lease &operator=(const Lease &) = delete;
+        ~Lease()
+        {
+            if (parser)
+                pool->release(std::move(parser));
+        }
+
+        VitalParser &operator*() const { return *parser; }
+        VitalParser *operator->() const { return parser.get(); }
+
+    private:
+        friend class VitalParserPool;
+        Lease(VitalParserPool *pool, std::unique_ptr<VitalParser> parser) : pool(pool), parser(std::move(parser)) {}
+        VitalParserPool *pool;
+        std::unique_ptr<VitalParser> parser;
+    };
+
+    /**
+     * @brief An idle parser, or a new one if every parser is leased. Safe from any thread.
+     */
+    Lease acquire();
+
+    /**
+     * @brief Number of idle parsers.
+     */
+    std::size_t idle() const;
+
+    /**
+     * @brief Free the idle parsers.
+     */
+    void clear();
+
+private:
+    void release(std::unique_ptr<VitalParser> parser);
+    mutable std::mutex mtx;
+    std::vector<std::unique_ptr<VitalParser>> parsers;
+};
+
 #endif // VITAL_LIB_H
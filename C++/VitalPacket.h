@@ -0,0 +1,369 @@
+#pragma once
+#define MAX_PACKET 1000000 // larger datalen means a broken file
+#define FIRSTVAL_MAX 4096 // bytes of the firstval summary of a str track
+#include "GZReader.h"
+#include <string_view>
+#include <vector>
+
+// The fixed-width fields of a packet part, in file order. Sizes and offsets are known at
+// compile time, so decode and encode are one memcpy per field at a constant offset with
+// no check per field. The fields bind to their exact types, so a mis-sized one does not compile.
+template <typename... T>
+struct PackedLayout
+{
+	static_assert((std::is_trivially_copyable<T>::value && ...), "raw fields only");
+	static constexpr std::uint32_t size = (0 + ... + (std::uint32_t)sizeof(T));
+
+	// p must hold size bytes. returns the end of the fields
+	static const unsigned char *decode(const unsigned char *p, T &...x)
+	{
+		((memcpy(&x, p, sizeof(T)), p += sizeof(T)), ...);
+		return p;
+	}
+
+	static unsigned char *encode(unsigned char *p, const T &...x)
+	{
+		((memcpy(p, &x, sizeof(T)), p += sizeof(T)), ...);
+		return p;
+	}
+
+	static void append(std::vector<unsigned char> &v, const T &...x)
+	{
+		std::size_t n = v.size();
+		v.resize(n + size);
+		encode(v.data() + n, x...);
+	}
+};
+
+// type, datalen
+using PacketHead = PackedLayout<std::uint8_t, std::uint32_t>;
+// devinfo: did, then dtype, dname and port with their lengths
+using DevInfoHead = PackedLayout<std::uint32_t>;
+// trkinfo: tid, rectype, recfmt, then tname and unit with their lengths
+using TrkInfoHead = PackedLayout<std::uint16_t, std::uint8_t, std::uint8_t>;
+// trkinfo after unit: mindisp, maxdisp, col, srate, adc_gain, adc_offset, montype, did
+using TrkInfoTail = PackedLayout<float, float, std::uint32_t, float, double, double, std::uint8_t, std::uint32_t>;
+// rec: infolen, dt, tid, then the track-type specific part
+using RecHead = PackedLayout<std::uint16_t, double, std::uint16_t>;
+// a whole rec packet up to the track-type specific part, for the writers
+using RecPacketHead = PackedLayout<std::uint8_t, std::uint32_t, std::uint16_t, double, std::uint16_t>;
+
+static_assert(PacketHead::size == 5 && RecHead::size == 12 && RecPacketHead::size == 17, "rec layout");
+static_assert(TrkInfoHead::size == 4 && TrkInfoTail::size == 37, "trkinfo layout");
+
+// 4-byte length + bytes
+inline void append_str(std::vector<unsigned char> &v, std::string_view s)
+{
+	std::uint32_t len = (std::uint32_t)s.size();
+	v.insert(v.end(), (const unsigned char *)&len, (const unsigned char *)&len + 4);
+	v.insert(v.end(), s.begin(), s.end());
+}
+
+// One packet of the vital body. payload points into the reader's buffer
+// and stays valid until the next packet is read.
+struct PacketView
+{
+	std::uint8_t type = 0; // 0: trkinfo, 1: rec, 9: devinfo
+	std::uint32_t datalen = 0;
+	const unsigned char *payload = nullptr;
+
+	// the PacketHead::size bytes in front of the payload
+	void encode_head(unsigned char *p) const
+	{
+		PacketHead::encode(p, type, datalen);
+	}
+};
+
+// Bounds-checked little-endian cursor over a packet payload
+class PacketCursor
+{
+	const unsigned char *m_ptr;
+	const unsigned char *m_end;
+
+public:
+	PacketCursor(const unsigned char *p, std::uint32_t len) : m_ptr(p), m_end(p + len) {}
+	PacketCursor(const PacketView &pkt) : PacketCursor(pkt.payload, pkt.datalen) {}
+
+	std::uint32_t remain() const
+	{
+		return (std::uint32_t)(m_end - m_ptr);
+	}
+	const unsigned char *ptr() const
+	{
+		return m_ptr;
+	}
+
+	template <typename T>
+	bool get(T &x)
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "raw fields only");
+		if (remain() < sizeof(T))
+			return false;
+		memcpy(&x, m_ptr, sizeof(T));
+		m_ptr += sizeof(T);
+		return true;
+	}
+
+	// 4-byte length + bytes, like GZReader::fetch_with_len
+	bool get_str(std::string_view &x)
+	{
+		std::uint32_t len = 0;
+		if (!get(len))
+			return false;
+		if (len >= 1048576 || remain() < len)
+			return false;
+		x = std::string_view((const char *)m_ptr, len);
+		m_ptr += len;
+		return true;
+	}
+
+	// every field of a PackedLayout with one bounds check
+	template <typename Layout, typename... T>
+	bool get_packed(T &...x)
+	{
+		if (remain() < Layout::size)
+			return false;
+		m_ptr = Layout::decode(m_ptr, x...);
+		return true;
+	}
+
+	bool skip(std::uint32_t len)
+	{
+		if (remain() < len)
+			return false;
+		m_ptr += len;
+		return true;
+	}
+};
+
+// type 9
+struct DevInfoView
+{
+	std::uint32_t did = 0;
+	std::string_view dtype;
+	std::string_view dname; // falls back to dtype when empty
+	std::string_view port;
+	std::string_view more; // bytes after port, kept by encode
+
+	bool parse(const PacketView &pkt)
+	{
+		PacketCursor c(pkt);
+		more = std::string_view();
+		if (!c.get_packed<DevInfoHead>(did) || !c.get_str(dtype) || !c.get_str(dname))
+			return false;
+		if (dname.empty())
+			dname = dtype;
+		if (c.get_str(port))
+			more = std::string_view((const char *)c.ptr(), c.remain());
+		return true;
+	}
+
+	// the payload of a devinfo packet
+	void encode(std::vector<unsigned char> &v) const
+	{
+		DevInfoHead::append(v, did);
+		append_str(v, dtype);
+		append_str(v, dname);
+		append_str(v, port);
+		v.insert(v.end(), more.begin(), more.end());
+	}
+};
+
+// type 0. fields after tname are optional in older files and keep their defaults
+struct TrkInfoView
+{
+	std::uint16_t tid = 0;
+	std::uint8_t rectype = 0; // 1: wav, 2: num, 5: str
+	std::uint8_t recfmt = 0;  // 1: float, 2: double, 3: char, 4: byte, 5: short, 6: word, 7: long, 8: dword
+	std::string_view tname;
+	std::string_view unit;
+	float mindisp = 0.f;
+	float maxdisp = 0.f;
+	std::uint32_t col = 0;
+	float srate = 0.f;
+	double adc_gain = 1.0;
+	double adc_offset = 0.0;
+	std::uint8_t montype = 0;
+	std::uint32_t did = 0;
+	bool full = false;	   // every field up to did was present
+	std::string_view more; // bytes after did of a full trkinfo, kept by encode
+
+	bool parse(const PacketView &pkt)
+	{
+		PacketCursor c(pkt);
+		more = std::string_view();
+		full = false;
+		if (!c.get_packed<TrkInfoHead>(tid, rectype, recfmt) || !c.get_str(tname))
+			return false;
+		if (!c.get_str(unit))
+			return true;
+		full = c.get_packed<TrkInfoTail>(mindisp, maxdisp, col, srate, adc_gain, adc_offset, montype, did);
+		if (full)
+			more = std::string_view((const char *)c.ptr(), c.remain());
+		else // stop at the first missing field
+			(void)(c.get(mindisp) && c.get(maxdisp) && c.get(col) && c.get(srate) && c.get(adc_gain) &&
+				   c.get(adc_offset) && c.get(montype));
+		return true;
+	}
+
+	// the payload of a trkinfo packet. one that is not full ends at tname, like the oldest files
+	void encode(std::vector<unsigned char> &v) const
+	{
+		TrkInfoHead::append(v, tid, rectype, recfmt);
+		append_str(v, tname);
+		if (!full)
+			return;
+		append_str(v, unit);
+		TrkInfoTail::append(v, mindisp, maxdisp, col, srate, adc_gain, adc_offset, montype, did);
+		v.insert(v.end(), more.begin(), more.end());
+	}
+};
+
+// type 1. data points to the track-type specific part after infolen
+struct RecView
+{
+	std::uint16_t infolen = 10;
+	double dt = 0.0;
+	std::uint16_t tid = 0;
+	const unsigned char *data = nullptr;
+	std::uint32_t len = 0;
+
+	bool parse(const PacketView &pkt)
+	{
+		PacketCursor c(pkt);
+		if (!c.get_packed<RecHead>(infolen, dt, tid))
+			return false;
+		data = c.ptr();
+		len = c.remain();
+		return true;
+	}
+
+	// the payload of a rec packet
+	void encode(std::vector<unsigned char> &v) const
+	{
+		RecHead::append(v, infolen, dt, tid);
+		v.insert(v.end(), data, data + len);
+	}
+
+	// wav: sample count and the raw samples that are actually present
+	bool wav(std::uint32_t &nsamp, const unsigned char *&samples) const
+	{
+		PacketCursor c(data, len);
+		if (!c.get(nsamp))
+			return false;
+		samples = c.ptr();
+		return true;
+	}
+
+	bool num(float &fval) const
+	{
+		PacketCursor c(data, len);
+		return c.get(fval);
+	}
+
+	bool str(std::string_view &sval) const
+	{
+		PacketCursor c(data, len);
+		return c.skip(4) && c.get_str(sval);
+	}
+};
+
+// firstval of a str track: every value, repeats too, joined by " | " in record order,
+// cut at FIRSTVAL_MAX bytes, moved back so that no utf-8 character is split.
+// the caller passes each record's value
+inline void append_firstval(std::string &firstval, std::string_view sval)
+{
+	// a cut backs off at most 3 bytes, so a summary that long is already complete
+	if (firstval.size() + 3 >= FIRSTVAL_MAX)
+		return;
+	if (!firstval.empty())
+		firstval += " | ";
+	firstval += sval;
+	if (firstval.size() > FIRSTVAL_MAX)
+	{
+		// back off the continuation bytes (10xxxxxx) to the lead byte of the cut character
+		std::size_t cut = FIRSTVAL_MAX;
+		while (cut > 0 && ((unsigned char)firstval[cut] & 0xC0) == 0x80)
+			cut--;
+		firstval.resize(cut);
+	}
+}
+
+// Iterates the packets of a vital body without copying them out field by field.
+// The reader must be positioned at the first packet (after the header).
+class PacketReader
+{
+	GZReader &m_gz;
+	bool m_bad = false;
+
+public:
+	PacketReader(GZReader &gz) : m_gz(gz) {}
+
+	// false at the end of file, on a truncated packet, or on an insane datalen
+	bool next(PacketView &pkt)
+	{
+		unsigned char hdr[PacketHead::size];
+		if (m_gz.read(hdr, PacketHead::size) != PacketHead::size)
+			return false;
+		PacketHead::decode(hdr, pkt.type, pkt.datalen);
+		if (pkt.datalen > MAX_PACKET)
+		{
+			m_bad = true;
+			return false;
+		}
+		pkt.payload = m_gz.view(pkt.datalen);
+		return pkt.payload != nullptr;
+	}
+
+	// like next(), but a rec packet is read only up to its tid and shown to keep(rec).
+	// rejected and unparsable recs are skipped by their length without viewing the data.
+	// for a kept rec, rec.data holds the rest of the packet and pkt.payload is null
+	template <typename Keep>
+	bool next(PacketView &pkt, RecView &rec, Keep keep)
+	{
+		const std::uint32_t headlen = RecHead::size;
+		while (true)
+		{
+			unsigned char hdr[PacketHead::size + headlen];
+			if (m_gz.read(hdr, PacketHead::size) != PacketHead::size)
+				return false;
+			PacketHead::decode(hdr, pkt.type, pkt.datalen);
+			if (pkt.datalen > MAX_PACKET)
+			{
+				m_bad = true;
+				return false;
+			}
+			if (pkt.type != 1)
+			{
+				pkt.payload = m_gz.view(pkt.datalen);
+				return pkt.payload != nullptr;
+			}
+			if (pkt.datalen < headlen)
+			{
+				if (!m_gz.skip(pkt.datalen))
+					return false;
+				continue;
+			}
+			if (m_gz.read(hdr + PacketHead::size, headlen) != headlen)
+				return false;
+			RecHead::decode(hdr + PacketHead::size, rec.infolen, rec.dt, rec.tid);
+			rec.data = nullptr;
+			rec.len = pkt.datalen - headlen;
+			if (!keep(rec))
+			{
+				if (!m_gz.skip(rec.len))
+					return false;
+				continue;
+			}
+			pkt.payload = nullptr;
+			rec.data = m_gz.view(rec.len);
+			return rec.data != nullptr;
+		}
+	}
+
+	// stopped on a broken packet rather than at the end of file
+	bool bad() const
+	{
+		return m_bad;
+	}
+};
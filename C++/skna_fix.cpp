@@ -10,7 +10,8 @@
 #include <stdarg.h> // For va_start, etc.
 #include <memory>	// For std::unique_ptr
 #include <time.h>
-#include "GZReader.h"
+#include "GZParWriter.h"
+#include "VitalPacket.h"
 #include "Util.h"
 #include <queue>
 #include <complex>
@@ -268,7 +269,7 @@ int main(int argc, char *argv[])
 Usage : %s INPUT_PATH OUTPUT_PATH\n\n\
 INPUT_PATH: vital file path\n\
 OUTPUT_DIR: output file path\n",
-				basename(argv[0]).c_str());
+				basename(string(argv[0])).c_str());
 		return -1;
 	}
 	argc--;
@@ -277,7 +278,7 @@ OUTPUT_DIR: output file path\n",
 	////////////////////////////////////////////////////////////
 	// parse dname/tname
 	////////////////////////////////////////////////////////////
-	GZWriter fw(argv[1]); // ���� ������ ����.
+	GZParWriter fw(argv[1]); // ���� ������ ����.
 	GZReader fr(argv[0]); // ���� ������ ����.
 	if (!fr.opened() || !fw.opened())
 	{
@@ -314,17 +315,13 @@ OUTPUT_DIR: output file path\n",
 
 	fw.write(&header[0], header.size());
 
-	map<unsigned long, string> did_dname;
-	map<unsigned long, BUF> did_di;
+	map<uint32_t, string> did_dname;
+	map<uint32_t, BUF> did_di;
 	map<unsigned short, string> tid_tname;
 	map<unsigned short, BUF> tid_ti;
-	map<unsigned short, unsigned long> tid_did;
+	map<unsigned short, uint32_t> tid_did;
 	map<unsigned short, BUF> tid_recs;
 
-	// �ѹ� �����鼭 ���� ����, ���� �ð��� ����
-	double dtstart = DBL_MAX;
-	double dtend = 0;
-
 	short ch_last[2] = {
 		0,
 	};
@@ -360,57 +357,38 @@ OUTPUT_DIR: output file path\n",
 	double volt_max = 2420 / 12.0;
 	double volt_min = -2420 / 12.0;
 	double m_gain = (volt_max - volt_min) / (cnt_max - cnt_min);
-	double m_askna_dt = 0;
 
 	// �� ���� �����鼭 devinfo, trkinfo �� �� ����
-	while (!fr.eof())
+	// a packet as it was read
+	auto write_packet = [&](const PacketView &pkt)
+	{
+		unsigned char head[PacketHead::size];
+		pkt.encode_head(head);
+		fw.write(head, PacketHead::size);
+		fw.write(pkt.payload, pkt.datalen);
+	};
+
+	PacketReader pr(fr);
+	PacketView pkt;
+	while (pr.next(pkt))
 	{ // body�� ��Ŷ�� �����̴�.
-		unsigned char packet_type;
-		if (!fr.read(&packet_type, 1))
-			break;
-		unsigned long packet_len;
-		if (!fr.read(&packet_len, 4))
-			break;
-		if (packet_len > 1000000)
-			break; // 1MB �̻��� ��Ŷ�� ����
-		if (packet_type == 1)
-		{
-			fr.skip(packet_len);
+		if (pkt.type == 1)
 			continue; // rec
-		}
 
-		BUF packet_header(5);
-		packet_header[0] = packet_type;
-		memcpy(&packet_header[1], &packet_len, 4);
-
-		// �ϰ��� �����ؾ��ϹǷ� �ϰ��� ���� �� �ۿ� ����
-		BUF buf(packet_len);
-		if (!fr.read(&buf[0], packet_len))
-			break;
-		if (packet_type == 9)
+		if (pkt.type == 9)
 		{ // devinfo
-			unsigned long did = 0;
-			if (!buf.fetch(did))
-				continue;
-			string dtype;
-			if (!buf.fetch_with_len(dtype))
-				continue;
-			string dname;
-			if (!buf.fetch_with_len(dname))
+			DevInfoView di;
+			if (!di.parse(pkt))
 				continue;
-			if (dname.empty())
-				dname = dtype;
-			did_dname[did] = dname;
+			did_dname[di.did] = string(di.dname);
 		}
-		else if (packet_type == 0)
+		else if (pkt.type == 0)
 		{ // trkinfo
-			unsigned short tid;
-			if (!buf.fetch(tid))
-				continue;
-			buf.skip(2);
-			string tname;
-			if (!buf.fetch_with_len(tname))
+			TrkInfoView ti;
+			if (!ti.parse(pkt))
 				continue;
+			auto tid = ti.tid;
+			auto tname = ti.tname;
 			if (tname == "CH1")
 			{
 				tid_ch[0] = tid;
@@ -446,8 +424,7 @@ OUTPUT_DIR: output file path\n",
 		}
 
 		// �� �� ��Ŷ
-		fw.write(&packet_header[0], packet_header.size());
-		fw.write(&buf[0], buf.size());
+		write_packet(pkt);
 	}
 
 	fr.rewind(); // �� ����
@@ -455,38 +432,16 @@ OUTPUT_DIR: output file path\n",
 		return -1; // ����� �ǳʶ�
 
 	// rec �����鼭 ����.
-	while (!fr.eof())
+	while (pr.next(pkt))
 	{ // body�� ��Ŷ�� �����̴�.
-		unsigned char packet_type;
-		if (!fr.read(&packet_type, 1))
-			break;
-		unsigned long packet_len;
-		if (!fr.read(&packet_len, 4))
-			break;
-		if (packet_len > 1000000)
-			break; // 1MB �̻��� ��Ŷ�� ����
-		if (packet_type != 1)
-		{
-			fr.skip(packet_len);
-			continue; // rec
-		}
-
-		BUF packet_header(5);
-		packet_header[0] = packet_type;
-		memcpy(&packet_header[1], &packet_len, 4);
-
-		// �ϰ��� �����ؾ��ϹǷ� �ϰ��� ���� �� �ۿ� ����
-		BUF buf(packet_len);
-		if (!fr.read(&buf[0], packet_len))
-			break;
-
-		buf.skip(2);
-		double dt;
-		if (!buf.fetch(dt))
+		if (pkt.type != 1)
 			continue;
-		unsigned short tid;
-		if (!buf.fetch(tid))
+
+		RecView rec;
+		if (!rec.parse(pkt))
 			continue;
+		double dt = rec.dt;
+		unsigned short tid = rec.tid;
 
 		int ch = -1;
 		if (tid == tid_skna[0])
@@ -511,15 +466,15 @@ OUTPUT_DIR: output file path\n",
 		}
 		if (ch != -1)
 		{
-			unsigned long nsamp;
-			if (!buf.fetch(nsamp))
+			uint32_t nsamp;
+			const unsigned char *samples;
+			if (!rec.wav(nsamp, samples))
 				continue;
-			if (!nsamp)
+			if (!nsamp || nsamp > (rec.len - 4) / 2)
 				continue;
 
 			vector<short> vals(nsamp);
-			if (!buf.fetch(&vals[0], 2 * nsamp))
-				continue;
+			memcpy(&vals[0], samples, 2 * nsamp);
 
 			// ������ ���� �������� �̵�
 			short shift = ch_last[ch] - vals[0];
@@ -541,10 +496,11 @@ OUTPUT_DIR: output file path\n",
 
 			// raw �����͸� ����
 			unsigned short infolen = 10;
-			fw.write(&packet_header[0], packet_header.size());
-			fw.write(infolen);
-			fw.write(dt);
-			fw.write(tid);
+			unsigned char packet_type = 1;
+			uint32_t packet_len = RecHead::size + 4 + 2 * nsamp;
+			unsigned char head[RecPacketHead::size];
+			RecPacketHead::encode(head, packet_type, packet_len, infolen, dt, tid);
+			fw.write(head, RecPacketHead::size);
 			fw.write(nsamp);
 			fw.write(&vals[0], 2 * nsamp);
 
@@ -570,12 +526,9 @@ OUTPUT_DIR: output file path\n",
 			{
 				nsamp = filtered.size();
 				packet_type = 1;
-				packet_len = 12 + 4 + nsamp;
-				fw.write(packet_type);
-				fw.write(packet_len);
-				fw.write(infolen);
-				fw.write(dt);
-				fw.write(tid_skna[ch]);
+				packet_len = RecHead::size + 4 + nsamp;
+				RecPacketHead::encode(head, packet_type, packet_len, infolen, dt, tid_skna[ch]);
+				fw.write(head, RecPacketHead::size);
 				fw.write(nsamp);
 				for (auto &v : filtered)
 				{
@@ -597,12 +550,9 @@ OUTPUT_DIR: output file path\n",
 			{
 				nsamp = iskna.size();
 				packet_type = 1;
-				packet_len = 12 + 4 + 4 * nsamp;
-				fw.write(packet_type);
-				fw.write(packet_len);
-				fw.write(infolen);
-				fw.write(dt);
-				fw.write(tid_iskna[ch]);
+				packet_len = RecHead::size + 4 + 4 * nsamp;
+				RecPacketHead::encode(head, packet_type, packet_len, infolen, dt, tid_iskna[ch]);
+				fw.write(head, RecPacketHead::size);
 				fw.write(nsamp);
 				fw.write(&iskna[0], 4 * nsamp);
 			}
@@ -611,22 +561,25 @@ OUTPUT_DIR: output file path\n",
 			if (tid_askna[ch])
 			{
 				packet_type = 1;
-				packet_len = 12 + 4;
+				packet_len = RecHead::size + 4;
 				float val = (float)m_askna[ch].Get() * 1000.0f;
-				fw.write(packet_type);
-				fw.write(packet_len);
-				fw.write(infolen);
-				fw.write(dt);
-				fw.write(tid_askna[ch]);
+				RecPacketHead::encode(head, packet_type, packet_len, infolen, dt, tid_askna[ch]);
+				fw.write(head, RecPacketHead::size);
 				fw.write(val);
 			}
 			continue;
 		}
 
 		// �� �� ��Ŷ
-		fw.write(&packet_header[0], packet_header.size());
-		fw.write(&buf[0], buf.size());
+		write_packet(pkt);
 	}
 
+	// the deflate threads may still fail on the last blocks
+	fw.close();
+	if (!fw.good())
+	{
+		fprintf(stderr, "file write error\n");
+		return -1;
+	}
 	return 0;
 }
\ No newline at end of file
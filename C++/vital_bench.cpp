@@ -0,0 +1,205 @@
+#include "VitalLib.h"
+#include "GZPipeReader.h"
+#include "VitalPacket.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+using namespace std;
+
+static double now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// skip the file header. returns false if it is not a vital file
+static bool skip_header(GZReader &gz)
+{
+	char sign[4];
+	if (!gz.read(sign, 4) || strncmp(sign, "VITA", 4))
+		return false;
+	if (!gz.skip(4))
+		return false;
+	unsigned short headerlen;
+	if (!gz.read(&headerlen, 2))
+		return false;
+	return gz.skip(headerlen);
+}
+
+// the way the tools walk a file: copy every field out of the reader
+static unsigned long long scan_fetch(const char *path, unsigned long long &nbytes, float &sum)
+{
+	GZMapReader gz(path);
+	if (!skip_header(gz))
+		return 0;
+	unsigned long long npkt = 0;
+	while (!gz.eof())
+	{
+		unsigned char type = 0;
+		if (!gz.read(&type, 1))
+			break;
+		uint32_t datalen = 0;
+		if (!gz.read(&datalen, 4))
+			break;
+		if (datalen > MAX_PACKET)
+			break;
+		nbytes += 5 + datalen;
+		npkt++;
+		uint32_t remain = datalen;
+		if (type == 1)
+		{
+			unsigned short infolen = 0;
+			if (!gz.fetch(infolen, remain))
+				goto next;
+			double dt;
+			if (!gz.fetch(dt, remain))
+				goto next;
+			unsigned short tid;
+			if (!gz.fetch(tid, remain))
+				goto next;
+			float fval;
+			if (remain >= 4 && gz.fetch(fval, remain))
+				sum += fval;
+		}
+	next:
+		if (!gz.skip(remain))
+			break;
+	}
+	return npkt;
+}
+
+// GZPipeReader with the producer thread on, whatever the build default
+struct ThreadedPipeReader : public GZPipeReader
+{
+	ThreadedPipeReader(const char *path) : GZPipeReader(path, PIPE_BLOCK, true) {}
+};
+
+// the same walk over zero-copy packet views
+template <class Reader>
+static unsigned long long scan_view(const char *path, unsigned long long &nbytes, float &sum)
+{
+	Reader gz(path);
+	if (!skip_header(gz))
+		return 0;
+	unsigned long long npkt = 0;
+	PacketReader pr(gz);
+	PacketView pkt;
+	while (pr.next(pkt))
+	{
+		nbytes += 5 + pkt.datalen;
+		npkt++;
+		if (pkt.type == 1)
+		{
+			RecView rec;
+			float fval;
+			if (rec.parse(pkt) && rec.num(fval))
+				sum += fval;
+		}
+	}
+	return npkt;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Benchmark the packet scanners and the full parser.\n\n\
+Usage : %s INPUT_PATH [REPEAT]\n\n\
+INPUT_PATH: vital file path\n\
+REPEAT: number of runs of each scanner. the best run is reported (default 3)\n\n", argv[0]);
+		return -1;
+	}
+	const char *path = argv[1];
+	int repeat = 3;
+	if (argc > 2)
+		repeat = atoi(argv[2]);
+	if (repeat < 1)
+		repeat = 1;
+
+	double best_fetch = 0, best_view = 0, best_pipe = 0, best_parse = 0, best_inline = 0;
+	unsigned long long nbytes = 0, npkt = 0;
+	float sum_fetch = 0, sum_view = 0;
+	for (int i = 0; i < repeat; i++)
+	{
+		nbytes = 0;
+		sum_fetch = 0;
+		double t = now();
+		npkt = scan_fetch(path, nbytes, sum_fetch);
+		t = now() - t;
+		if (!i || t < best_fetch)
+			best_fetch = t;
+
+		unsigned long long nbytes_view = 0, npkt_view;
+		sum_view = 0;
+		t = now();
+		npkt_view = scan_view<GZMapReader>(path, nbytes_view, sum_view);
+		t = now() - t;
+		if (!i || t < best_view)
+			best_view = t;
+		if (npkt_view != npkt || nbytes_view != nbytes)
+		{
+			fprintf(stderr, "scanners disagree: %llu/%llu packets, %llu/%llu bytes\n", npkt, npkt_view, nbytes, nbytes_view);
+			return -1;
+		}
+
+		// inflate on another thread
+		nbytes_view = 0;
+		float sum_pipe = 0;
+		t = now();
+		npkt_view = scan_view<ThreadedPipeReader>(path, nbytes_view, sum_pipe);
+		t = now() - t;
+		if (!i || t < best_pipe)
+			best_pipe = t;
+		if (npkt_view != npkt || nbytes_view != nbytes || sum_pipe != sum_view)
+		{
+			fprintf(stderr, "pipelined scan disagrees: %llu/%llu packets, %llu/%llu bytes\n", npkt, npkt_view, nbytes, nbytes_view);
+			return -1;
+		}
+
+		t = now();
+		try
+		{
+			parseVitalFile(path, false);
+		}
+		catch (const exception &e)
+		{
+			fprintf(stderr, "%s\n", e.what());
+			return -1;
+		}
+		t = now() - t;
+		if (!i || t < best_parse)
+			best_parse = t;
+
+		// the same parse with the inflate in the calling thread, as VitalParser does it
+		t = now();
+		try
+		{
+			VitalParser parser;
+			parser.parse(path, false);
+		}
+		catch (const exception &e)
+		{
+			fprintf(stderr, "%s\n", e.what());
+			return -1;
+		}
+		t = now() - t;
+		if (!i || t < best_inline)
+			best_inline = t;
+	}
+	if (!npkt)
+	{
+		fprintf(stderr, "no packets in %s\n", path);
+		return -1;
+	}
+
+	double mb = nbytes / 1048576.0;
+	printf("%s: %llu packets, %.1f MB uncompressed\n", path, npkt, mb);
+	printf("fetch scan\t%.3f s\t%.1f MB/s\n", best_fetch, mb / best_fetch);
+	printf("view scan\t%.3f s\t%.1f MB/s\n", best_view, mb / best_view);
+	printf("pipe scan\t%.3f s\t%.1f MB/s\n", best_pipe, mb / best_pipe);
+	printf("parseVitalFile\t%.3f s\t%.1f MB/s\n", best_parse, mb / best_parse);
+	printf("parse inline\t%.3f s\t%.1f MB/s\n", best_inline, mb / best_inline);
+	if (sum_fetch != sum_view)
+		printf("warning: checksums differ (%g, %g)\n", sum_fetch, sum_view);
+	return 0;
+}
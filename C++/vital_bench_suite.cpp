@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <filesystem>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "VitalLib.h"
+#include "VitalGen.h"
+#include "GZMapReader.h"
+#include "VitalPacket.h"
+
+namespace fs = std::filesystem;
+using namespace std;
+
+// Benchmark suite: generates a synthetic corpus and times parseVitalFile and the
+// command line tools on it. Every run is a child process, so that its peak RSS
+// can be reported.
+
+struct Corpus
+{
+	const char *name;
+	VitalGenSpec spec;
+	bool full; // only with -full
+};
+
+static vector<Corpus> corpus_list()
+{
+	vector<Corpus> ret;
+	VitalGenSpec s;
+	s.hours = 1, s.nwav = 4, s.nnum = 8, s.nstr = 1, s.srate = 500, s.recfmts = {1, 5, 3, 6};
+	ret.push_back({"mixed_1h", s, false});
+	s.hours = 0.25, s.nwav = 2, s.nnum = 4, s.nstr = 1, s.srate = 4000, s.recfmts = {2, 7};
+	ret.push_back({"hirate_15m", s, false});
+	s.hours = 4, s.nwav = 4, s.nnum = 16, s.nstr = 2, s.srate = 100, s.recfmts = {4, 8, 1, 5};
+	ret.push_back({"lowrate_4h", s, false});
+	s.hours = 12, s.nwav = 4, s.nnum = 8, s.nstr = 1, s.srate = 500, s.recfmts = {1, 5, 3, 6};
+	ret.push_back({"mixed_12h", s, true});
+	s.hours = 48, s.nwav = 2, s.nnum = 8, s.nstr = 1, s.srate = 100, s.recfmts = {5, 1};
+	ret.push_back({"lowrate_48h", s, true});
+	return ret;
+}
+
+struct RunResult
+{
+	bool ok = false;
+	double sec = 0;
+	long maxrss_kb = 0;
+};
+
+static double now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static RunResult wait_child(pid_t pid, double t0)
+{
+	RunResult r;
+	int status = 0;
+	struct rusage ru;
+	if (wait4(pid, &status, 0, &ru) == pid)
+	{
+		r.sec = now() - t0;
+		r.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		r.maxrss_kb = ru.ru_maxrss;
+	}
+	return r;
+}
+
+// run a tool with its output thrown away
+static RunResult run_tool(const string &bin, const vector<string> &args)
+{
+	double t0 = now();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		int fd = open("/dev/null", O_WRONLY);
+		dup2(fd, 1);
+		dup2(fd, 2);
+		vector<char *> argv;
+		argv.push_back((char *)bin.c_str());
+		for (auto &a : args)
+			argv.push_back((char *)a.c_str());
+		argv.push_back(nullptr);
+		execvp(argv[0], argv.data());
+		_exit(127);
+	}
+	if (pid < 0)
+		return RunResult();
+	return wait_child(pid, t0);
+}
+
+static RunResult run_parse(const string &path)
+{
+	double t0 = now();
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		try
+		{
+			VitalFileData data = parseVitalFile(path, false);
+			_exit(data.tracks.empty() ? 1 : 0);
+		}
+		catch (...)
+		{
+			_exit(1);
+		}
+	}
+	if (pid < 0)
+		return RunResult();
+	return wait_child(pid, t0);
+}
+
+// uncompressed size and rec packets of a file
+static bool scan(const string &path, uint64_t &bytes, uint64_t &recs)
+{
+	GZMapReader gz(path.c_str());
+	if (!gz.opened() || !gz.skip(8))
+		return false;
+	uint16_t headerlen = 0;
+	if (!gz.read(&headerlen, 2) || !gz.skip(headerlen))
+		return false;
+	PacketReader pr(gz);
+	PacketView pkt;
+	recs = 0;
+	while (pr.next(pkt))
+		if (pkt.type == 1)
+			recs++;
+	bytes = gz.tell();
+	return true;
+}
+
+int main(int argc, char *argv[])
+{
+	bool full = false;
+	bool regen = false;
+	bool help = false;
+	string dir;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-full")
+			full = true;
+		else if (arg == "-g")
+			regen = true;
+		else if (arg == "-h" || arg == "--help")
+			help = true;
+		else
+			dir = arg;
+	}
+	if (help || dir.empty())
+	{
+		fprintf(stderr, "Time parseVitalFile and the command line tools on a synthetic corpus.\n\n\
+Usage : %s [-full] [-g] CORPUS_DIR\n\n\
+CORPUS_DIR : where the synthetic files are kept between runs\n\
+-full : add the 12 h and 48 h files\n\
+-g : generate the files again\n\n", fs::path(argv[0]).filename().c_str());
+		return help ? 0 : -1;
+	}
+
+	// the tools are expected next to this binary
+	string bindir = fs::path(argv[0]).parent_path().string();
+	auto tool = [&](const char *name)
+	{
+		return bindir.empty() ? string(name) : bindir + "/" + name;
+	};
+
+	fs::create_directories(dir);
+	string odir = dir + "/out";
+
+	printf("file,run,sec,MB/s,recs/s,peak RSS MB\n");
+	int nfailed = 0;
+	for (auto &c : corpus_list())
+	{
+		if (c.full && !full)
+			continue;
+		string path = dir + "/" + c.name + ".vital";
+		if (regen || !fs::exists(path))
+		{
+			VitalGenStats stats;
+			fprintf(stderr, "generating %s\n", path.c_str());
+			if (!vital_gen(path, c.spec, stats))
+			{
+				fprintf(stderr, "file write error: %s\n", path.c_str());
+				return -1;
+			}
+		}
+		uint64_t bytes = 0, recs = 0;
+		if (!scan(path, bytes, recs))
+		{
+			fprintf(stderr, "file read error: %s\n", path.c_str());
+			return -1;
+		}
+
+		auto report = [&](const string &run, const RunResult &r)
+		{
+			if (!r.ok)
+			{
+				printf("%s,%s,failed,,,\n", c.name, run.c_str());
+				nfailed++;
+				return;
+			}
+			printf("%s,%s,%.3f,%.1f,%.0f,%.1f\n", c.name, run.c_str(), r.sec,
+				   bytes / 1048576.0 / r.sec, recs / r.sec, r.maxrss_kb / 1024.0);
+			fflush(stdout);
+		};
+
+		report("parseVitalFile", run_parse(path));
+		vector<string> intervals = {"60", "1"};
+		if (c.spec.hours <= 4)
+			intervals.push_back("1/100"); // the table grows with the number of rows
+		for (auto &iv : intervals)
+			report("vital_recs " + iv, run_tool(tool("vital_recs"), {"-h", path, iv}));
+
+		fs::remove_all(odir);
+		fs::create_directories(odir + "/s3");
+		fs::create_directories(odir + "/blks");
+		report("vital_s3", run_tool(tool("vital_s3"), {path, odir + "/s3"}));
+		report("vital_blks", run_tool(tool("vital_blks"), {path, odir + "/blks"}));
+		// with only the two paths vital_copy copies the bytes. a max length past the end of
+		// the file makes it parse and rewrite every packet
+		report("vital_copy", run_tool(tool("vital_copy"), {path, odir + "/copy.vital", "1000000"}));
+		report("skna_fix", run_tool(tool("skna_fix"), {path, odir + "/skna.vital"}));
+		fs::remove_all(odir);
+	}
+	return nfailed ? -1 : 0;
+}
@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h> // exit()
 #include <assert.h>
-#include "zlib128/zlib.h"
+#include <zlib.h>
 #include <string>
 #include <vector>
 #include <map>
@@ -10,8 +10,11 @@
 #include <time.h>
 #include <set>
 #include <iostream>
-#include "GZReader.h"
+#include "GZMapReader.h"
+#include "VitalDecode.h"
+#include "TrackCatalog.h"
 #include "Util.h"
+#include "TextWriter.h"
 #include <random>
 #include <limits.h>
 #include <cfloat> // Required for DBL_MAX
@@ -20,7 +23,7 @@ using namespace std;
 
 void print_usage(const char *progname)
 {
-	fprintf(stderr, "Usage : %s INPUT_FILENAME [OUTPUT_FOLDER]\n\n", basename(progname).c_str());
+	fprintf(stderr, "Usage : %s INPUT_FILENAME [OUTPUT_FOLDER]\n\n", basename(string(progname)).c_str());
 }
 
 int main(int argc, char *argv[])
@@ -44,7 +47,7 @@ int main(int argc, char *argv[])
 	string filename = basename(argv[0]);
 	string caseid = filename;
 	auto dotpos = caseid.rfind('.');
-	if (dotpos != -1)
+	if (dotpos != string::npos)
 		caseid = caseid.substr(0, dotpos);
 
 	// Output folder
@@ -53,7 +56,7 @@ int main(int argc, char *argv[])
 		odir = argv[1];
 
 	// Open GZ
-	GZReader gz(argv[0]);
+	GZMapReader gz(argv[0]);
 	if (!gz.opened())
 	{
 		fprintf(stderr, "file does not exist\n");
@@ -91,162 +94,72 @@ int main(int argc, char *argv[])
 		return -1;
 	headerlen += 2; // ?
 
-	// Various maps
-	map<unsigned short, double> tid_dtstart;
-	map<unsigned short, double> tid_dtend;
-	map<unsigned int, string> did_dnames;
-	map<unsigned short, unsigned char> tid_rectypes;
-	map<unsigned short, unsigned char> tid_recfmts;
-	map<unsigned short, double> tid_gains;
-	map<unsigned short, double> tid_offsets;
-	map<unsigned short, double> tid_srates;
-	map<unsigned short, string> tid_tnames;
-	map<unsigned short, string> tid_dnames;
-	set<unsigned short> tids;
+	// Tracks. the slot of a track with records is its index in tids
+	TrackCatalog cat;
+	vector<unsigned short> tids;
 
 	double dtstart = DBL_MAX;
 	double dtend = 0;
 
-	unsigned char rectype = 0;
-	unsigned int nsamp = 0;
-	unsigned char recfmt = 0;
-	unsigned int fmtsize = 0;
-	double gain = 0;
-	double offset = 0;
-	unsigned short infolen = 0;
-	double dt_rec_start = 0;
-	unsigned short tid = 0;
-
 	// -----------------------------
 	// First main loop (type==0 or type==9 or type==1)
 	// -----------------------------
-	while (!gz.eof())
+	PacketReader pr(gz);
+	PacketView pkt;
+	while (pr.next(pkt))
 	{
-		unsigned char type = 0;
-		if (!gz.read(&type, 1))
-			break;
-		unsigned int datalen = 0;
-		if (!gz.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
-
-		if (type == 0)
+		if (pkt.type == 0)
 		{
-			// trkinfo
-			tid = 0;
-			if (!gz.fetch(tid, datalen))
-				goto skip_packet;
-
-			rectype = 0;
-			if (!gz.fetch(rectype, datalen))
-				goto skip_packet;
-
-			unsigned char recfmt_local;
-			if (!gz.fetch(recfmt_local, datalen))
-				goto skip_packet;
-
-			string tname, unit;
-			float minval, maxval, srate = 0;
-			unsigned int col = 0, did = 0;
-			double adc_gain = 1, adc_offset = 0;
-			unsigned char montype = 0;
-
-			if (!gz.fetch(tname, datalen))
-				goto skip_packet;
-			if (!gz.fetch(unit, datalen))
-				goto skip_packet;
-			if (!gz.fetch(minval, datalen))
-				goto skip_packet;
-			if (!gz.fetch(maxval, datalen))
-				goto skip_packet;
-			if (!gz.fetch(col, datalen))
-				goto skip_packet;
-			if (!gz.fetch(srate, datalen))
-				goto skip_packet;
-			if (!gz.fetch(adc_gain, datalen))
-				goto skip_packet;
-			if (!gz.fetch(adc_offset, datalen))
-				goto skip_packet;
-			if (!gz.fetch(montype, datalen))
-				goto skip_packet;
-			if (!gz.fetch(did, datalen))
-				goto skip_packet;
-
-			{
-				// save into maps
-				string dname = did_dnames[did];
-				tid_tnames[tid] = tname;
-				tid_dnames[tid] = dname;
-				tid_rectypes[tid] = rectype;
-				tid_recfmts[tid] = recfmt_local;
-				tid_gains[tid] = adc_gain;
-				tid_offsets[tid] = adc_offset;
-				tid_srates[tid] = srate;
-				tid_dtstart[tid] = DBL_MAX;
-				tid_dtend[tid] = 0.0;
-			}
+			// trkinfo, only with every field up to did
+			TrkInfoView ti;
+			if (ti.parse(pkt) && ti.full)
+				cat.add(ti);
 		}
-		else if (type == 9)
+		else if (pkt.type == 9)
 		{
 			// devinfo
-			unsigned int did;
-			if (!gz.fetch(did, datalen))
-				goto skip_packet;
-			string dtype;
-			if (!gz.fetch(dtype, datalen))
-				goto skip_packet;
-			string dname;
-			if (!gz.fetch(dname, datalen))
-				goto skip_packet;
-			if (dname.empty())
-				dname = dtype;
-			did_dnames[did] = dname;
+			DevInfoView di;
+			if (di.parse(pkt))
+				cat.add_device(di);
 		}
-		else if (type == 1)
+		else if (pkt.type == 1)
 		{
 			// rec
-			unsigned short infolen_local = 0;
-			if (!gz.fetch(infolen_local, datalen))
-				goto skip_packet;
-			double dt_rec_start_local = 0;
-			if (!gz.fetch(dt_rec_start_local, datalen))
-				goto skip_packet;
-			if (!dt_rec_start_local)
-				goto skip_packet;
-			unsigned short tid_local = 0;
-			if (!gz.fetch(tid_local, datalen))
-				goto skip_packet;
-
-			tids.insert(tid_local);
+			RecView rec;
+			if (!rec.parse(pkt) || !rec.dt)
+				continue;
+			TrackDesc &t = cat.at(rec.tid);
+			t.slot = 0;
 
 			// glean
-			auto rectype_local = tid_rectypes[tid_local];
-			auto srate_local = tid_srates[tid_local];
 			unsigned int nsamp_local = 0;
-			double dt_rec_end = dt_rec_start_local;
-			if (rectype_local == 1)
+			double dt_rec_end = rec.dt;
+			if (t.rectype == 1)
 			{
-				if (!gz.fetch(nsamp_local, datalen))
-					goto skip_packet;
-				if (srate_local > 0)
-					dt_rec_end += nsamp_local / srate_local;
+				const unsigned char *samples;
+				if (!rec.wav(nsamp_local, samples))
+					continue;
+				if (t.srate > 0)
+					dt_rec_end += nsamp_local / t.srate;
 			}
 
-			if (tid_dtstart[tid_local] > dt_rec_start_local)
-				tid_dtstart[tid_local] = dt_rec_start_local;
-			if (tid_dtend[tid_local] < dt_rec_end)
-				tid_dtend[tid_local] = dt_rec_end;
-			if (dtstart > dt_rec_start_local)
-				dtstart = dt_rec_start_local;
+			if (t.dtstart > rec.dt)
+				t.dtstart = rec.dt;
+			if (t.dtend < dt_rec_end)
+				t.dtend = dt_rec_end;
+			if (dtstart > rec.dt)
+				dtstart = rec.dt;
 			if (dtend < dt_rec_end)
 				dtend = dt_rec_end;
 		}
-
-	skip_packet:
-		// always skip remainder of packet
-		if (!gz.skip(datalen))
-			break;
+	}
+	for (size_t i = 0; i < cat.size(); i++)
+	{
+		TrackDesc &t = cat.at((unsigned short)i);
+		if (t.slot < 0)
+			continue;
+		t.slot = (int32_t)tids.size();
+		tids.push_back((unsigned short)i);
 	}
 
 	// Rewind
@@ -254,358 +167,165 @@ int main(int argc, char *argv[])
 	if (!gz.skip(10 + headerlen))
 		return -1;
 
-	// Prepare containers
-	map<unsigned short, vector<pair<double, float>>> nums;
-	map<unsigned short, vector<pair<double, string>>> strs;
-	map<unsigned short, vector<short>> wavs;
+	// Prepare containers, by slot
+	vector<vector<pair<double, float>>> nums(tids.size());
+	vector<vector<pair<double, string>>> strs(tids.size());
+	vector<vector<short>> wavs(tids.size());
 
-	for (auto tid : tids)
+	for (size_t i = 0; i < tids.size(); i++)
 	{
-		auto rectype = tid_rectypes[tid];
-		if (rectype == 1) // wav
-		{
-			int wave_tid_size = (int)ceil((tid_dtend[tid] - tid_dtstart[tid]) * tid_srates[tid]);
-			wavs[tid] = vector<short>(wave_tid_size, SHRT_MAX);
-		}
-		else if (rectype == 2)
-		{
-			nums[tid] = vector<pair<double, float>>();
-		}
-		else if (rectype == 5)
+		const TrackDesc &t = cat[tids[i]];
+		if (t.rectype == 1) // wav
 		{
-			strs[tid] = vector<pair<double, string>>();
+			int wave_tid_size = (int)ceil((t.dtend - t.dtstart) * double(t.srate));
+			wavs[i] = vector<short>(wave_tid_size, SHRT_MAX);
 		}
 	}
 
 	// -----------------------------
 	// Second main loop (type==1)
+	// recs before the start of their track or without a slot are skipped unread
 	// -----------------------------
-	while (!gz.eof())
+	PacketReader pr2(gz);
+	RecView rec;
+	vector<float> wavbuf;
+	while (pr2.next(pkt, rec, [&](const RecView &r)
+					{ return r.tid && r.dt >= cat[r.tid].dtstart && cat[r.tid].slot >= 0; }))
 	{
-		unsigned char type = 0;
-		if (!gz.read(&type, 1))
-			break;
-		unsigned int datalen = 0;
-		if (!gz.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
-
-		// CHANGED: If not type==1, skip and continue
-		if (type != 1)
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-
-		// We only handle type==1 below
-		infolen = 0;
-		if (!gz.fetch(infolen, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-
-		dt_rec_start = 0;
-		if (!gz.fetch(dt_rec_start, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-
-		tid = 0;
-		if (!gz.fetch(tid, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-
-		// CHANGED: if (!tid) skip
-		if (!tid)
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-
-		// CHANGED: if (dt_rec_start < tid_dtstart[tid]) skip
-		if (dt_rec_start < tid_dtstart[tid])
-		{
-			if (!gz.skip(datalen))
-				break;
+		if (pkt.type != 1)
 			continue;
-		}
 
-		// glean rectype
-		rectype = tid_rectypes[tid];
-		auto srate_local = tid_srates[tid];
-		nsamp = 0;
-		if (rectype == 1)
+		const TrackDesc &t = cat[rec.tid];
+		if (t.rectype == 1)
 		{
-			if (!gz.fetch(nsamp, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			// wav. integer samples are kept as raw counts; float and double ones are not handled and stay 0
+			uint32_t nsamp = 0;
+			const unsigned char *samples;
+			if (!rec.wav(nsamp, samples))
 				continue;
-			}
-		}
-
-		recfmt = tid_recfmts[tid];
-		fmtsize = 4;
-		switch (recfmt)
-		{
-		case 2:
-			fmtsize = 8;
-			break;
-		case 3: // char
-		case 4: // unsigned char
-			fmtsize = 1;
-			break;
-		case 5: // short
-		case 6: // unsigned short
-			fmtsize = 2;
-			break;
-		case 7: // int
-		case 8: // unsigned int
-			fmtsize = 4;
-			break;
-		default:
-			fmtsize = 4;
-		}
-
-		// Based on rectype
-		if (rectype == 1)
-		{
-			// wav
-			int idxrec = (int)((dt_rec_start - dtstart) * srate_local);
-			auto &v = wavs[tid];
-			if (idxrec < 0)
-			{
-				if (!gz.skip(datalen))
-					break;
+			int idxrec = (int)((rec.dt - dtstart) * t.srate);
+			auto &v = wavs[t.slot];
+			if (idxrec < 0 || idxrec + (int)nsamp >= (int)v.size())
 				continue;
-			}
-			if (idxrec + (int)nsamp >= (int)v.size())
+			// a short payload keeps only the complete samples
+			nsamp = min(nsamp, (rec.len - 4) / t.fmtsize);
+			if (t.recfmt < 3 || t.recfmt > 8)
 			{
-				if (!gz.skip(datalen))
-					break;
+				fill(v.begin() + idxrec, v.begin() + idxrec + nsamp, 0);
 				continue;
 			}
-			for (int i = 0; i < (int)nsamp; i++)
-			{
-				short cnt = 0;
-				switch (recfmt)
-				{
-				case 3:
-				{
-					char ival;
-					if (!gz.fetch(ival, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						// break or continue?
-						// We should break out of the for-loop, but
-						// also must break from the WHILE (outer).
-						// Let's do a ‘goto outer_loop_end;’ or
-						// do a little trick:
-						goto wave_done;
-					}
-					cnt = ival;
-				}
-				break;
-				case 4:
-				{
-					unsigned char ival;
-					if (!gz.fetch(ival, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						goto wave_done;
-					}
-					cnt = ival;
-				}
-				break;
-				case 5:
-				{
-					short ival;
-					if (!gz.fetch(ival, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						goto wave_done;
-					}
-					cnt = ival;
-				}
-				break;
-				case 6:
-				{
-					unsigned short ival;
-					if (!gz.fetch(ival, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						goto wave_done;
-					}
-					cnt = ival;
-				}
-				break;
-				case 7:
-				{
-					int ival;
-					if (!gz.fetch(ival, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						goto wave_done;
-					}
-					cnt = (short)ival;
-				}
-				break;
-				case 8:
-				{
-					unsigned int ival;
-					if (!gz.fetch(ival, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						goto wave_done;
-					}
-					cnt = (short)ival;
-				}
-				break;
-				case 1:
-				case 2:
-				default:
-					// floats/doubles are apparently not handled in
-					// your snippet, so skip them or parse them
-					// the same way
-					if (!gz.skip(fmtsize, datalen))
-					{
-						if (!gz.skip(datalen))
-							break;
-						goto wave_done;
-					}
-					break;
-				}
-				v[idxrec + i] = cnt;
-			}
-
-		wave_done:;
+			wavbuf.resize(nsamp);
+			decode_samples(samples, nsamp, t.recfmt, 1.f, 0.f, wavbuf.data());
+			for (uint32_t i = 0; i < nsamp; i++)
+				v[idxrec + i] = (short)(long long)wavbuf[i];
 		}
-		else if (rectype == 2)
+		else if (t.rectype == 2)
 		{
 			// num
 			float fval;
-			if (!gz.fetch(fval, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			if (!rec.num(fval))
 				continue;
-			}
-			nums[tid].push_back(make_pair(dt_rec_start, fval));
+			nums[t.slot].push_back(make_pair(rec.dt, fval));
 		}
-		else if (rectype == 5)
+		else if (t.rectype == 5)
 		{
 			// str
-			// skip 4 bytes?
-			if (!gz.skip(4, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			string sval;
-			if (!gz.fetch(sval, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			string_view sval;
+			if (!rec.str(sval))
 				continue;
-			}
-			strs[tid].push_back(make_pair(dt_rec_start, sval));
+			strs[t.slot].push_back(make_pair(rec.dt, string(sval)));
 		}
-
-		// CHANGED: after parsing, skip leftover in the packet
-		if (!gz.skip(datalen))
-			break;
 	} // end while
 
 	// Now do the rest of the logic as before...
-	map<unsigned int, unsigned long long> tid_dbtid;
-	for (auto t : tids)
-	{
-		if (tid_dbtid.find(t) != tid_dbtid.end())
-			continue;
-		unsigned long long dbtid = rnd();
-		tid_dbtid[t] = dbtid & LLONG_MAX;
-	}
+	vector<unsigned long long> dbtids(tids.size());
+	for (auto &dbtid : dbtids)
+		dbtid = rnd() & LLONG_MAX;
 
 	// Write .trk.csv
-	auto f = ::fopen((odir + "/" + filename + ".trk.csv").c_str(), "wt");
-	for (auto t : tids)
+	TextWriter ftrk((odir + "/" + filename + ".trk.csv").c_str());
+	for (size_t i = 0; i < tids.size(); i++)
 	{
-		auto rectype = tid_rectypes[t];
+		auto t = tids[i];
+		const TrackDesc &trk = cat[t];
 		char tp = 0;
-		if (rectype == 1)
+		if (trk.rectype == 1)
 			tp = 'w';
-		else if (rectype == 2)
+		else if (trk.rectype == 2)
 			tp = 'n';
-		else if (rectype == 5)
+		else if (trk.rectype == 5)
 			tp = 's';
 		else
 			continue;
 
-		fprintf(f, "%llu,\"%s\",%c,\"%s/%s\",%f,%f,%f,%f,%f\n",
-				tid_dbtid[t],
-				caseid.c_str(),
-				tp,
-				tid_dnames[t].c_str(),
-				tid_tnames[t].c_str(),
-				tid_dtstart[t],
-				tid_dtend[t],
-				tid_srates[t],
-				tid_gains[t],
-				tid_offsets[t]);
+		// "%llu,\"%s\",%c,\"%s/%s\",%f,%f,%f,%f,%f"
+		ftrk.integer(dbtids[i]);
+		ftrk.put(",\"");
+		ftrk.put(caseid);
+		ftrk.put("\",");
+		ftrk.put(tp);
+		ftrk.put(",\"");
+		ftrk.put(cat.dname(t));
+		ftrk.put('/');
+		ftrk.put(cat.tname(t));
+		ftrk.put("\",");
+		ftrk.fixed(trk.dtstart);
+		ftrk.put(',');
+		ftrk.fixed(trk.dtend);
+		ftrk.put(',');
+		ftrk.fixed(trk.srate);
+		ftrk.put(',');
+		ftrk.fixed(trk.gain);
+		ftrk.put(',');
+		ftrk.fixed(trk.offset);
+		ftrk.put('\n');
 	}
-	fclose(f);
+	ftrk.close();
 
 	// Write .num.csv
-	f = ::fopen((odir + "/" + filename + ".num.csv").c_str(), "wt");
-	for (auto &it : nums)
+	TextWriter fnum((odir + "/" + filename + ".num.csv").c_str());
+	for (size_t i = 0; i < tids.size(); i++)
 	{
-		auto t = it.first;
-		auto &recs = it.second;
-		for (auto &rec : recs)
-			fprintf(f, "%llu,%f,%f\n", tid_dbtid[t], rec.first, rec.second);
+		if (cat[tids[i]].rectype != 2)
+			continue;
+		for (auto &rec : nums[i])
+		{
+			fnum.integer(dbtids[i]);
+			fnum.put(',');
+			fnum.fixed(rec.first);
+			fnum.put(',');
+			fnum.fixed(rec.second);
+			fnum.put('\n');
+		}
 	}
-	fclose(f);
+	fnum.close();
 
 	// Write .str.csv
-	f = ::fopen((odir + "/" + filename + ".str.csv").c_str(), "wt");
-	for (auto &it : strs)
+	TextWriter fstr((odir + "/" + filename + ".str.csv").c_str());
+	for (size_t i = 0; i < tids.size(); i++)
 	{
-		auto t = it.first;
-		auto &recs = it.second;
-		for (auto &rec : recs)
+		if (cat[tids[i]].rectype != 5)
+			continue;
+		for (auto &rec : strs[i])
 		{
-			fprintf(f, "%llu,%f,%s\n",
-					tid_dbtid[t],
-					rec.first,
-					escape_csv(rec.second).c_str());
+			fstr.integer(dbtids[i]);
+			fstr.put(',');
+			fstr.fixed(rec.first);
+			fstr.put(',');
+			fstr.csv(rec.second);
+			fstr.put('\n');
 		}
 	}
-	fclose(f);
+	fstr.close();
 
 	// Write .wav.csv
-	f = ::fopen((odir + "/" + filename + ".wav.csv").c_str(), "wt");
-	for (auto &it : wavs)
+	TextWriter fwav((odir + "/" + filename + ".wav.csv").c_str());
+	for (size_t i = 0; i < tids.size(); i++)
 	{
-		auto t = it.first;
-		auto &v = it.second;
-		auto sr = tid_srates[t];
+		if (cat[tids[i]].rectype != 1)
+			continue;
+		auto &v = wavs[i];
+		double sr = cat[tids[i]].srate;
 		double totalSeconds = (double)v.size() / sr;
 		for (double dt = 0.0; dt < totalSeconds; dt += 1.0)
 		{
@@ -614,20 +334,23 @@ int main(int argc, char *argv[])
 			if (idx_end > (int)v.size())
 				idx_end = (int)v.size();
 
-			fprintf(f, "%llu,%f,\"", tid_dbtid[t], (dtstart + dt));
+			fwav.integer(dbtids[i]);
+			fwav.put(',');
+			fwav.fixed(dtstart + dt);
+			fwav.put(",\"");
 			bool firstVal = true;
 			for (int idx = idx_start; idx < idx_end; idx++)
 			{
 				if (!firstVal)
-					fputc(',', f);
+					fwav.put(',');
 				firstVal = false;
 				if (v[idx] != SHRT_MAX)
-					fprintf(f, "%d", v[idx]);
+					fwav.integer(v[idx]);
 			}
-			fprintf(f, "\"\n");
+			fwav.put("\"\n");
 		}
 	}
-	fclose(f);
+	fwav.close();
 
 	return 0;
 }
@@ -0,0 +1,116 @@
+#include "GZMapReader.h"
+#include "GZCodec.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static double now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// read the whole file through the reader. returns the uncompressed size
+static unsigned long long read_all(const char *path, int codec)
+{
+	GZMapReader gz(path, MAPCHUNK, codec);
+	if (!gz.opened())
+		return 0;
+	vector<unsigned char> buf(1 << 20);
+	unsigned long long total = 0;
+	while (true)
+	{
+		auto n = gz.read(&buf[0], (uint32_t)buf.size());
+		total += n;
+		if (n < buf.size())
+			break;
+	}
+	return total;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc < 2)
+	{
+		fprintf(stderr, "Compare the compression backends on the same files.\n\n\
+Usage : %s INPUT_PATH1 [INPUT_PATH2] ...\n\n\
+INPUT_PATH: vital files. each backend reads every file 3 times and the best run is reported\n\n", argv[0]);
+		return -1;
+	}
+
+	vector<string> paths(argv + 1, argv + argc);
+	unsigned long long compsize = 0, rawsize = 0;
+	vector<vector<unsigned char>> raws;
+	for (auto &path : paths)
+	{
+		GZMapReader gz(path.c_str(), MAPCHUNK, CODEC_ZLIB);
+		if (!gz.opened())
+		{
+			fprintf(stderr, "file does not exist: %s\n", path.c_str());
+			return -1;
+		}
+		compsize += gz.compsize();
+		vector<unsigned char> raw;
+		vector<unsigned char> comp(gz.compsize());
+		FILE *f = fopen(path.c_str(), "rb");
+		if (!f || fread(&comp[0], 1, comp.size(), f) != comp.size())
+		{
+			fprintf(stderr, "read error: %s\n", path.c_str());
+			return -1;
+		}
+		fclose(f);
+		codec_inflate_all(CODEC_ZLIB, comp.data(), comp.size(), raw, SIZE_MAX); // the whole file, however large
+		rawsize += raw.size();
+		raws.push_back(move(raw));
+	}
+	double rawmb = rawsize / 1048576.0;
+	printf("%zu files, %.1f MB compressed, %.1f MB uncompressed\n", paths.size(), compsize / 1048576.0, rawmb);
+	printf("backend\tinflate MB/s\tdeflate MB/s\tratio\n");
+
+	for (int codec = 0; codec < CODEC_COUNT; codec++)
+	{
+		if (!codec_available(codec))
+		{
+			printf("%s\tnot built\n", codec_name(codec));
+			continue;
+		}
+		double best_in = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			double t = now();
+			unsigned long long total = 0;
+			for (auto &path : paths)
+				total += read_all(path.c_str(), codec);
+			t = now() - t;
+			if (total != rawsize)
+			{
+				fprintf(stderr, "%s: read %llu bytes instead of %llu\n", codec_name(codec), total, rawsize);
+				return -1;
+			}
+			if (!i || t < best_in)
+				best_in = t;
+		}
+
+		// the rewriting tools compress at level 1
+		double best_out = 0;
+		unsigned long long outsize = 0;
+		for (int i = 0; i < 3; i++)
+		{
+			double t = now();
+			outsize = 0;
+			vector<unsigned char> comp;
+			for (auto &raw : raws)
+			{
+				codec_deflate_all(codec, raw.data(), raw.size(), comp, 1);
+				outsize += comp.size();
+			}
+			t = now() - t;
+			if (!i || t < best_out)
+				best_out = t;
+		}
+		printf("%s\t%.1f\t%.1f\t%.3f\n", codec_name(codec), rawmb / best_in, rawmb / best_out, rawsize ? (double)outsize / rawsize : 0.0);
+	}
+	return 0;
+}
@@ -9,7 +9,9 @@
 #include <cstdlib>
 #include <cfloat>
 #include <zlib.h>
-#include "GZReader.h"
+#include "GZMapReader.h"
+#include "GZParWriter.h"
+#include "VitalPacket.h"
 #include "Util.h"
 
 #ifdef _WIN32
@@ -56,6 +58,12 @@ int main(int argc, char *argv[])
 		}
 
 		dest << source.rdbuf();
+		dest.close();
+		if (!dest)
+		{
+			cerr << "File write error\n";
+			return EXIT_FAILURE;
+		}
 		return EXIT_SUCCESS;
 	}
 
@@ -114,8 +122,8 @@ int main(int argc, char *argv[])
 		}
 	}
 
-	GZReader fr(input_path.c_str());
-	GZWriter fw(output_path.c_str());
+	GZMapReader fr(input_path.c_str());
+	GZParWriter fw(output_path.c_str());
 
 	if (!fr.opened() || !fw.opened())
 	{
@@ -151,11 +159,11 @@ int main(int argc, char *argv[])
 	fw.write(&header[0], header.size());
 
 	// Track and device information
-	map<unsigned long, string> did_dname;
-	map<unsigned long, BUF> did_di;
+	map<uint32_t, string> did_dname;
+	map<uint32_t, BUF> did_di;
 	map<unsigned short, string> tid_tname;
 	map<unsigned short, BUF> tid_ti;
-	map<unsigned short, unsigned long> tid_did;
+	map<unsigned short, uint32_t> tid_did;
 	map<unsigned short, BUF> tid_recs;
 
 	// Scan file for data range
@@ -164,122 +172,101 @@ int main(int argc, char *argv[])
 
 	if (max_length)
 	{
-		while (!fr.eof())
+		// only the head of each rec is read, the rest is skipped
+		auto scan = [&](const RecView &rec)
 		{
-			unsigned char type;
-			if (!fr.read(&type, 1))
-				break;
-			unsigned long data_len;
-			if (!fr.read(&data_len, 4))
-				break;
-			if (data_len > 1000000)
-				break;
-
-			if (type == 1)
+			if (rec.dt)
 			{
-				unsigned short info_len;
-				double dt;
-				if (!fr.fetch(info_len, data_len) || !fr.fetch(dt, data_len))
-					continue;
-				if (!dt)
-					continue;
-				dt_start = min(dt_start, dt);
-				dt_end = max(dt_end, dt);
+				dt_start = min(dt_start, rec.dt);
+				dt_end = max(dt_end, rec.dt);
 			}
-			if (!fr.skip(data_len))
-				break;
-		}
+			return false;
+		};
+		PacketReader pr(fr);
+		PacketView pkt;
+		RecView rec;
+		while (pr.next(pkt, rec, scan))
+			;
 
 		if (dt_end <= dt_start)
 		{
 			cerr << "No data\n";
 			return EXIT_FAILURE;
 		}
-		if (dt_end - dt_start > 48 * 3600)
-		{
-			cerr << "Data duration > 48 hrs\n";
-			return EXIT_FAILURE;
-		}
 
 		fr.rewind();
 		if (!fr.skip(10 + headerlen))
 			return EXIT_FAILURE;
 	}
 
-	// Read and process packets
+	// Read and process packets, one at a time
+	BUF buf;
 	while (!fr.eof())
 	{
-		unsigned char packet_type;
-		if (!fr.read(&packet_type, 1))
-			break;
-		unsigned long packet_len;
-		if (!fr.read(&packet_len, 4))
+		unsigned char packet_header[PacketHead::size];
+		if (fr.read(packet_header, PacketHead::size) != PacketHead::size)
 			break;
-		if (packet_len > 1000000)
+		PacketView pkt;
+		PacketHead::decode(packet_header, pkt.type, pkt.datalen);
+		if (pkt.datalen > MAX_PACKET)
 			break;
 
-		BUF packet_header(5);
-		packet_header[0] = packet_type;
-		memcpy(&packet_header[1], &packet_len, 4);
-
-		BUF buf(packet_len);
-		if (!fr.read(&buf[0], packet_len))
+		buf.resize(pkt.datalen);
+		if (!fr.read(&buf[0], pkt.datalen))
 			break;
+		pkt.payload = &buf[0];
 
-		if (packet_type == 9)
+		if (pkt.type == 9)
 		{
-			unsigned long did;
-			string dtype, dname;
-			if (buf.fetch(did) && buf.fetch_with_len(dtype) && buf.fetch_with_len(dname))
-			{
-				if (dname.empty())
-					dname = dtype;
-				did_dname[did] = dname;
-			}
+			DevInfoView di;
+			if (di.parse(pkt))
+				did_dname[di.did] = string(di.dname);
 		}
-		else if (packet_type == 0)
+		else if (pkt.type == 0)
 		{
-			unsigned short tid;
-			buf.skip(2);
-			string tname;
-			if (buf.fetch(tid) && buf.fetch_with_len(tname))
+			TrkInfoView ti;
+			if (ti.parse(pkt))
 			{
-				buf.skip(33);
-				unsigned long did = 0;
-				buf.fetch(did);
-
-				tid_did[tid] = did;
-				tid_tname[tid] = tname;
-				string dname = did_dname[did];
+				string tname(ti.tname);
+				tid_did[ti.tid] = ti.did;
+				tid_tname[ti.tid] = tname;
+				string dname = did_dname[ti.did];
 
 				if (!all_tracks)
 				{
-					bool matched = any_of(tnames.begin(), tnames.end(), [&](const string &tn)
-										  { return (tn == "*" || tn == tname) &&
-												   (dnames.empty() || dnames[0] == "*" || dnames[0] == dname); });
+					bool matched = false;
+					for (size_t j = 0; j < tnames.size() && !matched; j++)
+						matched = (tnames[j] == "*" || tnames[j] == tname) &&
+								  (dnames[j].empty() || dnames[j] == "*" || dnames[j] == dname);
 					if (!matched)
 						continue;
+					tids.insert(ti.tid);
 				}
 			}
 		}
-		else if (packet_type == 1)
+		else if (pkt.type == 1)
 		{
-			buf.skip(2);
-			double dt;
-			unsigned short tid;
-			if (!buf.fetch(dt) || !buf.fetch(tid))
+			RecView rec;
+			if (!rec.parse(pkt))
 				continue;
 
-			if (max_length && dt > dt_start + max_length)
+			if (max_length && rec.dt > dt_start + max_length)
 				continue;
-			if (!all_tracks && tids.find(tid) == tids.end())
+			if (!all_tracks && tids.find(rec.tid) == tids.end())
 				continue;
 		}
 
 		// Write packet
-		fw.write(&packet_header[0], packet_header.size());
-		fw.write(&buf[0], buf.size());
+		fw.write(packet_header, PacketHead::size);
+		fw.write(&buf[0], pkt.datalen);
 	}
 
+	// the deflate threads may still fail on the last blocks
+	fw.close();
+	if (!fw.good())
+	{
+		cerr << "File write error\n";
+		return EXIT_FAILURE;
+	}
 	return EXIT_SUCCESS;
 }
@@ -13,7 +13,9 @@
 #include <cfloat> // For DBL_MAX
 
 #include "GZReader.h"
+#include "TrackCatalog.h"
 #include "Util.h"
+#include "TextWriter.h"
 
 using namespace std;
 
@@ -64,6 +66,7 @@ int main(int argc, char *argv[])
 	unsigned short headerlen;
 	if (!gz.read(&headerlen, 2))
 		return -1;
+	const unsigned body = 10 + headerlen; // the packets start here
 
 	short dgmt;
 	if (headerlen >= 2)
@@ -76,165 +79,119 @@ int main(int argc, char *argv[])
 	if (!gz.skip(headerlen))
 		return -1;
 
-	// Data structures
-	map<unsigned short, double> tid_dtstart, tid_dtend, tid_srates;
-	map<unsigned short, unsigned char> tid_rectypes, tid_recfmts;
-	map<unsigned short, double> tid_gains, tid_offsets;
-	map<unsigned short, string> tid_tnames, tid_dnames;
-	map<unsigned long, string> did_dnames;
+	// Tracks and devices
+	TrackCatalog cat;
 	set<unsigned short> tids;
 
 	double dtstart = DBL_MAX, dtend = 0;
 
-	while (!gz.eof())
+	PacketReader pr(gz);
+	PacketView pkt;
+	while (pr.next(pkt))
 	{
-		unsigned char type = 0;
-		if (!gz.read(&type, 1))
-			break;
-
-		unsigned long datalen = 0;
-		if (!gz.read(&datalen, 4) || datalen > 1000000)
-			break;
-
-		if (type == 0)
+		if (pkt.type == 0)
 		{ // Track info
-			unsigned short tid;
-			unsigned char rectype, recfmt;
-			string tname, unit;
-			float minval, maxval, srate;
-			unsigned long col, did;
-			double adc_gain, adc_offset;
-			unsigned char montype;
-
-			if (!gz.fetch(tid, datalen) ||
-				!gz.fetch(rectype, datalen) ||
-				!gz.fetch(recfmt, datalen) ||
-				!gz.fetch(tname, datalen) ||
-				!gz.fetch(unit, datalen) ||
-				!gz.fetch(minval, datalen) ||
-				!gz.fetch(maxval, datalen) ||
-				!gz.fetch(col, datalen) ||
-				!gz.fetch(srate, datalen) ||
-				!gz.fetch(adc_gain, datalen) ||
-				!gz.fetch(adc_offset, datalen) ||
-				!gz.fetch(montype, datalen) ||
-				!gz.fetch(did, datalen))
-			{
-				gz.skip(datalen);
-				continue;
-			}
-
-			tid_tnames[tid] = tname;
-			tid_dnames[tid] = did_dnames[did];
-			tid_rectypes[tid] = rectype;
-			tid_recfmts[tid] = recfmt;
-			tid_gains[tid] = adc_gain;
-			tid_offsets[tid] = adc_offset;
-			tid_srates[tid] = srate;
-			tid_dtstart[tid] = DBL_MAX;
-			tid_dtend[tid] = 0.0;
+			TrkInfoView ti;
+			if (ti.parse(pkt) && ti.full)
+				cat.add(ti);
 		}
 
-		if (type == 9)
+		if (pkt.type == 9)
 		{ // Device info
-			unsigned long did;
-			string dtype, dname;
-			if (!gz.fetch(did, datalen) ||
-				!gz.fetch(dtype, datalen) ||
-				!gz.fetch(dname, datalen))
-			{
-				gz.skip(datalen);
-				continue;
-			}
-			if (dname.empty())
-				dname = dtype;
-			did_dnames[did] = dname;
+			DevInfoView di;
+			if (di.parse(pkt))
+				cat.add_device(di);
 		}
 
-		if (type == 1)
+		if (pkt.type == 1)
 		{ // Recording
-			unsigned short infolen, tid;
-			double dt_rec_start;
-
-			if (!gz.fetch(infolen, datalen) ||
-				!gz.fetch(dt_rec_start, datalen) ||
-				!gz.fetch(tid, datalen))
-			{
-				gz.skip(datalen);
+			RecView rec;
+			if (!rec.parse(pkt))
 				continue;
-			}
 
-			tids.insert(tid);
-			auto rectype = tid_rectypes[tid];
-			auto srate = tid_srates[tid];
-			unsigned long nsamp = 0;
-			double dt_rec_end = dt_rec_start;
+			tids.insert(rec.tid);
+			TrackDesc &t = cat.at(rec.tid);
+			uint32_t nsamp = 0;
+			const unsigned char *samples;
+			double dt_rec_end = rec.dt;
 
-			if (rectype == 1 && gz.fetch(nsamp, datalen))
+			if (t.rectype == 1 && rec.wav(nsamp, samples))
 			{
-				if (srate > 0)
-					dt_rec_end += nsamp / srate;
+				if (t.srate > 0)
+					dt_rec_end += nsamp / t.srate;
 			}
 
-			tid_dtstart[tid] = min(tid_dtstart[tid], dt_rec_start);
-			tid_dtend[tid] = max(tid_dtend[tid], dt_rec_end);
-			dtstart = min(dtstart, dt_rec_start);
+			t.dtstart = min(t.dtstart, rec.dt);
+			t.dtend = max(t.dtend, dt_rec_end);
+			dtstart = min(dtstart, rec.dt);
 			dtend = max(dtend, dt_rec_end);
 		}
+	}
 
-		gz.skip(datalen);
+	map<unsigned short, vector<pair<double, float>>> nums;
+	map<unsigned short, vector<pair<double, string>>> strs;
+	for (auto tid : tids)
+	{
+		const TrackDesc &t = cat[tid];
+		if (t.rectype == 2)
+			nums[tid];
+		else if (t.rectype == 5)
+			strs[tid];
 	}
 
+	// Second pass: the values of the num and str tracks
 	gz.rewind();
-	gz.skip(10 + headerlen);
+	if (!gz.skip(body))
+		return -1;
+	PacketReader pr2(gz);
+	while (pr2.next(pkt))
+	{
+		if (pkt.type != 1)
+			continue;
+		RecView rec;
+		if (!rec.parse(pkt))
+			continue;
+		const TrackDesc &t = cat[rec.tid];
+		if (t.rectype == 2)
+		{
+			float fval;
+			if (rec.num(fval))
+				nums[rec.tid].emplace_back(rec.dt, fval);
+		}
+		else if (t.rectype == 5)
+		{
+			string_view sval;
+			if (rec.str(sval))
+				strs[rec.tid].emplace_back(rec.dt, string(sval));
+		}
+	}
 
 	// Writing CSV files
 	auto write_csv = [&](const string &filepath, auto &data)
 	{
-		FILE *f = fopen(filepath.c_str(), "wt");
-		if (!f)
+		TextWriter f(filepath.c_str());
+		if (!f.good())
 			return;
 
 		for (const auto &[tid, records] : data)
 		{
 			for (const auto &[dt, val] : records)
 			{
+				f.integer(tid);
+				f.put(',');
+				f.fixed(dt);
+				f.put(',');
 				if constexpr (std::is_same_v<std::decay_t<decltype(val)>, std::string>)
-				{
-					fprintf(f, "%hu,%f,%s\n", tid, dt, escape_csv(val).c_str());
-				}
+					f.csv(val);
 				else
-				{
-					fprintf(f, "%hu,%f,%f\n", tid, dt, static_cast<double>(val));
-				}
+					f.fixed(static_cast<double>(val));
+				f.put('\n');
 			}
 		}
 
-		fclose(f);
+		f.close();
 	};
 
-	map<unsigned short, vector<pair<double, float>>> nums;
-	map<unsigned short, vector<pair<double, string>>> strs;
-	map<unsigned short, vector<short>> wavs;
-
-	for (auto tid : tids)
-	{
-		auto rectype = tid_rectypes[tid];
-		if (rectype == 1)
-		{
-			long wave_size = static_cast<long>((tid_dtend[tid] - tid_dtstart[tid]) * tid_srates[tid]);
-			wavs[tid] = vector<short>(wave_size);
-		}
-		else if (rectype == 2)
-		{
-			nums[tid] = {};
-		}
-		else if (rectype == 5)
-		{
-			strs[tid] = {};
-		}
-	}
-
 	write_csv(odir + "/" + filename + ".num.csv", nums);
 	write_csv(odir + "/" + filename + ".str.csv", strs);
 
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "VitalDecode.h"
+
+using namespace std;
+
+// decode_samples and each of its kernels against sample_value, the one sample at a time
+// reading of vital_recs, for every recfmt, every tail length mod 8 and unaligned buffers.
+// ctest runs it; it prints the failures and exits 1 if there are any.
+
+static const float SENTINEL = -12345.f;
+static int g_fails = 0;
+static int g_checks = 0;
+
+// the same bits, or both nan: a signaling nan float is quieted by the trip through double
+static bool same(float a, float b)
+{
+	if (std::isnan(a) && std::isnan(b))
+		return true;
+	return memcmp(&a, &b, sizeof(float)) == 0;
+}
+
+typedef void (*decoder)(const unsigned char *src, uint32_t n, uint8_t recfmt, float gain, float offset, float *dst);
+
+static void check(const char *path, decoder dec, const unsigned char *src, uint32_t n, uint8_t recfmt, float gain, float offset)
+{
+	vector<float> out(n + 16, SENTINEL);
+	dec(src, n, recfmt, gain, offset, out.data());
+	g_checks++;
+	uint32_t fmtsize = recfmt_size(recfmt);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		float ref = float(sample_value(src + i * fmtsize, recfmt, gain, offset));
+		if (!same(out[i], ref))
+		{
+			if (g_fails++ < 20)
+				printf("%s recfmt=%d n=%u gain=%g offset=%g: sample %u is %.9g, expected %.9g\n", path, recfmt, n, gain, offset, i, out[i], ref);
+			return;
+		}
+	}
+	for (uint32_t i = n; i < out.size(); i++)
+	{
+		if (out[i] != SENTINEL)
+		{
+			if (g_fails++ < 20)
+				printf("%s recfmt=%d n=%u: wrote past the end at %u\n", path, recfmt, n, i);
+			return;
+		}
+	}
+}
+
+#ifdef VITAL_SSE2
+static void dec_sse2(const unsigned char *src, uint32_t n, uint8_t recfmt, float gain, float offset, float *dst)
+{
+	uint32_t done = decode_samples_sse2(src, n, recfmt, gain, offset, dst);
+	decode_samples_scalar(src + done * recfmt_size(recfmt), n - done, recfmt, gain, offset, dst + done);
+}
+#endif
+
+#ifdef VITAL_AVX2
+static void dec_avx2(const unsigned char *src, uint32_t n, uint8_t recfmt, float gain, float offset, float *dst)
+{
+	uint32_t done = decode_samples_avx2(src, n, recfmt, gain, offset, dst);
+	decode_samples_scalar(src + done * recfmt_size(recfmt), n - done, recfmt, gain, offset, dst + done);
+}
+#endif
+
+// the extremes of each format, then random bytes
+static void fill(vector<unsigned char> &buf, uint8_t recfmt, mt19937 &rnd)
+{
+	for (auto &c : buf)
+		c = (unsigned char)rnd();
+	uint32_t fmtsize = recfmt_size(recfmt);
+	size_t k = 0;
+	auto put = [&](const void *v)
+	{
+		if ((k + 1) * fmtsize <= buf.size())
+			memcpy(&buf[k++ * fmtsize], v, fmtsize);
+	};
+	switch (recfmt)
+	{
+	case 2:
+		for (double v : {0.0, -0.0, 1.0, -1.5, 1e300, -1e300, 1e-300, 3.4028235677973366e38, (double)INFINITY, (double)NAN})
+			put(&v);
+		break;
+	case 3:
+		for (int8_t v : {0, -1, 1, -128, 127})
+			put(&v);
+		break;
+	case 4:
+		for (uint8_t v : {0, 1, 127, 128, 255})
+			put(&v);
+		break;
+	case 5:
+		for (int16_t v : {0, -1, 1, -32768, 32767})
+			put(&v);
+		break;
+	case 6:
+		for (uint16_t v : {0, 1, 32767, 32768, 65535})
+			put(&v);
+		break;
+	case 7:
+		for (int32_t v : {0, -1, 1, INT32_MIN, INT32_MAX, 16777217, -16777217, 16777219})
+			put(&v);
+		break;
+	case 8:
+		for (uint32_t v : {0u, 1u, 0x7fffffffu, 0x80000000u, 0xffffffffu, 16777217u, 0x01000003u, 0xfffffe80u})
+			put(&v);
+		break;
+	default:
+		for (float v : {0.f, -0.f, 1.f, -2.5f, INFINITY, NAN})
+			put(&v);
+		break;
+	}
+}
+
+int main()
+{
+	mt19937 rnd(12345);
+	const float params[][2] = {{1.f, 0.f}, {0.25f, -3.5f}, {1.1f, 1e-3f}, {-7.3f, 100.f}, {1e-6f, 0.f}, {1e6f, -1e6f}};
+	vector<uint32_t> lens;
+	for (uint32_t n = 0; n <= 40; n++)
+		lens.push_back(n);
+	for (uint32_t n = 1000; n < 1008; n++)
+		lens.push_back(n);
+
+	struct Path
+	{
+		const char *name;
+		decoder dec;
+	};
+	vector<Path> paths = {{"scalar", decode_samples_scalar}, {"decode_samples", decode_samples}};
+#ifdef VITAL_SSE2
+	paths.push_back({"sse2", dec_sse2});
+#endif
+#ifdef VITAL_AVX2
+	if (cpu_has_avx2())
+		paths.push_back({"avx2", dec_avx2});
+	else
+		printf("no avx2 on this cpu, the avx2 kernel is not tested\n");
+#endif
+
+	// 0 and 9 are unknown formats, read as float
+	for (int recfmt = 0; recfmt <= 9; recfmt++)
+	{
+		for (uint32_t n : lens)
+		{
+			for (int misalign = 0; misalign < 4; misalign++)
+			{
+				vector<unsigned char> buf(misalign + n * recfmt_size(recfmt) + 1);
+				vector<unsigned char> data(n * recfmt_size(recfmt));
+				fill(data, (uint8_t)recfmt, rnd);
+				if (!data.empty())
+					memcpy(&buf[misalign], data.data(), data.size());
+				for (auto &p : params)
+					for (auto &path : paths)
+						check(path.name, path.dec, &buf[misalign], n, (uint8_t)recfmt, p[0], p[1]);
+			}
+		}
+	}
+
+	printf("%d checks", g_checks);
+	for (auto &path : paths)
+		printf(", %s", path.name);
+	printf(": %d failed\n", g_fails);
+	return g_fails ? 1 : 0;
+}
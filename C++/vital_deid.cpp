@@ -8,7 +8,8 @@
 #include <stdarg.h> // For va_start, etc.
 #include <memory>	// For std::unique_ptr
 #include <time.h>
-#include "GZReader.h"
+#include "GZParWriter.h"
+#include "VitalPacket.h"
 #include "Util.h"
 #include <cfloat> // For DBL_MAX
 
@@ -23,7 +24,7 @@ INPUT_PATH: input vital file path\n\
 OUTPUT_PATH: output vital file path\n\
 SECONDS: relative time moves in second (if < 100000000)\n\
          unix timestamp (if > 100000000) \n\n",
-			basename(progname).c_str());
+			basename(string(progname)).c_str());
 }
 
 int main(int argc, char *argv[])
@@ -43,7 +44,7 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	GZWriter go(argv[1]);
+	GZParWriter go(argv[1]);
 	if (!go.opened())
 	{
 		fprintf(stderr, "cannot open output file\n");
@@ -82,57 +83,22 @@ int main(int argc, char *argv[])
 	// 1st pass to find out dtstart
 	unsigned short tid_evt = 0; // event trkid
 	double dtstart = DBL_MAX;
-	while (!gi.eof())
+	PacketReader pr(gi);
+	PacketView pkt;
+	while (pr.next(pkt))
 	{ // body is just a list of packet
-		unsigned char type;
-		if (!gi.read(&type, 1))
-			break;
-		unsigned long datalen;
-		if (!gi.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
-		if (type == 0)
+		if (pkt.type == 0)
 		{ // trkinfo : tname, tid, dname, did, type (NUM, STR, WAV), srate
-			unsigned short tid;
-			if (!gi.fetch(tid, datalen))
-				goto next_packet;
-			gi.skip(2, datalen);
-			string tname;
-			if (!gi.fetch_with_len(tname, datalen))
-				goto next_packet;
-			string unit;
-			gi.fetch_with_len(unit, datalen);
-			gi.skip(4 + 4 + 4 + 4 + 8 + 8 + 1, datalen);
-			unsigned long did = 0;
-			gi.fetch(did, datalen);
-			if (did == 0 && tname == "EVENT")
-			{
-				tid_evt = tid;
-			}
-			goto next_packet;
-		}
-		else if (type == 9)
-		{ // devinfo
-			goto next_packet;
+			TrkInfoView ti;
+			if (ti.parse(pkt) && ti.did == 0 && ti.tname == "EVENT")
+				tid_evt = ti.tid;
 		}
-		else if (type == 1)
+		else if (pkt.type == 1)
 		{ // rec
-			unsigned short infolen;
-			if (!gi.fetch(infolen, datalen))
-				goto next_packet;
-			double dt_rec_start;
-			if (!gi.fetch(dt_rec_start, datalen))
-				goto next_packet;
-			if (!dt_rec_start)
-				goto next_packet;
-			if (dtstart > dt_rec_start)
-				dtstart = dt_rec_start;
+			RecView rec;
+			if (rec.parse(pkt) && rec.dt && dtstart > rec.dt)
+				dtstart = rec.dt;
 		}
-
-	next_packet:
-		if (!gi.skip(datalen))
-			break;
 	}
 
 	vector<unsigned char> buf;
@@ -148,54 +114,49 @@ int main(int argc, char *argv[])
 		return -1; // write header
 	while (!gi.eof())
 	{
-		unsigned char type;
-		if (!gi.read(&type, 1))
+		unsigned char hdr[PacketHead::size];
+		if (!gi.read(hdr, PacketHead::size))
 			break;
-		unsigned long datalen;
-		if (!gi.read(&datalen, 4))
+		PacketHead::decode(hdr, pkt.type, pkt.datalen);
+		if (pkt.datalen > MAX_PACKET)
 			break;
-		if (datalen > 1000000)
-			break;
-		if (buf.size() < datalen)
-			buf.resize(datalen);
-		if (!gi.read(&buf[0], datalen))
+		if (buf.size() < pkt.datalen)
+			buf.resize(pkt.datalen);
+		if (!gi.read(&buf[0], pkt.datalen))
 			break; // read packet
-		if (type == 0)
-		{ // trkinfo : tname, tid, dname, did, type (NUM, STR, WAV), srate
-			goto next_packet2;
-		}
-		else if (type == 9)
-		{ // devinfo
-			goto next_packet2;
-		}
-		else if (type == 1)
+		pkt.payload = &buf[0];
+		if (pkt.type == 1)
 		{ // rec
-			if (datalen < 10)
+			RecView rec;
+			if (!rec.parse(pkt))
 				break;
-			double *pdt = (double *)&buf[2];
-			auto ptid = (unsigned short *)&buf[10];
-			if (*ptid == tid_evt)
+			if (rec.tid == tid_evt)
 				continue; // skip the old event records
 
 			if (seconds)
 			{ // ���ð���ŭ �̵�
-				*pdt += seconds;
+				rec.dt += seconds;
 			}
 			else
 			{ // 2100�� 1�� 1�Ϸ� �̵�
-				*pdt -= dtstart;
-				*pdt += dt_moveto;
+				rec.dt -= dtstart;
+				rec.dt += dt_moveto;
 			}
+			RecHead::encode(&buf[0], rec.infolen, rec.dt, rec.tid);
 		}
 
-	next_packet2:
-		if (!go.write(&type, 1))
+		if (!go.write(hdr, PacketHead::size))
 			break;
-		if (!go.write(&datalen, 4))
-			break;
-		if (!go.write(&buf[0], datalen))
+		if (!go.write(&buf[0], pkt.datalen))
 			break;
 	}
 
+	// the deflate threads may still fail on the last blocks
+	go.close();
+	if (!go.good())
+	{
+		fprintf(stderr, "cannot write output file\n");
+		return -1;
+	}
 	return 0;
 }
\ No newline at end of file
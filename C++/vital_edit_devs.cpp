@@ -8,7 +8,8 @@
 #include <stdarg.h>  // For va_start, etc.
 #include <memory>    // For std::unique_ptr
 #include <time.h> 
-#include "GZReader.h"
+#include "GZEditWriter.h"
+#include "VitalPacket.h"
 #include "Util.h"
 using namespace std;
 
@@ -18,7 +19,7 @@ Usage : %s INPUT_PATH OUTPUT_PATH DEVNAME_FROM DEVNAME_TO\n\n\
 INPUT_PATH : vital file name\n\
 OUTPUT_PATH : output file name\n\
 DEVNAME_FROM : old device name\n\
-DEVNAME_TO : new device name\n\n", basename(progname).c_str());
+DEVNAME_TO : new device name\n\n", basename(string(progname)).c_str());
 }
 
 int main(int argc, char* argv[]) {
@@ -31,8 +32,8 @@ int main(int argc, char* argv[]) {
 	string devfrom = argv[2];
 	string devto = argv[3];
 
-	GZWriter fw(argv[1]); //   .
-	GZReader fr(argv[0]); //   .
+	GZMapReader fr(argv[0]); //   .
+	GZEditWriter fw(argv[1], fr); //   . ٲ  κ  ״ Ѵ.
 	if (!fr.opened() || !fw.opened()) {
 		fprintf(stderr, "file open error\n");
 		return -1;
@@ -45,64 +46,51 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr, "file does not seem to be a vital file\n");
 		return -1;
 	}
-	if (!fw.write(sign, 4)) return -1;
 
 	char ver[4];
 	if (!fr.read(ver, 4)) return -1; // version
-	if (!fw.write(ver, 4)) return -1;
 
 	unsigned short headerlen; // header length
 	if (!fr.read(&headerlen, 2)) return -1;
-	if (!fw.write(&headerlen, 2)) return -1;
-
-	BUF header(headerlen);
-	if (!fr.read(&header[0], headerlen)) return -1;
-	if (!fw.write(&header[0], headerlen)) return -1;
+	if (!fr.skip(headerlen)) return -1;
+	fw.keep(0, 10 + headerlen);
 
 	//   . ѹ 鼭 .
 	while (!fr.eof()) { // body Ŷ ̴.
+		uint64_t packet_pos = fr.tell();
 		unsigned char packet_type; if (!fr.read(&packet_type, 1)) break;
-		unsigned long packet_len; if (!fr.read(&packet_len, 4)) break;
+		uint32_t packet_len; if (!fr.read(&packet_len, 4)) break;
 		if(packet_len > 1000000) break; // 1MB ̻ Ŷ 
 		
-		// ϰ ؾϹǷ ϰ   ۿ 
-		BUF buf(packet_len);
-		if (!fr.read(&buf[0], packet_len)) break;
 		if (packet_type == 9) { // devinfo
-			unsigned long did; if (!buf.fetch(did)) continue;
-			string dtype; if (!buf.fetch_with_len(dtype)) continue;
-			string dname; if (!buf.fetch_with_len(dname)) continue;
-			if (dname.empty()) dname = dtype;
-			if (dname == devfrom) {
-				unsigned long new_packet_len = packet_len - devfrom.size() + devto.size();
+			// ϰ ؾϹǷ ϰ   ۿ 
+			BUF buf(packet_len);
+			if (!fr.read(&buf[0], packet_len)) break;
+
+			DevInfoView di; if (!di.parse({packet_type, packet_len, &buf[0]})) continue;
+			if (di.dname == devfrom) {
+				// did, dtype, port and anything after it stay as they were
+				di.dname = devto;
+				BUF di_packet;
+				di.encode(di_packet);
+				uint32_t new_packet_len = (uint32_t)di_packet.size();
 				fw.write(&packet_type, 1);
 				fw.write(&new_packet_len, 4);
-				
-				//    
-				fw.write(&did, sizeof(did));
-
-				unsigned long dtype_len = dtype.size();
-				fw.write(&dtype_len, 4);
-				fw.write(&dtype[0], dtype_len);
-				
-				//   
-				unsigned long devto_len = devto.size();
-				fw.write(&devto_len, 4);
-				fw.write(&devto[0], devto_len);
-				
-				//  
-				unsigned long remain_pos = 4 + 8 + dtype_len + devfrom.size();
-				fw.write(&buf[remain_pos], packet_len - remain_pos);
+				fw.write(&di_packet[0], new_packet_len);
 			} else {
-				fw.write(&packet_type, 1);
-				fw.write(&packet_len, 4);
-				fw.write(&buf[0], packet_len);
+				fw.keep(packet_pos, 5 + packet_len);
 			}
 		} else { //  ׳ 
-			fw.write(&packet_type, 1);
-			fw.write(&packet_len, 4);
-			fw.write(&buf[0], packet_len);
+			if (!fr.skip(packet_len)) break;
+			fw.keep(packet_pos, 5 + packet_len);
 		}
 	}
+
+	// the kept members are copied and the file is flushed only here
+	fw.close();
+	if (!fw.good()) {
+		fprintf(stderr, "file write error\n");
+		return -1;
+	}
 	return 0;
 }
\ No newline at end of file
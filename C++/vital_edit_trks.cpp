@@ -8,7 +8,8 @@
 #include <stdarg.h>  // For va_start, etc.
 #include <memory>    // For std::unique_ptr
 #include <time.h> 
-#include "GZReader.h"
+#include "GZEditWriter.h"
+#include "VitalPacket.h"
 #include "Util.h"
 using namespace std;
 
@@ -34,7 +35,7 @@ vital_edit_trks a.vital b.vital BIS/* \n\
 -> remove all track from 'BIS' device\n\n\
 vital_edit_trks a.vital b.vital \"SNUADC/ART1=FEM,SNUADC/RESP\"\n\
 -> rename 'SNUADC' device's 'ART1' track to 'FEM' and delete 'RESP' track\n\n\
-", basename(progname).c_str());
+", basename(string(progname)).c_str());
 }
 
 int main(int argc, char* argv[]) {
@@ -52,7 +53,7 @@ int main(int argc, char* argv[]) {
 	vector<string> dnames(ncmds);
 	vector<string> newnames(ncmds);
 	vector<string> newtis(ncmds);
-	for (int i = 0; i < ncmds; i++) {
+	for (unsigned i = 0; i < ncmds; i++) {
 		auto tname = tnames[i];
 
 		int pos = tname.find('@');
@@ -76,8 +77,8 @@ int main(int argc, char* argv[]) {
 		tnames[i] = tname;
 	}
 	
-	GZWriter fw(argv[1]); //   .
-	GZReader fr(argv[0]); //   .
+	GZMapReader fr(argv[0]); //   .
+	GZEditWriter fw(argv[1], fr); //   . ٲ  κ  ״ Ѵ.
 	if (!fr.opened() || !fw.opened()) {
 		fprintf(stderr, "file open error\n");
 		return -1;
@@ -90,26 +91,22 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr, "file does not seem to be a vital file\n");
 		return -1;
 	}
-	if (!fw.write(sign, 4)) return -1;
 
 	char ver[4];
 	if (!fr.read(ver, 4)) return -1; // version
-	if (!fw.write(ver, 4)) return -1;
 
 	unsigned short headerlen; // header length
 	if (!fr.read(&headerlen, 2)) return -1;
-	if (!fw.write(&headerlen, 2)) return -1;
-
-	BUF header(headerlen);
-	if (!fr.read(&header[0], headerlen)) return -1;
-	if (!fw.write(&header[0], headerlen)) return -1;
+	if (!fr.skip(headerlen)) return -1;
+	fw.keep(0, 10 + headerlen);
 
 	//   . ѹ 鼭 .
 	map<unsigned short, bool> tid_need_to_delete; //  tid   
-	map<unsigned long, string> did_dnames;
+	map<uint32_t, string> did_dnames;
 	while (!fr.eof()) { // body Ŷ ̴.
+		uint64_t packet_pos = fr.tell();
 		unsigned char packet_type; if (!fr.read(&packet_type, 1)) break;
-		unsigned long packet_len; if (!fr.read(&packet_len, 4)) break;
+		uint32_t packet_len; if (!fr.read(&packet_len, 4)) break;
 		if(packet_len > 1000000) break; // 1MB ̻ Ŷ 
 		
 		// ϰ ؾϹǷ ϰ   ۿ 
@@ -119,33 +116,22 @@ int main(int argc, char* argv[]) {
 		// tname, tid, dname, did, type (NUM, STR, WAV), srate
 		bool need_to_save = true;
 		if (packet_type == 0) { // trkinfo
-			unsigned short tid; if (!buf.fetch(tid)) goto next_packet;
-			buf.skip(2);
-			string tname; if (!buf.fetch_with_len(tname)) goto next_packet;
+			// fields missing in older files keep these defaults
+			TrkInfoView info;
+			info.maxdisp = 100.0f;
+			info.srate = 100.0f;
+			info.col = 0xffffffff;
+			if (!info.parse({packet_type, packet_len, &buf[0]})) goto next_packet;
+			string tname(info.tname);
 			
 			//  Ʈ  ޾ƿ.  ޾ƿ´
-			string unit; float mindisp = 0.0f, maxdisp = 100.0f, srate = 100.0f;
-			unsigned char color_a = 255, color_r = 255, color_g = 255, color_b = 255, montype = 0;
-			double gain = 1.0, offset = 0.0;
-
-			buf.fetch_with_len(unit);
-			buf.fetch(mindisp);
-			buf.fetch(maxdisp);
-			buf.fetch(color_b);
-			buf.fetch(color_g);
-			buf.fetch(color_r);
-			buf.fetch(color_a);
-			buf.fetch(srate);
-			buf.fetch(gain);
-			buf.fetch(offset);
-			buf.fetch(montype);
+			string unit(info.unit);
+			unsigned char color_r = (info.col >> 16) & 0xff, color_g = (info.col >> 8) & 0xff, color_b = info.col & 0xff;
 
-			unsigned long did = 0; 
-			buf.fetch(did);
-			auto dname = did_dnames[did];
+			auto dname = did_dnames[info.did];
 
 			bool need_to_delete = false; // ش Ʈ    ̹Ƿ 
-			for (int i = 0; i < ncmds; i++) {
+			for (unsigned i = 0; i < ncmds; i++) {
 				if (tnames[i] == "*" || tnames[i] == tname) {
 					if (dnames[i].empty() || dnames[i] == dname || dnames[i] == "*") { // Ʈ Ī 
 						need_to_save = false; // ϰų ϸ ⼭ ű  Ʒ   
@@ -164,11 +150,11 @@ int main(int argc, char* argv[]) {
 								}
 								if (ti.size() > 1) {
 									auto& s = ti[1];
-									if (!s.empty()) mindisp = atof(s.c_str());
+									if (!s.empty()) info.mindisp = atof(s.c_str());
 								}
 								if (ti.size() > 2) {
 									auto& s = ti[2];
-									if (!s.empty()) maxdisp = atof(s.c_str());
+									if (!s.empty()) info.maxdisp = atof(s.c_str());
 								}
 								if (ti.size() > 5) {
 									auto s = ti[3];
@@ -180,59 +166,31 @@ int main(int argc, char* argv[]) {
 								}
 								if (ti.size() > 6) {
 									auto& s = ti[6];
-									if (!s.empty()) gain = atof(s.c_str());
+									if (!s.empty()) info.adc_gain = atof(s.c_str());
 								}
 								if (ti.size() > 7) {
 									auto& s = ti[7];
-									if (!s.empty()) offset = atof(s.c_str());
+									if (!s.empty()) info.adc_offset = atof(s.c_str());
 								}
 								if (ti.size() > 8) {
 									auto& s = ti[8];
-									if (!s.empty()) montype = atof(s.c_str());
+									if (!s.empty()) info.montype = atof(s.c_str());
 								}
 							}
 
-							unsigned long new_packet_len = packet_len - tname.size() + newname.size() - unit.size() + newunit.size();
-
+							if (newname.empty()) newname = tname; // Ʈ   
+							info.tname = newname;
+							info.unit = newunit;
+							info.col = (info.col & 0xff000000) | (color_r << 16) | (color_g << 8) | color_b;
+							info.full = true;
+
+							// the fields after did stay as they were
+							BUF ti_packet;
+							info.encode(ti_packet);
+							uint32_t new_packet_len = (uint32_t)ti_packet.size();
 							fw.write(&packet_type, 1);
 							fw.write(&new_packet_len, 4);
-
-							// Ʈ   
-							unsigned long old_packet_written = 4;
-							fw.write(&buf[0], 4);
-
-							//  Ʈ 
-							old_packet_written += 4 + tname.size();
-							if (newname.empty()) newname = tname; // Ʈ   
-							fw.write_with_len(newname);
-
-							old_packet_written += 4 + unit.size();
-							fw.write_with_len(newunit);
-
-							old_packet_written += 4;
-							fw.write(mindisp);
-
-							old_packet_written += 4;
-							fw.write(maxdisp);
-
-							old_packet_written += 4;
-							fw.write(color_b);
-							fw.write(color_g);
-							fw.write(color_r);
-							fw.write(color_a);
-
-							old_packet_written += 12;
-							fw.write(srate);
-							fw.write(gain);
-
-							old_packet_written += 8;
-							fw.write(offset);
-
-							old_packet_written += 1;
-							fw.write(montype);
-
-							//   ( did)
-							fw.write(&buf[old_packet_written], packet_len - old_packet_written);
+							fw.write(&ti_packet[0], new_packet_len);
 
 							need_to_delete = false;
 						} else { // ̸ ĪǴµ newname  newti  ̴ 
@@ -242,25 +200,26 @@ int main(int argc, char* argv[]) {
 					}
 				}
 			}
-			tid_need_to_delete[tid] = need_to_delete;
+			tid_need_to_delete[info.tid] = need_to_delete;
 		} else if (packet_type == 9) { // devinfo
-			unsigned long did; if (!buf.fetch(did)) goto next_packet;
-			string dtype; if (!buf.fetch_with_len(dtype)) goto next_packet;
-			string dname; if (!buf.fetch_with_len(dname)) goto next_packet;
-			if (dname.empty()) dname = dtype;
-			did_dnames[did] = dname;
+			DevInfoView di; if (!di.parse({packet_type, packet_len, &buf[0]})) goto next_packet;
+			did_dnames[di.did] = string(di.dname);
 		} else if (packet_type == 1) { // rec
-			buf.skip(2 + 8); // infolen, dt_rec_start
-			unsigned short tid; if (!buf.fetch(tid)) goto next_packet;
-			need_to_save = !tid_need_to_delete[tid];
+			RecView rec; if (!rec.parse({packet_type, packet_len, &buf[0]})) goto next_packet;
+			need_to_save = !tid_need_to_delete[rec.tid];
 		}
 
 next_packet:
 		if (need_to_save) { //  Ŷ 
-			fw.write(&packet_type, 1);
-			fw.write(&packet_len, 4);
-			fw.write(&buf[0], packet_len);
+			fw.keep(packet_pos, 5 + packet_len);
 		}
 	}
+
+	// the kept members are copied and the file is flushed only here
+	fw.close();
+	if (!fw.good()) {
+		fprintf(stderr, "file write error\n");
+		return -1;
+	}
 	return 0;
 }
\ No newline at end of file
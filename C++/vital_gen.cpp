@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "VitalGen.h"
+#include "Util.h"
+using namespace std;
+
+void print_usage(const char *progname)
+{
+	fprintf(stderr, "Write a synthetic vital file for benchmarks.\n\n\
+Usage : %s [OPTIONS] OUTPUT_PATH\n\n\
+-d HOURS : duration. default = 1\n\
+-w N : wave tracks. default = 4\n\
+-n N : numeric tracks, one value every 2 sec. default = 8\n\
+-s N : string tracks, one event every 10 min. default = 1\n\
+-r SRATE : sampling rate of the wave tracks in Hz. default = 500\n\
+-f FMT,FMT,... : recfmt of the wave tracks, cycled. 1: float, 2: double, 3: char, 4: byte,\n\
+   5: short, 6: word, 7: long, 8: dword. default = 1\n\
+-z SEED : random seed. default = 1\n\n",
+			basename(string(progname)).c_str());
+}
+
+int main(int argc, char *argv[])
+{
+	VitalGenSpec spec;
+	string opath;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg.size() == 2 && arg[0] == '-' && i + 1 < argc)
+		{
+			const char *val = argv[++i];
+			switch (arg[1])
+			{
+			case 'd':
+				spec.hours = atof(val);
+				break;
+			case 'w':
+				spec.nwav = atoi(val);
+				break;
+			case 'n':
+				spec.nnum = atoi(val);
+				break;
+			case 's':
+				spec.nstr = atoi(val);
+				break;
+			case 'r':
+				spec.srate = atof(val);
+				break;
+			case 'f':
+				spec.recfmts.clear();
+				for (auto &s : explode(val, ','))
+					spec.recfmts.push_back((uint8_t)atoi(s.c_str()));
+				break;
+			case 'z':
+				spec.seed = atoi(val);
+				break;
+			default:
+				print_usage(argv[0]);
+				return -1;
+			}
+		}
+		else
+			opath = arg;
+	}
+	if (opath.empty() || spec.hours <= 0 || spec.srate <= 0)
+	{
+		print_usage(argv[0]);
+		return -1;
+	}
+	for (auto fmt : spec.recfmts)
+	{
+		if (fmt < 1 || fmt > 8)
+		{
+			fprintf(stderr, "recfmt should be 1 - 8\n");
+			return -1;
+		}
+	}
+
+	VitalGenStats stats;
+	if (!vital_gen(opath, spec, stats))
+	{
+		fprintf(stderr, "file write error\n");
+		return -1;
+	}
+	printf("%s,%llu records,%llu bytes\n", opath.c_str(), (unsigned long long)stats.recs, (unsigned long long)stats.bytes);
+	return 0;
+}
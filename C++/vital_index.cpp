@@ -0,0 +1,117 @@
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <sys/stat.h>
+#include "GZMapReader.h"
+#include "VitalIndex.h"
+#include "Util.h"
+using namespace std;
+
+void print_usage(const char *progname)
+{
+	fprintf(stderr, "Build or refresh the sidecar indexes of vital files.\n\n\
+Usage : %s [-f] [-j THREADS] INPUT_PATH1 [INPUT_PATH2] ...\n\n\
+INPUT_PATH : vital file, or directory that is searched recursively for .vital files\n\
+-f : rebuild the indexes even if they are fresh\n\
+-j : number of files indexed at the same time. default = number of cores\n\n\
+Each file gets FILE.vital.idx (track catalog, time ranges, statistics and record offsets)\n\
+and FILE.vital.gzi (random access points). Tools use them while they match the file.\n\n",
+			basename(string(progname)).c_str());
+}
+
+// returns "fresh", "built" or the reason of the failure
+const char *index_file(const string &path, bool force)
+{
+	if (!force)
+	{
+		VitalIndex idx;
+		GZIndex gzi;
+		if (idx.load_for(path) && gzi.load_for(path))
+			return "fresh";
+	}
+
+	GZMapReader gz(path.c_str(), MAPCHUNK, CODEC_ZLIB); // streaming, so the access points can be collected
+	if (!gz.opened())
+		return "open error";
+	gz.enable_index();
+	VitalIndex idx;
+	if (!idx.build(gz))
+		return "not a vital file";
+	// a broken packet stops the scan; the access points still cover the whole file
+	if (!gz.build_index())
+		return "read error";
+	if (!idx.save_for(path) || !gz.index()->save_for(path))
+		return "write error";
+	return "built";
+}
+
+int main(int argc, char *argv[])
+{
+	const char *progname = argv[0];
+	bool force = false;
+	unsigned nthreads = thread::hardware_concurrency();
+	vector<string> paths;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "-f")
+			force = true;
+		else if (arg == "-j" && i + 1 < argc)
+			nthreads = atoi(argv[++i]);
+		else
+			paths.push_back(arg);
+	}
+	if (paths.empty())
+	{
+		print_usage(progname);
+		return -1;
+	}
+
+	vector<string> files;
+	int nmissing = 0;
+	for (auto &path : paths)
+	{
+		struct stat st;
+		if (stat(path.c_str(), &st) != 0)
+		{
+			fprintf(stderr, "file does not exist: %s\n", path.c_str());
+			nmissing++;
+			continue;
+		}
+		if (S_ISDIR(st.st_mode))
+			scan_vital_files(files, path);
+		else
+			files.push_back(path);
+	}
+	if (!nthreads)
+		nthreads = 1;
+	if (nthreads > files.size())
+		nthreads = (unsigned)files.size();
+
+	// one file per thread at a time
+	atomic<size_t> next(0);
+	atomic<int> nfailed(0);
+	mutex print_mutex;
+	auto work = [&]()
+	{
+		for (size_t i; (i = next++) < files.size();)
+		{
+			const char *res = index_file(files[i], force);
+			bool ok = !strcmp(res, "fresh") || !strcmp(res, "built");
+			if (!ok)
+				nfailed++;
+			lock_guard<mutex> lock(print_mutex);
+			printf("%s,%s\n", files[i].c_str(), res);
+		}
+	};
+	vector<thread> threads;
+	for (unsigned i = 1; i < nthreads; i++)
+		threads.emplace_back(work);
+	work();
+	for (auto &t : threads)
+		t.join();
+	return nfailed || nmissing ? -1 : 0;
+}
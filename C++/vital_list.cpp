@@ -12,6 +12,7 @@
 #include <unistd.h> // for access(), etc. if needed
 #include <dirent.h> // for opendir(), readdir(), closedir() on POSIX
 #include "Util.h"	// you might have your custom utils here
+#include "VitalIndex.h"
 
 using namespace std;
 
@@ -155,6 +156,35 @@ int stripos(string shaystack, string sneedle)
 	return (int)pos;
 }
 
+// the track table that vital_trks prints, taken from a fresh sidecar index
+bool trks_from_index(const string &path, string &result)
+{
+	VitalIndex idx;
+	if (!idx.load_for(path))
+		return false;
+	ostringstream os;
+	bool has_dt = idx.body >= 10 + 26;
+	os << "#dgmt," << idx.dgmt / 60.0 << "\n";
+	// timestamps as vital_trks prints them, in fixed notation
+	os << std::fixed << "#dtstart," << (has_dt ? idx.dtstart : 0.0) << "\n";
+	os << "#dtend," << (has_dt ? idx.dtend : 0.0) << "\n"
+	   << std::defaultfloat;
+	os << "tname,tid,dname,did,rectype,dtstart,dtend,srate,minval,maxval,cnt,avgval,firstval\n";
+	for (auto &kv : idx.trks)
+	{
+		const VitalIndex::Track &trk = kv.second;
+		if (!trk.info)
+			continue;
+		const char *stype = trk.rectype == 1 ? "WAV" : trk.rectype == 2 ? "NUM" : trk.rectype == 5 ? "STR" : "";
+		os << trk.tname << "," << trk.tid << "," << trk.dname << "," << trk.did << "," << stype << ","
+		   << std::fixed << (trk.has_data() ? trk.dtstart : 0.0) << "," << trk.dtend << "," << std::defaultfloat << trk.srate << ","
+		   << trk.minval << "," << trk.maxval << "," << trk.count << ","
+		   << (trk.count ? trk.sum / (double)trk.count : 0.0) << "," << trk.firstval << "\n";
+	}
+	result = os.str();
+	return true;
+}
+
 int main(int argc, char *argv[])
 {
 	if (argc < 2)
@@ -193,22 +223,25 @@ Usage : %s [DIR]\n\n",
 		if (stripos(path.substr(path.size() - 6), ".vital") == -1)
 			continue;
 
-		// FIX #2: use popen / pclose on macOS, not _popen / _pclose
-		string cmd = string("vital_trks \"") + path + "\"";
-		FILE *f = popen(cmd.c_str(), "r");
-		if (!f)
-			continue;
-		ostringstream output;
-		while (!feof(f) && !ferror(f))
+		string result;
+		if (!trks_from_index(path, result))
 		{
-			char buf[128];
-			int bytesRead = (int)fread(buf, 1, 128, f);
-			if (bytesRead > 0)
-				output.write(buf, bytesRead);
+			// FIX #2: use popen / pclose on macOS, not _popen / _pclose
+			string cmd = string("vital_trks \"") + path + "\"";
+			FILE *f = popen(cmd.c_str(), "r");
+			if (!f)
+				continue;
+			ostringstream output;
+			while (!feof(f) && !ferror(f))
+			{
+				char buf[128];
+				int bytesRead = (int)fread(buf, 1, 128, f);
+				if (bytesRead > 0)
+					output.write(buf, bytesRead);
+			}
+			pclose(f);
+			result = output.str();
 		}
-		pclose(f);
-
-		string result = output.str();
 
 		// If you have an escape_csv or basename in "Util.h", use them
 		// otherwise provide your own
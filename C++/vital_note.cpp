@@ -8,7 +8,8 @@
 #include <stdarg.h> // For va_start, etc.
 #include <memory>	// For std::unique_ptr
 #include <time.h>
-#include "GZReader.h"
+#include "GZParWriter.h"
+#include "VitalPacket.h"
 #include "Util.h"
 #include <cfloat> // Required for DBL_MAX
 using namespace std;
@@ -20,7 +21,7 @@ Usage : %s INPUT_PATH OUTPUT_PATH NOTE\n\n\
 INPUT_PATH: input vital file path\n\
 OUTPUT_PATH: output vital file path\n\
 NOTE: new event string\n\n",
-		   basename(progname).c_str());
+		   basename(string(progname)).c_str());
 }
 
 int main(int argc, char *argv[])
@@ -40,7 +41,7 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	GZWriter go(argv[1]);
+	GZParWriter go(argv[1]);
 	if (!go.opened())
 	{
 		fprintf(stderr, "cannot open output file\n");
@@ -99,62 +100,30 @@ int main(int argc, char *argv[])
 	// 1st pass to find out dtstart
 	double dtstart = DBL_MAX;
 	double dtend = -1;
-	while (!gi.eof())
+	PacketReader pr(gi);
+	PacketView pkt;
+	while (pr.next(pkt))
 	{ // body is just a list of packet
-		unsigned char type;
-		if (!gi.read(&type, 1))
-			break;
-		unsigned long datalen;
-		if (!gi.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
-		if (type == 0)
+		if (pkt.type == 0)
 		{ // trkinfo : tname, tid, dname, did, type (NUM, STR, WAV), srate
-			unsigned short tid;
-			if (!gi.fetch(tid, datalen))
-				goto next_packet;
-			if (tid > tid_max)
-				tid_max = tid;
-			gi.skip(2, datalen);
-			string tname;
-			if (!gi.fetch_with_len(tname, datalen))
-				goto next_packet;
-			string unit;
-			if (!gi.fetch_with_len(unit, datalen))
-				goto next_packet;
-			gi.skip(4 + 4 + 4 + 4 + 8 + 8 + 1, datalen);
-			unsigned long did;
-			if (!gi.fetch(did, datalen))
-				goto next_packet;
-			if (did == 0 && tname == "EVENT")
-			{
-				tid_evt = tid;
-			}
-		}
-		else if (type == 9)
-		{ // devinfo
-			goto next_packet;
+			TrkInfoView ti;
+			if (!ti.parse(pkt))
+				continue;
+			if (ti.tid > tid_max)
+				tid_max = ti.tid;
+			if (ti.full && ti.did == 0 && ti.tname == "EVENT")
+				tid_evt = ti.tid;
 		}
-		else if (type == 1)
+		else if (pkt.type == 1)
 		{ // rec
-			unsigned short infolen;
-			if (!gi.fetch(infolen, datalen))
-				goto next_packet;
-			double dt_rec_start;
-			if (!gi.fetch(dt_rec_start, datalen))
-				goto next_packet;
-			if (!dt_rec_start)
-				goto next_packet;
-			if (dtstart > dt_rec_start)
-				dtstart = dt_rec_start;
-			if (dtend < dt_rec_start)
-				dtend = dt_rec_start;
+			RecView rec;
+			if (!rec.parse(pkt) || !rec.dt)
+				continue;
+			if (dtstart > rec.dt)
+				dtstart = rec.dt;
+			if (dtend < rec.dt)
+				dtend = rec.dt;
 		}
-
-	next_packet:
-		if (!gi.skip(datalen))
-			break;
 	}
 
 	vector<unsigned char> buf;
@@ -171,66 +140,47 @@ int main(int argc, char *argv[])
 	if (tid_evt == 0)
 	{
 		// SAVE_TRKINFO
-		unsigned char b = 0;
-		go.write(&b, 1);
-
-		unsigned long len = 13;
-		go.write(&len, 4);
-
 		tid_evt = tid_max + 1;
-		go.write(&tid_evt, 2);
-
-		b = 5; // REC_STR
-		go.write(&b, 1);
-
-		b = 0; // FMT_NULL
-		go.write(&b, 1);
-
-		// trk name
-		len = 5;
-		go.write(&len, 4);
-		go.write("EVENT", 5);
+		TrkInfoView ti;
+		ti.tid = tid_evt;
+		ti.rectype = 5; // REC_STR
+		ti.recfmt = 0;	// FMT_NULL
+		ti.tname = "EVENT";
+		vector<unsigned char> d;
+		ti.encode(d);
+
+		unsigned char hdr[PacketHead::size];
+		PacketHead::encode(hdr, 0, (uint32_t)d.size());
+		go.write(hdr, PacketHead::size);
+		go.write(&d[0], (uint32_t)d.size());
 	}
 
 	while (!gi.eof())
 	{ // �Է� ������ ��� ��Ŷ�� ������
-		unsigned char type;
-		if (!gi.read(&type, 1))
+		unsigned char hdr[PacketHead::size];
+		if (!gi.read(hdr, PacketHead::size))
 			break;
-		unsigned long datalen;
-		if (!gi.read(&datalen, 4))
+		PacketHead::decode(hdr, pkt.type, pkt.datalen);
+		if (pkt.datalen > MAX_PACKET)
 			break;
-		if (datalen > 1000000)
-			break;
-		if (buf.size() < datalen)
-			buf.resize(datalen);
-		if (!gi.read(&buf[0], datalen))
+		if (buf.size() < pkt.datalen)
+			buf.resize(pkt.datalen);
+		if (!gi.read(&buf[0], pkt.datalen))
 			break; // read packet
+		pkt.payload = &buf[0];
 
-		if (type == 0)
-		{ // trkinfo : tname, tid, dname, did, type (NUM, STR, WAV), srate
-			goto next_packet2;
-		}
-		else if (type == 9)
-		{ // devinfo
-			goto next_packet2;
-		}
-		else if (type == 1)
+		if (pkt.type == 1)
 		{ // rec
-			if (datalen < 10)
+			RecView rec;
+			if (!rec.parse(pkt))
 				break;
-			auto pdt = (double *)&buf[2];
-			auto ptid = (unsigned short *)&buf[10];
-			if (*ptid == tid_evt)
+			if (rec.tid == tid_evt)
 				continue; // skip the old event records
 		}
 
-	next_packet2:
-		if (!go.write(&type, 1))
+		if (!go.write(hdr, PacketHead::size))
 			break;
-		if (!go.write(&datalen, 4))
-			break;
-		if (!go.write(&buf[0], datalen))
+		if (!go.write(&buf[0], pkt.datalen))
 			break;
 	}
 
@@ -239,34 +189,26 @@ int main(int argc, char *argv[])
 		double dt = it.first;
 		string str = it.second;
 
-		// type and datalen
-		unsigned char type = 1; // SAVE_REC
-		if (!go.write(&type, 1))
-			break;
-
-		unsigned long strlen = str.size();
-
-		unsigned long datalen = 10 + 2 + (8 + strlen);
-		if (!go.write(&datalen, 4))
-			break;
+		// SAVE_REC of a str track: infolen, dt, tid, 4 reserved bytes, the string with its length
+		vector<unsigned char> d;
+		RecHead::append(d, 10, dt, tid_evt);
+		d.resize(d.size() + 4);
+		append_str(d, str);
 
-		// save info
-		unsigned short infolen = 10;
-		if (!go.write(&infolen, 2))
-			break;
-		if (!go.write(&dt, 8))
+		unsigned char hdr[PacketHead::size];
+		PacketHead::encode(hdr, 1, (uint32_t)d.size());
+		if (!go.write(hdr, PacketHead::size))
 			break;
-		if (!go.write(&tid_evt, 2))
-			break;
-
-		unsigned long nil = 0;
-		if (!go.write(&nil, 4))
-			break;
-		if (!go.write(&strlen, 4))
-			break;
-		if (!go.write((void *)str.c_str(), strlen))
+		if (!go.write(&d[0], (uint32_t)d.size()))
 			break;
 	}
 
+	// the deflate threads may still fail on the last blocks
+	go.close();
+	if (!go.good())
+	{
+		fprintf(stderr, "cannot write output file\n");
+		return -1;
+	}
 	return 0;
 }
\ No newline at end of file
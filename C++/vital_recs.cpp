@@ -5,16 +5,36 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <deque>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 #include <stdarg.h> // For va_start, etc.
 #include <memory>	// For std::unique_ptr
 #include <time.h>
 #include <cfloat>  // For DBL_MAX and DBL_MIN
 #include <cmath>   // For fabs, etc.
 #include <cstdint> // For int64_t, etc.
-#include "GZReader.h"
+#include <sys/stat.h>
+#include "GZPipeReader.h"
+#include "GZSpool.h"
+#include "VitalPacket.h"
+#include "VitalIndex.h"
+#include "TrackCatalog.h"
+#include "TextWriter.h"
 #include "Util.h"
 using namespace std;
 
+const size_t MAX_SPOOL = (size_t)1 << 29; // bytes of records kept in memory between the passes, the rest goes to a temp file
+const size_t MIN_SPOOL = (size_t)1 << 27; // the least MAX_SPOOL is divided down to when several files are read at once
+const double STREAM_WINDOW = 600; // seconds of rows written out at a time
+const long RING_WINDOWS = 2; // windows of rows kept in memory
+const size_t REORDER_MAX = (size_t)1 << 24; // bytes of records waiting for rows past the kept windows
+const size_t SPILL_FANIN = 16; // runs of spilled records merged into one at a time
+const std::uint32_t RUN_CHUNK = 1 << 16; // bytes read back from a run of spilled records at a time
+const size_t MAX_PENDING = (size_t)1 << 26; // bytes of csv a batch buffers while the files before them are written
+
 void print_usage(const char *progname)
 {
 	fprintf(stderr,
@@ -29,12 +49,18 @@ void print_usage(const char *progname)
 			"  n : print the closest value from the start of the time interval\n"
 			"  m : print mean value for numeric and wave tracks\n"
 			"  d : print device name\n"
-			"  s : skip blank rows\n\n"
-			"INPUT_FILENAME : vital file name\n\n"
+			"  s : skip blank rows\n"
+			"  o : write the rows of each input file to FILENAME.csv next to it\n"
+			"  jN : export N files at a time. default = number of cores\n\n"
+			"INPUT_FILENAME : vital file name, a directory that is searched for .vital files,\n"
+			"  or @LIST_FILE with one path per line. the rows of several files are written\n"
+			"  in the order of the files. use c to tell them apart\n\n"
 			"INTERVAL : time interval of each row in sec. default = 1. ex) 1/100\n\n"
 			"DEVNAME/TRKNAME : comma-separated device and track name list. ex) BIS/BIS,BIS/SEF\n"
-			"  if omitted, all tracks are exported.\n\n",
-			basename(progname).c_str());
+			"  if omitted, all tracks are exported.\n\n"
+			"The rows are written as the file is read. Records far out of time order wait in\n"
+			"memory, and in temp files past a limit, until their rows come up.\n\n",
+			basename(string(progname)).c_str());
 }
 
 double minval(const vector<double> &v)
@@ -59,118 +85,225 @@ double maxval(const vector<double> &v)
 	return ret;
 }
 
-// c++ string --> newly allocated C string
-char *cstr(const string &s)
+// skip forward to uncompressed offset 'off'
+bool skip_to(GZReader &rd, uint64_t off)
 {
-	char *ret = new char[s.size() + 1];
-	copy(s.begin(), s.end(), ret);
-	ret[s.size()] = '\0';
-	return ret;
+	while (rd.tell() < off)
+	{
+		uint64_t gap = off - rd.tell();
+		if (!rd.skip(gap > (1u << 30) ? (1u << 30) : (uint32_t)gap))
+			return false;
+	}
+	return rd.tell() == off;
 }
 
-int main(int argc, char *argv[])
+// One column of the output table, a typed vector over the rows. A blank NUM/WAV cell is NAN,
+// so a cell costs 4 bytes instead of a heap string and the text is made only when it is printed.
+// STR cells are rare and live in a sparse side table.
+struct Column
 {
-	const char *progname = argv[0];
-	--argc;
-	++argv; // skip program name
+	vector<float> f;		// NUM and WAV
+	vector<double> d;		// double WAV samples, or the sums of -m
+	vector<uint32_t> cnt;	// -m: the values summed in d
+	map<long, string> strs; // STR: row -> value escaped for csv
 
-	bool absolute_time = false;
-	bool unix_time = false;
-	bool all_required = false;
-	bool fill_last = false;
-	bool print_header = false;
-	bool print_filename = false;
-	bool print_mean = false;
-	bool print_dname = false;
-	bool print_closest = false;
-	bool skip_blank_row = false;
+	void alloc(const TrackDesc &t, long nrows, bool mean)
+	{
+		if (t.rectype != 1 && t.rectype != 2)
+			return;
+		if (mean)
+		{
+			d.assign(nrows, 0.0);
+			cnt.assign(nrows, 0);
+		}
+		else if (t.rectype == 1 && t.recfmt == 2)
+			d.assign(nrows, NAN);
+		else
+			f.assign(nrows, NAN);
+	}
 
-	// Parse any options in argv[0] if it starts with '-'
-	if (argc > 0)
+	bool filled(long row) const
 	{
-		string opts(argv[0]);
-		if (!opts.empty() && opts[0] == '-')
+		if (!cnt.empty())
+			return cnt[row] > 0;
+		if (!d.empty())
+			return !isnan(d[row]);
+		if (!f.empty())
+			return !isnan(f[row]);
+		return strs.count(row) > 0;
+	}
+
+	// empty a row for the next window
+	void clear(long row)
+	{
+		if (!cnt.empty())
 		{
-			--argc;
-			++argv;
-			if (opts.find('a') != string::npos)
-				absolute_time = true;
-			if (opts.find('u') != string::npos)
-				unix_time = true;
-			if (opts.find('r') != string::npos)
-				all_required = true;
-			if (opts.find('l') != string::npos)
-				fill_last = true;
-			if (opts.find('h') != string::npos)
-				print_header = true;
-			if (opts.find('c') != string::npos)
-				print_filename = true;
-			if (opts.find('m') != string::npos)
-				print_mean = true;
-			if (opts.find('s') != string::npos)
-				skip_blank_row = true;
-			if (opts.find('n') != string::npos)
-				print_closest = true;
-			if (opts.find('d') != string::npos)
-				print_dname = true;
+			d[row] = 0.0;
+			cnt[row] = 0;
 		}
+		else if (!d.empty())
+			d[row] = NAN;
+		else if (!f.empty())
+			f[row] = NAN;
+		else
+			strs.erase(row);
 	}
 
-	double epoch = 1.0;
-	if (argc < 1)
+	// -l: keep the value of a filled row in another
+	void copy(long from, long to)
 	{
-		print_usage(progname);
-		return -1;
+		if (!cnt.empty())
+		{
+			d[to] = d[from];
+			cnt[to] = cnt[from];
+		}
+		else if (!d.empty())
+			d[to] = d[from];
+		else if (!f.empty())
+			f[to] = f[from];
+		else
+			strs[to] = strs.at(from);
 	}
 
-	// If we have 2 or more remaining args, the second one is interval
-	if (argc >= 2)
+	// -m: the samples of a row, added in order
+	void add(long row, const float *v, uint32_t n)
 	{
-		string sspan(argv[1]);
-		auto pos = sspan.find('/');
-		epoch = atof(sspan.c_str());
-		if (pos != string::npos)
+		double sum = d[row];
+		for (uint32_t i = 0; i < n; i++)
+			sum += v[i];
+		d[row] = sum;
+		cnt[row] += n;
+	}
+
+	void put(long row, double v)
+	{
+		if (!cnt.empty())
 		{
-			double divider = atof(sspan.substr(pos + 1).c_str());
-			if (divider == 0)
-			{
-				fprintf(stderr, "divider of [TIMESPAN] should not be 0\n");
-				return -1;
-			}
-			epoch /= divider;
+			d[row] += (float)v; // the mean is taken over float values
+			cnt[row]++;
 		}
+		else if (!d.empty())
+			d[row] = v;
+		else if (!f.empty())
+			f[row] = (float)v;
 	}
-	if (epoch <= 0)
+
+	// ",value" of a filled cell
+	void print(TextWriter &out, long row) const
 	{
-		fprintf(stderr, "[TIMESPAN] should be > 0\n");
-		return -1;
+		out.put(',');
+		if (!cnt.empty())
+			out.fixed(d[row] / double(cnt[row]));
+		else if (!d.empty())
+			out.fixed(d[row]);
+		else if (!f.empty())
+			out.fixed(f[row]);
+		else
+			out.put(strs.at(row));
 	}
+};
 
-	// parse dname/tname if 3 or more args
-	vector<string> tnames;
-	vector<string> dnames;
-	vector<unsigned short> tids;
-	bool alltrack = true;
-	if (argc >= 3)
+// Where the samples of one wav rec fall in the rows of the table: sample i goes to row
+// (long)(frow(i) + bias), with bias 0.5 for -n. The row boundaries are guessed from
+// srate * epoch samples per row and confirmed with that same formula, so a rec is
+// binned row by row with the same result as a loop over every sample.
+struct RowMap
+{
+	double dt;
+	double srate;
+	double dtstart;
+	double epoch;
+	double bias;
+
+	double frow(uint32_t i) const
 	{
-		alltrack = false;
-		tnames = explode(argv[2], ',');
-		size_t ncols = tnames.size();
-		tids.resize(ncols);
-		dnames.resize(ncols);
-		for (size_t j = 0; j < ncols; j++)
+		return (dt + double(i) / srate - dtstart) / epoch;
+	}
+
+	long row(uint32_t i) const
+	{
+		return (long)(frow(i) + bias);
+	}
+
+	// the sample where frow reaches x, roughly
+	uint32_t guess(double x, uint32_t n) const
+	{
+		double k = ceil((x * epoch + dtstart - dt) * srate);
+		return k <= 0 ? 0 : k >= n ? n : (uint32_t)k;
+	}
+
+	// the first k in [lo, hi) with pred(k), or hi. pred is monotone and k is usually right
+	template <typename Pred>
+	static uint32_t first(uint32_t lo, uint32_t hi, uint32_t k, Pred pred)
+	{
+		k = k < lo ? lo : k > hi ? hi : k;
+		for (int step = 0; step < 4; step++)
 		{
-			auto pos = tnames[j].find('/');
-			if (pos != string::npos)
-			{
-				dnames[j] = tnames[j].substr(0, pos);
-				tnames[j] = tnames[j].substr(pos + 1);
-			}
+			if (k < hi && !pred(k))
+				k++;
+			else if (k > lo && pred(k - 1))
+				k--;
+			else
+				return k;
 		}
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			if (pred(mid))
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		return lo;
+	}
+
+	// the first sample in [lo, n) in a row after r
+	uint32_t row_end(long r, uint32_t lo, uint32_t n) const
+	{
+		return first(lo, n, guess(r + 1 - bias, n), [&](uint32_t k)
+					 { return row(k) > r; });
+	}
+
+	// the first sample in [lo, hi) with frow >= x
+	uint32_t reach(double x, uint32_t lo, uint32_t hi) const
+	{
+		return first(lo, hi, guess(x, hi), [&](uint32_t k)
+					 { return frow(k) >= x; });
 	}
+};
+
+// The command line. Every file of a batch is exported with the same options
+struct Options
+{
+	bool absolute_time = false;
+	bool unix_time = false;
+	bool all_required = false;
+	bool fill_last = false;
+	bool print_header = false;
+	bool print_filename = false;
+	bool print_mean = false;
+	bool print_dname = false;
+	bool print_closest = false;
+	bool skip_blank_row = false;
+	double epoch = 1.0;
+	bool alltrack = true;
+	vector<string> tnames; // the requested columns
+	vector<string> dnames;
+	size_t max_spool = MAX_SPOOL;
+	bool inflate_thread = PIPE_THREADED; // inflate on a thread of its own, off when each core already reads a file
+};
 
-	string filename = argv[0];
-	GZReader gz(filename.c_str());
+// Exports one vital file. The header line goes to out with -h, and to *header if it is
+// given, before the first row. Returns -1 if the file has no table to export.
+int export_file(const string &filename, const Options &opt, TextWriter &out, string *header = nullptr)
+{
+	// the columns of this file
+	vector<string> tnames = opt.tnames;
+	vector<string> dnames = opt.dnames;
+	vector<unsigned short> tids(tnames.size());
+	bool alltrack = opt.alltrack;
+
+	GZPipeReader gz(filename.c_str(), PIPE_BLOCK, opt.inflate_thread && thread::hardware_concurrency() > 1);
 	if (!gz.opened())
 	{
 		fprintf(stderr, "file does not exist\n");
@@ -205,138 +338,90 @@ int main(int argc, char *argv[])
 		return -1;
 	headerlen += 2; // adjust if needed later
 
-	// track data
-	map<unsigned short, double> tid_dtstart;
-	map<unsigned short, double> tid_dtend;
-	map<unsigned long, string> did_dnames;
-	map<unsigned short, unsigned char> rectypes;
-	map<unsigned short, unsigned char> recfmts;
-	map<unsigned short, double> gains;
-	map<unsigned short, double> offsets;
-	map<unsigned short, float> srates;
-	map<unsigned short, string> tid_tnames;
-	map<unsigned short, string> tid_dnames;
-	map<unsigned short, size_t> tid_col;
-	map<unsigned short, bool> tid_used;
-
-	// First pass: parse track info
-	while (!gz.eof())
-	{
-		unsigned char type;
-		if (!gz.read(&type, 1))
-			break;
-		unsigned long datalen;
-		if (!gz.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break; // basic sanity check
+	// track data. the slot of an exported track is its column
+	TrackCatalog cat;
 
-		if (type == 0)
+	// a fresh sidecar index replaces the first pass. not with -r, which needs the time of every record
+	VitalIndex idx;
+	bool indexed = !opt.all_required && idx.load_for(filename);
+	vector<uint64_t> recs; // offsets of the records to read in the second pass
+	GZIndex gzi;
+	if (indexed)
+	{
+		// tracks with a partial trkinfo are unknown, as in the first pass
+		vector<const VitalIndex::Track *> used;
+		for (auto &it : idx.trks)
 		{
-			// trkinfo
-			unsigned short tid;
-			if (!gz.fetch(tid, datalen))
+			auto &trk = it.second;
+			unsigned short tid = trk.tid;
+			bool known = trk.info && trk.full;
+			if (known)
+				cat.add(trk);
+			if (trk.has_data())
+				used.push_back(&trk);
+			if (known || trk.has_data())
 			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
+				TrackDesc &t = cat.at(tid);
+				t.dtstart = known ? trk.dtstart : 0.0;
+				t.dtend = trk.dtend;
 			}
-			unsigned char rectype;
-			if (!gz.fetch(rectype, datalen))
+			if (known && !alltrack)
 			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
+				for (size_t i = 0; i < tnames.size(); i++)
+				{
+					if (tnames[i] == trk.tname && (dnames[i].empty() || dnames[i] == trk.dname))
+					{
+						tids[i] = tid;
+						cat.at(tid).slot = (int32_t)i;
+						break;
+					}
+				}
 			}
-			unsigned char recfmt;
-			if (!gz.fetch(recfmt, datalen))
+		}
+		if (alltrack)
+		{
+			// columns in the order of the first record of each track
+			sort(used.begin(), used.end(), [](const VitalIndex::Track *a, const VitalIndex::Track *b)
+				 { return a->first < b->first; });
+			for (auto trk : used)
 			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
+				cat.at(trk->tid).slot = (int32_t)tnames.size();
+				tnames.push_back(cat.tname(trk->tid));
+				dnames.push_back(cat.dname(trk->tid));
+				tids.push_back(trk->tid);
 			}
+		}
+		vector<uint16_t> exported;
+		for (size_t tid = 0; tid < cat.size(); tid++)
+			if (cat[(uint16_t)tid].slot >= 0)
+				exported.push_back((uint16_t)tid);
+		recs = idx.recs_of(exported);
+		if (gzi.load_for(filename))
+			gz.enable_index(&gzi);
+	}
 
-			string tname, unit;
-			float minv, maxv, srate;
-			unsigned long col, did;
-			double adc_gain, adc_offset;
-			unsigned char montype;
-
-			// fetch tname
-			if (!gz.fetch_with_len(tname, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			// fetch unit
-			if (!gz.fetch_with_len(unit, datalen))
-			{
-				// just skip the rest if fails
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(minv, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(maxv, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(col, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(srate, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(adc_gain, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(adc_offset, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(montype, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (!gz.fetch(did, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+	// First pass: parse track info and keep the records of the exported tracks, in memory up to
+	// max_spool and in a temp file past it, so that the table is filled without inflating the file again
+	GZSpool spool(opt.max_spool);
+	bool spooling = !indexed;
+	double lag = indexed ? idx.lag : 0.0; // as VitalIndex::lag, over the records of the exported tracks
+	double dt_last_end = 0.0;
+	PacketReader pr(gz);
+	PacketView pkt;
+	while (!indexed && pr.next(pkt))
+	{
+		if (pkt.type == 0)
+		{
+			// trkinfo
+			TrkInfoView ti;
+			if (!ti.parse(pkt) || !ti.full)
 				continue;
-			}
+			unsigned short tid = ti.tid;
 
 			// save track info
-			string dname = did_dnames[did];
-			tid_tnames[tid] = tname;
-			tid_dnames[tid] = dname;
-			rectypes[tid] = rectype;
-			recfmts[tid] = recfmt;
-			gains[tid] = adc_gain;
-			offsets[tid] = adc_offset;
-			srates[tid] = srate;
-			tid_dtstart[tid] = DBL_MAX;
-			tid_dtend[tid] = 0.0;
+			TrackDesc &t = cat.add(ti);
+			const string &tname = cat.tname(tid);
+			const string &dname = cat.dname(tid);
 
 			// if user requested specific track names, see if it matches
 			if (!alltrack)
@@ -357,102 +442,71 @@ int main(int argc, char *argv[])
 				if (colPos >= 0)
 				{
 					tids[colPos] = tid;
-					tid_col[tid] = size_t(colPos);
+					t.slot = (int32_t)colPos;
 				}
 			}
 		}
-		else if (type == 9)
+		else if (pkt.type == 9)
 		{
 			// devinfo
-			unsigned long did;
-			if (!gz.fetch(did, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			string dtype;
-			if (!gz.fetch_with_len(dtype, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			string dname;
-			if (!gz.fetch_with_len(dname, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			DevInfoView di;
+			if (!di.parse(pkt))
 				continue;
-			}
-			if (dname.empty())
-				dname = dtype;
-			did_dnames[did] = dname;
+			cat.add_device(di);
 		}
-		else if (type == 1)
+		else if (pkt.type == 1)
 		{
 			// rec
-			unsigned short infolen;
-			if (!gz.fetch(infolen, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			double dt_rec_start;
-			if (!gz.fetch(dt_rec_start, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			RecView rec;
+			if (!rec.parse(pkt))
 				continue;
-			}
+			double dt_rec_start = rec.dt;
 			if (!dt_rec_start)
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			unsigned short tid;
-			if (!gz.fetch(tid, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
 				continue;
-			}
+			unsigned short tid = rec.tid;
+			TrackDesc &t = cat.at(tid);
+			bool known = t.info;
 			// update dtstart/dtend for that track
-			unsigned char rectype = rectypes[tid];
-			float srate = srates[tid];
-			unsigned long nsamp = 0;
+			unsigned char rectype = t.rectype;
+			float srate = t.srate;
+			uint32_t nsamp = 0;
 			double dt_rec_end = dt_rec_start;
 			if (rectype == 1) // wave
 			{
-				if (!gz.fetch(nsamp, datalen))
-				{
-					if (!gz.skip(datalen))
-						break;
+				const unsigned char *samples;
+				if (!rec.wav(nsamp, samples))
 					continue;
-				}
 				if (srate > 0)
 					dt_rec_end += nsamp / srate;
 			}
-			if (alltrack && !tid_used[tid])
+			if (alltrack && t.slot < 0)
 			{
-				size_t col = tnames.size();
-				tnames.push_back(tid_tnames[tid]);
-				dnames.push_back(tid_dnames[tid]);
+				t.slot = (int32_t)tnames.size();
+				tnames.push_back(cat.tname(tid));
+				dnames.push_back(cat.dname(tid));
 				tids.push_back(tid);
-				tid_col[tid] = col;
-				tid_used[tid] = true;
 			}
-			if (tid_dtstart[tid] > dt_rec_start)
-				tid_dtstart[tid] = dt_rec_start;
-			if (tid_dtend[tid] < dt_rec_end)
-				tid_dtend[tid] = dt_rec_end;
-		}
+			if (t.dtstart > dt_rec_start)
+				t.dtstart = dt_rec_start;
+			if (t.dtend < dt_rec_end)
+				t.dtend = dt_rec_end;
 
-		// skip leftover data in the chunk
-		if (!gz.skip(datalen))
-			break;
+			// the track info may still come later for unknown tracks
+			if (t.slot < 0 && known)
+				continue;
+			if (dt_last_end - dt_rec_start > lag)
+				lag = dt_last_end - dt_rec_start;
+			if (dt_last_end < dt_rec_end)
+				dt_last_end = dt_rec_end;
+			if (spooling)
+			{
+				unsigned char head[PacketHead::size];
+				pkt.encode_head(head);
+				// the temp file cannot be written. read the file again in the second pass
+				if (!spool.append(head, sizeof(head)) || !spool.append(pkt.payload, pkt.datalen))
+					spooling = false;
+			}
+		}
 	}
 
 	// figure out global start/end
@@ -462,8 +516,8 @@ int main(int argc, char *argv[])
 	{
 		if (t == 0)
 			continue;
-		dtstarts.push_back(tid_dtstart[t]);
-		dtends.push_back(tid_dtend[t]);
+		dtstarts.push_back(cat[t].dtstart);
+		dtends.push_back(cat[t].dtend);
 	}
 	if (dtstarts.empty() || dtends.empty())
 	{
@@ -471,7 +525,7 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	if (all_required)
+	if (opt.all_required)
 	{
 		// all tracks must have data
 		dtstart = -DBL_MAX;
@@ -494,511 +548,858 @@ int main(int argc, char *argv[])
 		fprintf(stderr, "No data\n");
 		return -1;
 	}
-	if (dtend - dtstart > 48 * 3600)
-	{
-		fprintf(stderr, "Data duration > 48 hrs\n");
-		return -1;
-	}
-
-	// rewind and parse again
-	gz.rewind();
-	// skip 10 + headerlen
-	if (!gz.skip(10 + headerlen))
-		return -1;
 
 	size_t ncols = tids.size();
 	// how many rows
-	long nrows = (long)ceil((dtend - dtstart) / epoch);
+	long nrows = (long)ceil((dtend - dtstart) / opt.epoch);
 
-	// allocate memory for table
-	vector<char *> vals(ncols * nrows, nullptr);
+	// the records are read again from the spool, or from the file if the spool failed
+	GZReader &rd = spooling ? (GZReader &)spool : (GZReader &)gz;
+	auto rewind_records = [&]()
+	{
+		if (spooling)
+		{
+			spool.rewind();
+			return true;
+		}
+		gz.rewind();
+		// skip 10 + headerlen
+		return gz.skip(10 + headerlen);
+	};
 
-	// if computing mean
-	vector<double> sums;
-	vector<long> cnts;
-	if (print_mean)
+	if (opt.all_required)
 	{
-		sums.resize(ncols * nrows, 0.0);
-		cnts.resize(ncols * nrows, 0L);
+		// every column needs a record in a row of the table: one that starts at dtstart or later,
+		// in a row before nrows, as the second pass bins it. the records are read once more until
+		// each column has one, before anything is written
+		vector<bool> found(ncols, false);
+		size_t nfound = 0;
+		if (!rewind_records())
+			return -1;
+		PacketReader sr(rd);
+		RecView rec;
+		while (nfound < ncols && sr.next(pkt, rec, [&](const RecView &r)
+										 { return r.dt >= dtstart && cat[r.tid].slot >= 0 && !found[size_t(cat[r.tid].slot)]; }))
+		{
+			if (pkt.type != 1)
+				continue;
+			const TrackDesc &t = cat[rec.tid];
+			if ((long)((rec.dt - dtstart) / opt.epoch + (opt.print_closest ? 0.5 : 0.0)) >= nrows)
+				continue;
+			bool binned = !t.info;
+			if (t.rectype == 1)
+			{
+				uint32_t nsamp;
+				const unsigned char *samples;
+				binned = t.srate > 0 && rec.wav(nsamp, samples) && min(nsamp, (rec.len - 4) / t.fmtsize) > 0;
+			}
+			else if (t.rectype == 2)
+			{
+				float fval;
+				binned = rec.num(fval);
+			}
+			else if (t.rectype == 5)
+			{
+				string_view sval;
+				binned = rec.str(sval);
+			}
+			if (binned)
+			{
+				found[size_t(t.slot)] = true;
+				nfound++;
+			}
+		}
+		if (nfound < ncols)
+		{
+			fprintf(stderr, "No data\n");
+			return -1;
+		}
 	}
 
+	// the second pass
+	if (!rewind_records())
+		return -1;
+	size_t irec = 0;
+
+	// The table is streamed in windows of STREAM_WINDOW seconds. Only the rows of the last
+	// RING_WINDOWS windows are in memory, row r at r % cap, and the oldest window is written out
+	// when a record needs a row past them. A case that fits in the ring is written at the end.
+	// A window goes only once no record still to come can reach it: none starts more than the
+	// lag before a record read earlier.
+	long wrows = max(1L, (long)ceil(STREAM_WINDOW / opt.epoch));
+	long cap = min(nrows, wrows * RING_WINDOWS);
+	long base = 0;	 // the first row not written yet
+	long held = cap; // -l: the row that keeps the last value of each column
+	double dt_seen = dtstart; // the latest start of a record read in the second pass
+
+	// the rows before this take no more records. one row less for the rounding
+	auto final_rows = [&]()
+	{
+		return max(0L, (long)floor((dt_seen - lag - dtstart) / opt.epoch) - 1);
+	};
+
+	// allocate memory for table
+	vector<Column> cols(ncols);
+	for (size_t j = 0; j < ncols; j++)
+		if (tids[j])
+			cols[j].alloc(cat[tids[j]], cap + 1, opt.print_mean);
+
 	// if printing closest
 	vector<double> dists;
-	if (print_closest)
+	if (opt.print_closest)
 	{
-		dists.resize(ncols * nrows, DBL_MAX);
+		dists.resize(ncols * cap, DBL_MAX);
 	}
 
-	vector<bool> has_data_in_col(ncols, false);
-	vector<bool> has_data_in_row(nrows, false);
+	vector<bool> has_data_in_row(cap, false);
+	vector<bool> has_last(ncols, false); // -l
+	vector<float> wavbuf; // -m: the decoded samples of a rec
 
-	// second pass
-	while (!gz.eof())
+	// Records that start past the ring wait here by their first row, so that a record
+	// written out of order still finds its rows. A long wav rec waits with the sample it
+	// stopped at. The oldest window is written when the buffer is full, and the records
+	// that fit then are binned in the order they were read, as without the buffer. If no
+	// window can go yet, the buffer is spilled to disk instead.
+	struct Pending
 	{
-		unsigned char type;
-		if (!gz.read(&type, 1))
-			break;
-		unsigned long datalen;
-		if (!gz.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
+		vector<unsigned char> payload;
+		uint32_t from; // the first sample not binned yet
+		size_t seq;	   // order in the file
+	};
+	multimap<long, Pending> pending;
+	size_t pending_bytes = 0;
+	size_t nlate = 0; // records that came after their rows were written
 
-		// If it's not a rec packet, skip
-		if (type != 1)
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
+	auto defer = [&](long irow, const RecView &rec, uint32_t from, size_t seq)
+	{
+		Pending p;
+		rec.encode(p.payload);
+		p.from = from;
+		p.seq = seq;
+		pending_bytes += p.payload.size();
+		pending.emplace(irow, std::move(p));
+	};
 
-		// Declarations
-		unsigned short infolen = 0;
-		double dt_rec_start = 0.0;
-		unsigned short tid = 0;
-		float srate = 0.f;
-		unsigned long nsamp = 0;
-		unsigned char rectype = 0;
-		unsigned char recfmt = 0;
-		unsigned long fmtsize = 4;
-		double gain = 0.0;
-		double offset = 0.0;
+	// A spill is a run of the buffer sorted by row, in a temp file. The runs are read back a
+	// record at a time as the ring reaches their rows, and SPILL_FANIN runs of a level are
+	// merged into one of the next, so that only a few are open however many spills there are.
+	struct Run
+	{
+		unique_ptr<GZSpool> data; // row, seq, from, len and payload of each record
+		size_t level = 0;		  // merged from SPILL_FANIN^level spills
+		long row = 0;			  // of the head
+		Pending head;			  // the next record, loaded
+		bool more = false;		  // head is loaded
+	};
+	vector<Run> runs;
 
-		// fetch them carefully
-		// If any fails, skip/continue
-		if (!gz.fetch(infolen, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-		if (!gz.fetch(dt_rec_start, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-		if (dt_rec_start < dtstart)
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-		if (!gz.fetch(tid, datalen))
+	auto put = [](GZSpool &f, long row, const Pending &p)
+	{
+		int64_t r = row;
+		uint64_t seq = p.seq;
+		uint32_t len = (uint32_t)p.payload.size();
+		return f.append(&r, 8) && f.append(&seq, 8) && f.append(&p.from, 4) && f.append(&len, 4) && f.append(p.payload.data(), len);
+	};
+
+	auto load = [](Run &run)
+	{
+		int64_t row;
+		uint64_t seq;
+		uint32_t len;
+		run.more = run.data->read(&row, 8) == 8 && run.data->read(&seq, 8) == 8 && run.data->read(&run.head.from, 4) == 4 && run.data->read(&len, 4) == 4;
+		if (!run.more)
+			return;
+		run.head.payload.resize(len);
+		run.more = run.data->read(run.head.payload.data(), len) == len;
+		run.row = (long)row;
+		run.head.seq = (size_t)seq;
+	};
+
+	// write the buffer out as a run, and merge the levels that are full. false if the temp file cannot be written
+	auto spill = [&]()
+	{
+		Run run;
+		run.data.reset(new GZSpool(0, RUN_CHUNK));
+		for (auto &it : pending)
+			if (!put(*run.data, it.first, it.second))
+				return false;
+		run.data->rewind();
+		load(run);
+		runs.push_back(std::move(run));
+		pending.clear();
+		pending_bytes = 0;
+
+		for (size_t level = 0;; level++)
 		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
+			if ((size_t)count_if(runs.begin(), runs.end(), [&](const Run &r)
+								 { return r.level == level; }) < SPILL_FANIN)
+				return true;
+			Run merged;
+			merged.level = level + 1;
+			merged.data.reset(new GZSpool(0, RUN_CHUNK));
+			while (true)
+			{
+				Run *low = nullptr;
+				for (auto &r : runs)
+					if (r.level == level && r.more && (!low || r.row < low->row))
+						low = &r;
+				if (!low)
+					break;
+				if (!put(*merged.data, low->row, low->head))
+					return false;
+				load(*low);
+			}
+			runs.erase(remove_if(runs.begin(), runs.end(), [&](const Run &r)
+								 { return r.level == level; }),
+					   runs.end());
+			merged.data->rewind();
+			load(merged);
+			runs.push_back(std::move(merged));
 		}
-		// check if known tid
-		if (tid_col.find(tid) == tid_col.end())
+	};
+
+	// the first row of a waiting record, in memory or spilled. nrows if none
+	auto first_row = [&]()
+	{
+		long first = pending.empty() ? nrows : pending.begin()->first;
+		for (auto &r : runs)
+			if (r.more && r.row < first)
+				first = r.row;
+		return first;
+	};
+
+	bool started = false;
+	string fname = basename(filename);
+
+	// write the rows up to end and free them for the next window
+	auto write_rows = [&](long end)
+	{
+		// print header
+		if (!started)
 		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
+			string line;
+			if (opt.print_filename)
+				line += "Filename,";
+
+			line += "Time";
+			for (size_t j = 0; j < ncols; j++)
+			{
+				string colName = tnames[j];
+				if (opt.print_dname && !dnames[j].empty())
+				{
+					colName = dnames[j] + "/" + colName;
+				}
+				line += ',';
+				line += colName;
+			}
+			line += '\n';
+			if (opt.print_header)
+				out.put(line);
+			if (header)
+				*header = line;
 		}
+		started = true;
 
-		rectype = rectypes[tid];
-		srate = srates[tid];
-		if (rectype == 1)
+		// Output rows
+		for (long i = base; i < end; i++)
 		{
-			if (!gz.fetch(nsamp, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			long slot = i % cap;
+			if (opt.skip_blank_row && !has_data_in_row[size_t(slot)])
 				continue;
+
+			double dt = dtstart + i * opt.epoch;
+
+			if (opt.print_filename)
+			{
+				out.put(fname);
+				out.put(',');
 			}
+
+			if (opt.absolute_time)
+			{
+				// convert dt => local time
+				time_t t_local = (time_t)(dt - dgmt * 60);
+				struct tm tm_local;
+#ifdef _WIN32
+				gmtime_s(&tm_local, &t_local);
+#else
+				gmtime_r(&t_local, &tm_local);
+#endif
+				struct tm *ts = &tm_local;
+				int64_t msPart = (int64_t)((dt - (int64_t)dt) * 1000.0);
+				// "%04d-%02d-%02d %02d:%02d:%02d.%03lld"
+				out.integer(ts->tm_year + 1900, 4);
+				out.put('-');
+				out.integer(ts->tm_mon + 1, 2);
+				out.put('-');
+				out.integer(ts->tm_mday, 2);
+				out.put(' ');
+				out.integer(ts->tm_hour, 2);
+				out.put(':');
+				out.integer(ts->tm_min, 2);
+				out.put(':');
+				out.integer(ts->tm_sec, 2);
+				out.put('.');
+				out.integer((long long)msPart, 3);
+			}
+			else if (opt.unix_time)
+			{
+				out.fixed(dt);
+			}
+			else
+			{
+				out.fixed(dt - dtstart);
+			}
+
+			// columns
+			for (size_t j = 0; j < ncols; j++)
+			{
+				long row = cols[j].filled(slot) ? slot : -1;
+				if (opt.fill_last)
+				{
+					if (row >= 0)
+					{
+						cols[j].copy(row, held);
+						has_last[j] = true;
+					}
+					else if (has_last[j])
+					{
+						row = held;
+					}
+				}
+				if (row >= 0)
+					cols[j].print(out, row);
+				else
+					out.put(',');
+			}
+			out.put('\n');
 		}
-		recfmt = recfmts[tid];
-		switch (recfmt)
+
+		for (long i = base; i < end; i++)
 		{
-		case 2:
-			fmtsize = 8;
-			break; // double
-		case 3:
-		case 4:
-			fmtsize = 1;
-			break; // char / unsigned char
-		case 5:
-		case 6:
-			fmtsize = 2;
-			break; // short / unsigned short
-			// case 1, 7, or 8 => default fmtsize=4
+			long slot = i % cap;
+			for (auto &col : cols)
+				col.clear(slot);
+			if (opt.print_closest)
+				fill(dists.begin() + slot * ncols, dists.begin() + (slot + 1) * ncols, DBL_MAX);
+			has_data_in_row[size_t(slot)] = false;
 		}
-		gain = gains[tid];
-		offset = offsets[tid];
+		base = end;
+	};
 
-		size_t icol = tid_col[tid];
+	// bin a rec, from sample 'from' for wav
+	auto bin = [&](const RecView &rec, uint32_t from, size_t seq)
+	{
+		const TrackDesc &t = cat[rec.tid];
+		size_t icol = size_t(t.slot);
+		Column &col = cols[icol];
+		unsigned char rectype = t.rectype;
+		unsigned char recfmt = t.recfmt;
+		uint32_t fmtsize = t.fmtsize;
+		float srate = t.srate;
+		double gain = t.gain;
+		double offset = t.offset;
 
 		// handle track data
 		if (rectype == 1)
 		{
-			// wave
-			for (long i = 0; i < (long)nsamp; i++)
+			// wave. the samples that are present, viewed at once
+			uint32_t nsamp;
+			const unsigned char *samples;
+			if (!rec.wav(nsamp, samples))
+				return;
+			uint32_t n = min(nsamp, (rec.len - 4) / fmtsize);
+			if (!(srate > 0))
+				return;
+
+			RowMap m{rec.dt, srate, dtstart, opt.epoch, opt.print_closest ? 0.5 : 0.0};
+			if (from == 0 && n && m.row(0) < base)
+				nlate++;
+			if (opt.print_mean)
 			{
-				double ftime = dt_rec_start + double(i) / srate;
-				double frow = (ftime - dtstart) / epoch;
-				long irow = (long)(frow + (print_closest ? 0.5 : 0.0));
-				if (irow < 0)
-				{
-					if (!gz.skip(fmtsize, datalen))
-						break;
-					continue;
-				}
+				wavbuf.resize(n);
+				decode_samples(samples, n, recfmt, float(gain), float(offset), wavbuf.data());
+			}
+
+			// one step per row. samples before the first row and after the last are never read
+			for (uint32_t i = m.row_end(base - 1, from, n), e; i < n; i = e)
+			{
+				long irow = m.row(i);
 				if (irow >= nrows)
+					break;
+				if (irow >= base + cap)
 				{
-					if (!gz.skip(fmtsize, datalen))
-						break;
-					continue;
+					// the rest waits for the ring to move
+					defer(irow, rec, i, seq);
+					break;
 				}
-				bool skip_sample = true;
-				if (print_closest)
+				e = m.row_end(irow, i + 1, n);
+				long slot = irow % cap;
+				size_t idx = size_t(slot) * ncols + icol;
+				bool stored = false;
+				if (opt.print_closest && opt.print_mean)
 				{
-					double dist = fabs(frow - irow);
-					size_t idx = size_t(irow) * ncols + icol;
-					if (dist < dists[idx])
+					// every sample that comes closer is summed, as it always was
+					for (uint32_t k = i; k < e; k++)
 					{
-						dists[idx] = dist;
-						skip_sample = false;
+						double dist = fabs(m.frow(k) - irow);
+						if (dist < dists[idx])
+						{
+							dists[idx] = dist;
+							col.add(slot, &wavbuf[k], 1);
+							stored = true;
+						}
 					}
 				}
-				else if (print_mean)
+				else if (opt.print_closest)
 				{
-					skip_sample = false;
+					// the closest sample is on either side of the row time
+					uint32_t j = m.reach(double(irow), i, e);
+					for (uint32_t k = (j > i ? j - 1 : j); k < e && k <= j; k++)
+					{
+						double dist = fabs(m.frow(k) - irow);
+						if (dist < dists[idx])
+						{
+							dists[idx] = dist;
+							col.put(slot, sample_value(samples + k * fmtsize, recfmt, float(gain), float(offset)));
+							stored = true;
+						}
+					}
 				}
-				else
+				else if (opt.print_mean)
 				{
-					// if not closest or mean, only fill once if empty
-					skip_sample = (vals[size_t(irow) * ncols + icol] != nullptr);
+					col.add(slot, &wavbuf[i], e - i);
+					stored = true;
 				}
-				if (skip_sample)
+				else if (!col.filled(slot))
 				{
-					if (!gz.skip(fmtsize, datalen))
-						break;
-					continue;
+					// the first sample of the row
+					col.put(slot, sample_value(samples + i * fmtsize, recfmt, float(gain), float(offset)));
+					stored = true;
 				}
+				if (stored)
+					has_data_in_row[size_t(slot)] = true;
+			}
+			return;
+		}
 
-				// read this sample
-				string sval;
-				float fval = 0.f;
-				bool fetch_ok = true;
-				switch (recfmt)
-				{
-				case 1: // float
-				{
-					float v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					sval = string_format("%f", v);
-					fval = v;
-					break;
-				}
-				case 2: // double
-				{
-					double v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					sval = string_format("%lf", v);
-					fval = float(v);
-					break;
-				}
-				case 3: // char
-				{
-					char v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					fval = float(v) * float(gain) + float(offset);
-					sval = string_format("%f", fval);
-					break;
-				}
-				case 4: // unsigned char
-				{
-					unsigned char v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					fval = float(v) * float(gain) + float(offset);
-					sval = string_format("%f", fval);
-					break;
-				}
-				case 5: // short
-				{
-					short v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					fval = float(v) * float(gain) + float(offset);
-					sval = string_format("%f", fval);
-					break;
-				}
-				case 6: // unsigned short
-				{
-					unsigned short v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					fval = float(v) * float(gain) + float(offset);
-					sval = string_format("%f", fval);
-					break;
-				}
-				case 7: // long
-				{
-					long v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					fval = float(v) * float(gain) + float(offset);
-					sval = string_format("%f", fval);
-					break;
-				}
-				case 8: // unsigned long
-				{
-					unsigned long v;
-					if (!gz.fetch(v, datalen))
-						fetch_ok = false;
-					fval = float(v) * float(gain) + float(offset);
-					sval = string_format("%f", fval);
-					break;
-				}
-				}
-				if (!fetch_ok)
-				{
-					// if fetch fails, skip leftover data and break loop
-					if (!gz.skip(datalen))
-						break;
-					break;
-				}
+		if (rectype != 2 && rectype != 5)
+			return;
 
-				size_t idx = size_t(irow) * ncols + icol;
-				if (print_mean)
-				{
-					sums[idx] += double(fval);
-					cnts[idx]++;
-				}
-				else
-				{
-					vals[idx] = cstr(sval);
-				}
-				has_data_in_col[icol] = true;
-				has_data_in_row[size_t(irow)] = true;
-			}
+		// numeric or string track
+		double frow = (rec.dt - dtstart) / opt.epoch;
+		long irow = (long)(frow + (opt.print_closest ? 0.5 : 0.0));
+		if (irow < 0 || irow >= nrows)
+			return;
+		if (irow < base)
+		{
+			nlate++;
+			return;
 		}
-		else if (rectype == 2)
+		if (irow >= base + cap)
 		{
-			// numeric track
-			double frow = (dt_rec_start - dtstart) / epoch;
-			long irow = (long)(frow + (print_closest ? 0.5 : 0.0));
-			if (irow < 0 || irow >= nrows)
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			bool skip_sample = true;
-			size_t idx = size_t(irow) * ncols + icol;
-			if (print_closest)
-			{
-				double dist = fabs(frow - irow);
-				if (dist < dists[idx])
-				{
-					dists[idx] = dist;
-					skip_sample = false;
-				}
-			}
-			else if (print_mean)
+			defer(irow, rec, 0, seq);
+			return;
+		}
+		long slot = irow % cap;
+		bool skip_sample = true;
+		size_t idx = size_t(slot) * ncols + icol;
+		if (opt.print_closest)
+		{
+			double dist = fabs(frow - irow);
+			if (dist < dists[idx])
 			{
+				dists[idx] = dist;
 				skip_sample = false;
 			}
-			else
-			{
-				skip_sample = (vals[idx] != nullptr);
-			}
-			if (skip_sample)
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
+		}
+		else if (opt.print_mean && rectype == 2)
+		{
+			skip_sample = false;
+		}
+		else
+		{
+			skip_sample = col.filled(slot);
+		}
+		if (skip_sample)
+			return;
+
+		if (rectype == 2)
+		{
 			float fval = 0.f;
-			if (!gz.fetch(fval, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			if (print_mean)
-			{
-				sums[idx] += double(fval);
-				cnts[idx]++;
-			}
-			else
-			{
-				vals[idx] = cstr(string_format("%f", fval));
-			}
-			has_data_in_col[icol] = true;
-			has_data_in_row[size_t(irow)] = true;
+			if (!rec.num(fval))
+				return;
+			col.put(slot, fval);
 		}
-		else if (rectype == 5)
+		else
 		{
-			// string track
-			double frow = (dt_rec_start - dtstart) / epoch;
-			long irow = (long)(frow + (print_closest ? 0.5 : 0.0));
-			if (irow < 0 || irow >= nrows)
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			bool skip_sample = true;
-			size_t idx = size_t(irow) * ncols + icol;
-			if (print_closest)
-			{
-				double dist = fabs(frow - irow);
-				if (dist < dists[idx])
-				{
-					dists[idx] = dist;
-					skip_sample = false;
-				}
-			}
-			else
-			{
-				skip_sample = (vals[idx] != nullptr);
-			}
-			if (skip_sample)
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			// skip 4-byte length field
-			if (!gz.skip(4, datalen))
+			string_view sval;
+			if (!rec.str(sval))
+				return;
+			col.strs[slot] = escape_csv(string(sval));
+		}
+		has_data_in_row[size_t(slot)] = true;
+	};
+
+	// write the oldest window until the first waiting record fits, as long as the window is
+	// before row 'done', then bin all that fit. false if nothing moved
+	vector<Pending> ready;
+	auto advance = [&](long done)
+	{
+		long first = first_row();
+		long from = base;
+		while (first < nrows && first >= base + cap && base + wrows <= done)
+			write_rows(base + wrows);
+		ready.clear();
+		while (!pending.empty() && pending.begin()->first < base + cap)
+		{
+			pending_bytes -= pending.begin()->second.payload.size();
+			ready.push_back(std::move(pending.begin()->second));
+			pending.erase(pending.begin());
+		}
+		for (auto &r : runs)
+			while (r.more && r.row < base + cap)
 			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
+				ready.push_back(std::move(r.head));
+				load(r);
 			}
-			string sval;
-			if (!gz.fetch_with_len(sval, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			vals[idx] = cstr(escape_csv(sval));
-			has_data_in_col[icol] = true;
-			has_data_in_row[size_t(irow)] = true;
+		runs.erase(remove_if(runs.begin(), runs.end(), [](const Run &r)
+							 { return !r.more; }),
+				   runs.end());
+		sort(ready.begin(), ready.end(), [](const Pending &a, const Pending &b)
+			 { return a.seq < b.seq; });
+		for (auto &p : ready)
+		{
+			PacketView pv;
+			pv.type = 1;
+			pv.datalen = (uint32_t)p.payload.size();
+			pv.payload = p.payload.data();
+			RecView rec;
+			if (rec.parse(pv))
+				bin(rec, p.from, p.seq);
 		}
+		return base > from || !ready.empty();
+	};
 
-		// skip leftover data for this packet
-		if (!gz.skip(datalen))
+	// second pass. with the index every record read is of an exported track
+	PacketReader rr(rd);
+	RecView rec;
+	size_t nread = 0;
+	while (true)
+	{
+		// with the index, go straight to the next record of an exported track
+		if (indexed && (irec == recs.size() || !skip_to(rd, recs[irec++])))
+			break;
+		if (!rr.next(pkt, rec, [&](const RecView &r)
+					 { return indexed || (r.dt >= dtstart && cat[r.tid].slot >= 0); }))
 			break;
+		if (pkt.type != 1 || rec.dt < dtstart || cat[rec.tid].slot < 0)
+			continue;
+		// a wav rec that cannot be read was left out of the lag as well
+		uint32_t nsamp;
+		const unsigned char *samples;
+		if (rec.dt > dt_seen && (cat[rec.tid].rectype != 1 || rec.wav(nsamp, samples)))
+			dt_seen = rec.dt;
+		bin(rec, 0, nread++);
+		while (pending_bytes > REORDER_MAX)
+			if (!advance(final_rows()) && !spill())
+				advance(nrows); // no temp file. write the window anyway, later records for it are left out
 	}
+	while (!pending.empty() || !runs.empty())
+		advance(nrows);
+
+	write_rows(nrows);
+	if (nlate)
+		fprintf(stderr, "%zu records came after their rows were written and were left out\n", nlate);
 
-	// all_required => check if any track had no data
-	if (all_required)
+	return 0;
+}
+
+// the paths of a list file, one per line
+bool read_list(const string &path, vector<string> &out)
+{
+	FILE *f = fopen(path.c_str(), "rt");
+	if (!f)
+		return false;
+	char line[4096];
+	while (fgets(line, sizeof(line), f))
 	{
-		for (size_t j = 0; j < ncols; j++)
-		{
-			if (!has_data_in_col[j])
-			{
-				fprintf(stderr, "No data\n");
-				return -1;
-			}
-		}
+		string s = line;
+		while (!s.empty() && (s.back() == '\n' || s.back() == '\r' || s.back() == ' ' || s.back() == '\t'))
+			s.pop_back();
+		s = ltrim(s, " \t");
+		if (!s.empty())
+			out.push_back(s);
 	}
+	fclose(f);
+	return true;
+}
 
-	// finalize mean if needed
-	if (print_mean)
+// o: FILE.vital -> FILE.csv
+string csv_path(const string &path)
+{
+	if (is_vital(path))
+		return path.substr(0, path.size() - 6) + ".csv";
+	return path + ".csv";
+}
+
+// Exports several files, nthreads at a time. Each thread takes the next file that no thread
+// has started, so a long case does not hold up the short ones. Unless every file gets its own
+// csv, this thread writes the rows in the order of the files: a file streams out while the
+// ones before it are done, and the buffers of the later ones wait in memory. Past MAX_PENDING
+// bytes of those, their threads wait for the writer to reach them. The thread of the file being
+// written only waits for the writer to take its own buffers, so it always goes on. With -h the
+// header is written once, and again where the columns change.
+int export_batch(const vector<string> &files, Options opt, bool per_file, unsigned nthreads)
+{
+	if (!nthreads)
+		nthreads = 1;
+	if (nthreads > files.size())
+		nthreads = (unsigned)files.size();
+	opt.max_spool = max(MAX_SPOOL / nthreads, MIN_SPOOL); // what does not fit goes to a temp file, not to a second inflate
+	opt.inflate_thread = opt.inflate_thread && nthreads == 1; // otherwise the readers already use every core
+
+	struct Job
 	{
-		for (long i = 0; i < nrows; i++)
+		deque<vector<char>> chunks; // output not written yet
+		size_t bytes = 0;			// in chunks
+		string header;				// set before the first chunk
+		bool done = false;
+		int ret = 0;
+	};
+	vector<Job> jobs(files.size());
+	mutex m;
+	condition_variable cv;
+	atomic<size_t> next(0);
+	size_t head = 0;	// the file being written
+	size_t pending = 0; // bytes in the chunks of all jobs
+
+	auto work = [&]()
+	{
+		for (size_t i; (i = next++) < files.size();)
 		{
-			for (size_t j = 0; j < ncols; j++)
+			Job &job = jobs[i];
+			int ret = 0;
+			if (per_file)
 			{
-				long idx = i * (long)ncols + (long)j;
-				if (cnts[idx] > 0)
+				string opath = csv_path(files[i]);
+				TextWriter out(opath.c_str());
+				if (!out.good())
 				{
-					double m = sums[idx] / double(cnts[idx]);
-					vals[idx] = cstr(string_format("%f", m));
+					fprintf(stderr, "cannot write %s\n", opath.c_str());
+					ret = -1;
+				}
+				else
+				{
+					ret = export_file(files[i], opt, out);
+					if (!out.close())
+						ret = -1;
 				}
 			}
+			else
+			{
+				Options o = opt;
+				o.print_header = false;
+				TextWriter out([&](const char *p, size_t len)
+							   {
+								   unique_lock<mutex> lock(m);
+								   cv.wait(lock, [&]
+										   { return i == head ? !job.bytes || job.bytes + len <= MAX_PENDING
+															  : !pending || pending + len <= MAX_PENDING; });
+								   job.chunks.emplace_back(p, p + len);
+								   job.bytes += len;
+								   pending += len;
+								   cv.notify_all();
+								   return true; });
+				ret = export_file(files[i], o, out, &job.header);
+				out.close();
+			}
+			lock_guard<mutex> lock(m);
+			job.ret = ret;
+			job.done = true;
+			cv.notify_all();
 		}
-	}
+	};
+	vector<thread> threads;
+	for (unsigned i = 0; i < nthreads; i++)
+		threads.emplace_back(work);
 
-	// print header
-	if (print_header)
+	// the ordered writer
+	TextWriter out(1);
+	string last_header;
+	int nfailed = 0;
+	for (size_t i = 0; i < files.size(); i++)
 	{
-		if (print_filename)
-			printf("Filename,");
-
-		printf("Time");
-		for (size_t j = 0; j < ncols; j++)
+		Job &job = jobs[i];
+		bool started = false;
+		{
+			lock_guard<mutex> lock(m);
+			head = i;
+		}
+		cv.notify_all();
+		while (true)
 		{
-			string colName = tnames[j];
-			if (print_dname && !dnames[j].empty())
+			deque<vector<char>> chunks;
+			bool done;
 			{
-				colName = dnames[j] + "/" + colName;
+				unique_lock<mutex> lock(m);
+				cv.wait(lock, [&]
+						{ return job.done || !job.chunks.empty(); });
+				chunks.swap(job.chunks);
+				pending -= job.bytes;
+				job.bytes = 0;
+				done = job.done;
 			}
-			printf(",%s", colName.c_str());
+			cv.notify_all(); // a full sink may go on
+			if (!started && !job.header.empty())
+			{
+				if (opt.print_header && job.header != last_header)
+					out.put(job.header);
+				last_header = job.header;
+				started = true;
+			}
+			for (auto &chunk : chunks)
+				out.put(string_view(chunk.data(), chunk.size()));
+			if (done)
+				break;
+		}
+		if (job.ret)
+		{
+			fprintf(stderr, "%s: failed\n", files[i].c_str());
+			nfailed++;
 		}
-		putchar('\n');
 	}
+	out.close();
+	for (auto &t : threads)
+		t.join();
+	return nfailed ? -1 : 0;
+}
 
-	// Output rows
-	vector<char *> lastval(ncols, nullptr);
-	for (long i = 0; i < nrows; i++)
-	{
-		if (skip_blank_row && !has_data_in_row[size_t(i)])
-			continue;
+int main(int argc, char *argv[])
+{
+	const char *progname = argv[0];
+	--argc;
+	++argv; // skip program name
 
-		double dt = dtstart + i * epoch;
+	Options opt;
+	bool per_file = false;
+	unsigned nthreads = thread::hardware_concurrency();
 
-		if (print_filename)
+	// Parse any options in argv[0] if it starts with '-'
+	if (argc > 0)
+	{
+		string opts(argv[0]);
+		if (!opts.empty() && opts[0] == '-')
 		{
-			printf("%s,", basename(filename).c_str());
+			--argc;
+			++argv;
+			if (opts.find('a') != string::npos)
+				opt.absolute_time = true;
+			if (opts.find('u') != string::npos)
+				opt.unix_time = true;
+			if (opts.find('r') != string::npos)
+				opt.all_required = true;
+			if (opts.find('l') != string::npos)
+				opt.fill_last = true;
+			if (opts.find('h') != string::npos)
+				opt.print_header = true;
+			if (opts.find('c') != string::npos)
+				opt.print_filename = true;
+			if (opts.find('m') != string::npos)
+				opt.print_mean = true;
+			if (opts.find('s') != string::npos)
+				opt.skip_blank_row = true;
+			if (opts.find('n') != string::npos)
+				opt.print_closest = true;
+			if (opts.find('d') != string::npos)
+				opt.print_dname = true;
+			if (opts.find('o') != string::npos)
+				per_file = true;
+			auto pos = opts.find('j');
+			if (pos != string::npos && isdigit((unsigned char)opts[pos + 1]))
+				nthreads = atoi(opts.c_str() + pos + 1);
 		}
+	}
 
-		if (absolute_time)
-		{
-			// convert dt => local time
-			time_t t_local = (time_t)(dt - dgmt * 60);
-			struct tm *ts = gmtime(&t_local);
-			int64_t msPart = (int64_t)((dt - (int64_t)dt) * 1000.0);
-			printf("%04d-%02d-%02d %02d:%02d:%02d.%03lld",
-				   ts->tm_year + 1900, ts->tm_mon + 1, ts->tm_mday,
-				   ts->tm_hour, ts->tm_min, ts->tm_sec,
-				   (long long)msPart);
-		}
-		else if (unix_time)
-		{
-			printf("%lf", dt);
-		}
-		else
+	if (argc < 1)
+	{
+		print_usage(progname);
+		return -1;
+	}
+
+	// If we have 2 or more remaining args, the second one is interval
+	if (argc >= 2)
+	{
+		string sspan(argv[1]);
+		auto pos = sspan.find('/');
+		opt.epoch = atof(sspan.c_str());
+		if (pos != string::npos)
 		{
-			printf("%lf", dt - dtstart);
+			double divider = atof(sspan.substr(pos + 1).c_str());
+			if (divider == 0)
+			{
+				fprintf(stderr, "divider of [TIMESPAN] should not be 0\n");
+				return -1;
+			}
+			opt.epoch /= divider;
 		}
+	}
+	if (opt.epoch <= 0)
+	{
+		fprintf(stderr, "[TIMESPAN] should be > 0\n");
+		return -1;
+	}
 
-		// columns
+	// parse dname/tname if 3 or more args
+	if (argc >= 3)
+	{
+		opt.alltrack = false;
+		opt.tnames = explode(argv[2], ',');
+		size_t ncols = opt.tnames.size();
+		opt.dnames.resize(ncols);
 		for (size_t j = 0; j < ncols; j++)
 		{
-			char *val = vals[i * (long)ncols + (long)j];
-			if (fill_last)
+			auto pos = opt.tnames[j].find('/');
+			if (pos != string::npos)
 			{
-				if (!val)
-				{
-					val = lastval[j];
-				}
-				else
-				{
-					lastval[j] = val;
-				}
+				opt.dnames[j] = opt.tnames[j].substr(0, pos);
+				opt.tnames[j] = opt.tnames[j].substr(pos + 1);
 			}
-			if (val)
-				printf(",%s", val);
-			else
-				printf(",");
 		}
-		putchar('\n');
 	}
 
-	// cleanup
-	for (auto &p : vals)
-		delete[] p;
+	// a list of files, or a directory, is a batch
+	string input = argv[0];
+	vector<string> files;
+	bool batch = per_file;
+	struct stat st;
+	if (input[0] == '@')
+	{
+		if (!read_list(input.substr(1), files))
+		{
+			fprintf(stderr, "file does not exist\n");
+			return -1;
+		}
+		batch = true;
+	}
+	else if (stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+	{
+		scan_vital_files(files, input);
+		sort(files.begin(), files.end());
+		batch = true;
+	}
+	else
+		files.push_back(input);
 
-	return 0;
+	if (!batch)
+	{
+		TextWriter out(1);
+		return export_file(input, opt, out);
+	}
+	if (files.empty())
+	{
+		fprintf(stderr, "No vital file\n");
+		return -1;
+	}
+	return export_batch(files, opt, per_file, nthreads);
 }
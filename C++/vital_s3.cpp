@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h> // exit()
 #include <assert.h>
-#include "zlib128/zlib.h"
+#include <zlib.h>
 #include <string>
 #include <vector>
 #include <map>
@@ -10,8 +10,12 @@
 #include <time.h>
 #include <set>
 #include <iostream>
-#include "GZReader.h"
+#include "GZMapReader.h"
+#include "VitalIndex.h"
+#include "VitalDecode.h"
+#include "TrackCatalog.h"
 #include "Util.h"
+#include "TextWriter.h"
 #include <limits.h> // LLONG_MAX, etc.
 #include <filesystem>
 #include <random>
@@ -22,6 +26,21 @@
 namespace fs = std::filesystem;
 using namespace std;
 
+// 'W', 'N' or 'S' for the rectype of a track, 0 if it has none of them
+static char rectype_char(const TrackDesc &t)
+{
+	switch (t.rectype)
+	{
+	case 1:
+		return 'W';
+	case 2:
+		return 'N';
+	case 5:
+		return 'S';
+	}
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {
 	if (argc < 2)
@@ -52,7 +71,7 @@ int main(int argc, char *argv[])
 
 	fs::create_directories(odir);
 
-	GZReader gz(argv[1]); // open the file
+	GZMapReader gz(argv[1]); // open the file
 	if (!gz.opened())
 	{
 		fprintf(stderr, "file does not exist\n");
@@ -86,168 +105,90 @@ int main(int argc, char *argv[])
 		return -1;
 	headerlen += 2;
 
-	// track data structures
-	map<unsigned long, string> did_dnames;
-	map<unsigned short, char> tid_rectypes; // 'W','N','S'
-	map<unsigned short, unsigned char> tid_recfmts;
-	map<unsigned short, double> tid_gains;
-	map<unsigned short, double> tid_biases;
-	map<unsigned short, double> tid_srates;
-
-	map<unsigned short, string> tid_units;
-	map<unsigned short, unsigned long> tid_samples;
-	map<unsigned short, float> tid_mindisps;
-	map<unsigned short, float> tid_maxdisps;
-	map<unsigned short, unsigned long> tid_colors;
-	map<unsigned short, unsigned char> tid_montypes;
-
-	map<unsigned short, string> tid_dnames;
-	map<unsigned short, string> tid_tnames;
-	set<unsigned short> tids;
+	// track data. the slot of a track with records is its index in tids
+	TrackCatalog cat;
+	vector<unsigned short> tids;
 
 	// track start/end time
 	double dtstart = DBL_MAX;
 	double dtend = 0.0;
 
-	unsigned short infolen = 0;
-	double dtrec = 0.0;
-	unsigned short tid = 0;
+	// a fresh sidecar index replaces the first pass
+	VitalIndex idx;
+	bool indexed = idx.load_for(argv[1]);
+	for (auto &it : idx.trks)
+	{
+		auto &trk = it.second;
+		if (!trk.info)
+			continue;
+		TrackDesc &t = cat.add(trk);
+
+		// only records of a known type count
+		if (!trk.has_data() || !rectype_char(t))
+			continue;
+		t.slot = 0;
+		if (dtstart > trk.dtstart)
+			dtstart = trk.dtstart;
+		if (dtend < trk.dtend)
+			dtend = trk.dtend;
+	}
 
 	// First pass: read metadata
-	while (!gz.eof())
+	PacketReader pr(gz);
+	PacketView pkt;
+	while (!indexed && pr.next(pkt))
 	{
-		unsigned char type = 0;
-		if (!gz.read(&type, 1))
-			break;
-		unsigned long datalen = 0;
-		if (!gz.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
-
-		if (type == 0)
+		if (pkt.type == 0)
 		{ // trkinfo
-			unsigned short tidVal = 0;
-			if (!gz.fetch(tidVal, datalen))
-				goto next_packet;
-			unsigned char rectype = 0;
-			if (!gz.fetch(rectype, datalen))
-				goto next_packet;
-			unsigned char recfmt;
-			if (!gz.fetch(recfmt, datalen))
-				goto next_packet;
-
-			string tname, unit;
-			float mindisp = 0.f, maxdisp = 0.f, srate = 0.f;
-			unsigned long col = 0, didVal = 0;
-			double gain = 1.0, bias = 0.0;
-			unsigned char montype;
-
-			if (!gz.fetch_with_len(tname, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch_with_len(unit, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(mindisp, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(maxdisp, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(col, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(srate, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(gain, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(bias, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(montype, datalen))
-				goto save_and_next_packet;
-			if (!gz.fetch(didVal, datalen))
-				goto save_and_next_packet;
-
-		save_and_next_packet:
-		{
-			string dname = did_dnames[didVal];
-			tid_dnames[tidVal] = dname;
-			tid_tnames[tidVal] = tname;
-
-			// rectype in [1:wav, 2:num, 5:str]
-			if (rectype == 1)
-				tid_rectypes[tidVal] = 'W';
-			else if (rectype == 2)
-				tid_rectypes[tidVal] = 'N';
-			else if (rectype == 5)
-				tid_rectypes[tidVal] = 'S';
-
-			tid_units[tidVal] = unit;
-			tid_colors[tidVal] = col;
-			tid_mindisps[tidVal] = mindisp;
-			tid_maxdisps[tidVal] = maxdisp;
-
-			tid_recfmts[tidVal] = recfmt;
-			tid_gains[tidVal] = gain;
-			tid_biases[tidVal] = bias;
-			tid_srates[tidVal] = srate;
-			tid_montypes[tidVal] = montype;
-			tid_samples[tidVal] = 0;
-		}
+			TrkInfoView ti;
+			if (ti.parse(pkt))
+				cat.add(ti);
 		}
-		else if (type == 9)
+		else if (pkt.type == 9)
 		{ // devinfo
-			unsigned long didVal;
-			if (!gz.fetch(didVal, datalen))
-				goto next_packet;
-			string dtype;
-			if (!gz.fetch_with_len(dtype, datalen))
-				goto next_packet;
-			string dname;
-			if (!gz.fetch_with_len(dname, datalen))
-				goto next_packet;
-			if (dname.empty())
-				dname = dtype;
-			did_dnames[didVal] = dname;
+			DevInfoView di;
+			if (di.parse(pkt))
+				cat.add_device(di);
 		}
-		else if (type == 1)
+		else if (pkt.type == 1)
 		{ // rec
-			unsigned short infolen2 = 0;
-			if (!gz.fetch(infolen2, datalen))
-				goto next_packet;
-			double dtrecVal = 0.0;
-			if (!gz.fetch(dtrecVal, datalen))
-				goto next_packet;
-			if (!dtrecVal)
-				goto next_packet;
-			unsigned short tidVal2 = 0;
-			if (!gz.fetch(tidVal2, datalen))
-				goto next_packet;
-
-			char rectype = tid_rectypes[tidVal2];
-			float srate = (float)tid_srates[tidVal2];
-			unsigned long nsamp = 0;
-			double dt_rec_end = dtrecVal;
+			RecView rec;
+			if (!rec.parse(pkt) || !rec.dt)
+				continue;
+			TrackDesc &t = cat.at(rec.tid);
+			char rectype = rectype_char(t);
+			uint32_t nsamp = 0;
+			double dt_rec_end = rec.dt;
 			if (rectype == 'W')
 			{
-				if (!gz.fetch(nsamp, datalen))
-					goto next_packet;
-				if (srate > 0.f)
+				const unsigned char *samples;
+				if (!rec.wav(nsamp, samples))
+					continue;
+				if (t.srate > 0.f)
 				{
-					dt_rec_end += nsamp / srate;
+					dt_rec_end += nsamp / t.srate;
 				}
 			}
 			else if (rectype != 'N' && rectype != 'S')
 			{
-				goto next_packet; // unknown rectype
+				continue; // unknown rectype
 			}
-			tids.insert(tidVal2);
+			t.slot = 0;
 
 			// track min start & max end
-			if (dtstart > dtrecVal)
-				dtstart = dtrecVal;
+			if (dtstart > rec.dt)
+				dtstart = rec.dt;
 			if (dtend < dt_rec_end)
 				dtend = dt_rec_end;
 		}
-	next_packet:
-		if (!gz.skip(datalen))
-			break;
+	}
+	for (size_t i = 0; i < cat.size(); i++)
+	{
+		TrackDesc &t = cat.at((unsigned short)i);
+		if (t.slot < 0)
+			continue;
+		t.slot = (int32_t)tids.size();
+		tids.push_back((unsigned short)i);
 	}
 
 	gz.rewind();
@@ -255,263 +196,112 @@ int main(int argc, char *argv[])
 	if (!gz.skip(10 + headerlen))
 		return -1;
 
-	// allocate structures for second pass
-	map<unsigned short, vector<pair<double, float>> *> nums;
-	map<unsigned short, vector<pair<double, string>> *> strs;
-	map<unsigned short, float *> wavs;
+	// allocate structures for second pass, by slot
+	vector<vector<pair<double, float>> *> nums(tids.size(), nullptr);
+	vector<vector<pair<double, string>> *> strs(tids.size(), nullptr);
+	vector<float *> wavs(tids.size(), nullptr);
 
 	// Prepare memory for wave / numeric / string tracks
-	for (auto tidVal : tids)
+	for (size_t i = 0; i < tids.size(); i++)
 	{
-		char rt = tid_rectypes[tidVal];
+		const TrackDesc &t = cat[tids[i]];
+		char rt = rectype_char(t);
 		if (rt == 'W')
 		{
-			long wav_trk_len = (long)ceil((dtend - dtstart) * tid_srates[tidVal]);
-			wavs[tidVal] = new float[wav_trk_len];
+			long wav_trk_len = (long)ceil((dtend - dtstart) * double(t.srate));
+			wavs[i] = new float[wav_trk_len];
 			// fill with FLT_MAX to indicate blanks
-			std::fill(wavs[tidVal], wavs[tidVal] + wav_trk_len, FLT_MAX);
+			std::fill(wavs[i], wavs[i] + wav_trk_len, FLT_MAX);
 		}
 		else if (rt == 'N')
 		{
-			nums[tidVal] = new vector<pair<double, float>>();
+			nums[i] = new vector<pair<double, float>>();
 		}
 		else if (rt == 'S')
 		{
-			strs[tidVal] = new vector<pair<double, string>>();
+			strs[i] = new vector<pair<double, string>>();
 		}
 	}
 
-	// second pass
-	while (!gz.eof())
+	// second pass. recs of tracks without a slot are skipped unread
+	PacketReader pr2(gz);
+	RecView rec;
+	while (pr2.next(pkt, rec, [&](const RecView &r)
+					{ return r.tid && cat[r.tid].slot >= 0; }))
 	{
-		unsigned char type = 0;
-		if (!gz.read(&type, 1))
-			break;
-		unsigned long datalen = 0;
-		if (!gz.read(&datalen, 4))
-			break;
-		if (datalen > 1000000)
-			break;
-
-		if (type != 1)
-		{
-			if (!gz.skip(datalen))
-				break;
+		if (pkt.type != 1)
 			continue;
-		}
-
-		unsigned long fmtsize = 4;
-		if (!gz.fetch(infolen, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-		if (!gz.fetch(dtrec, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-		tid = 0;
-		if (!gz.fetch(tid, datalen))
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-		if (!tid)
-		{
-			if (!gz.skip(datalen))
-				break;
-			continue;
-		}
-
-		char rt = tid_rectypes[tid];
-		double sr = tid_srates[tid];
-		unsigned long nsamp = 0;
-		if (rt == 'W')
-		{
-			if (!gz.fetch(nsamp, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-		}
-		unsigned char recfmt = tid_recfmts[tid];
-		switch (recfmt)
-		{
-		case 2:
-			fmtsize = 8;
-			break;
-		case 3:
-		case 4:
-			fmtsize = 1;
-			break;
-		case 5:
-		case 6:
-			fmtsize = 2;
-			break;
-		}
 
+		const TrackDesc &t = cat[rec.tid];
+		char rt = rectype_char(t);
 		if (rt == 'W')
 		{
-			long idxrec = (long)((dtrec - dtstart) * sr);
-			double gain = tid_gains[tid];
-			double bias = tid_biases[tid];
-			float *wptr = wavs[tid];
+			float *wptr = wavs[t.slot];
 			if (!wptr)
-			{
-				if (!gz.skip(datalen))
-					break;
 				continue;
-			}
-			for (long i = 0; i < (long)nsamp; i++)
-			{
-				auto idxrow = idxrec + i;
-				float fval = FLT_MAX;
-				bool fetch_ok = true;
-				switch (recfmt)
-				{
-				case 1:
-				{ // float
-					float tmp;
-					if (!gz.fetch(tmp, datalen))
-						fetch_ok = false;
-					fval = tmp;
-					break;
-				}
-				case 2:
-				{ // double
-					double dval;
-					if (!gz.fetch(dval, datalen))
-						fetch_ok = false;
-					fval = (float)dval;
-					break;
-				}
-				case 3:
-				{ // char
-					char ival;
-					if (!gz.fetch(ival, datalen))
-						fetch_ok = false;
-					fval = float(ival);
-					break;
-				}
-				case 4:
-				{ // unsigned char
-					unsigned char ival;
-					if (!gz.fetch(ival, datalen))
-						fetch_ok = false;
-					fval = float(ival);
-					break;
-				}
-				case 5:
-				{ // short
-					short ival;
-					if (!gz.fetch(ival, datalen))
-						fetch_ok = false;
-					fval = float(ival);
-					break;
-				}
-				case 6:
-				{ // unsigned short
-					unsigned short ival;
-					if (!gz.fetch(ival, datalen))
-						fetch_ok = false;
-					fval = float(ival);
-					break;
-				}
-				case 7:
-				{ // long
-					long ival;
-					if (!gz.fetch(ival, datalen))
-						fetch_ok = false;
-					fval = float(ival);
-					break;
-				}
-				case 8:
-				{ // unsigned long
-					unsigned long ival;
-					if (!gz.fetch(ival, datalen))
-						fetch_ok = false;
-					fval = float(ival);
-					break;
-				}
-				}
-				if (!fetch_ok)
-				{
-					if (!gz.skip(datalen))
-						break;
-					break;
-				}
-				wptr[idxrow] = fval * gain + float(bias);
-			}
+			uint32_t nsamp = 0;
+			const unsigned char *samples;
+			if (!rec.wav(nsamp, samples))
+				continue;
+			// a short payload keeps only the complete samples
+			nsamp = min(nsamp, (rec.len - 4) / t.fmtsize);
+			long wav_trk_len = (long)ceil((dtend - dtstart) * double(t.srate));
+			long idxrec = (long)((rec.dt - dtstart) * double(t.srate));
+			if (idxrec < 0 || idxrec >= wav_trk_len)
+				continue;
+			nsamp = (uint32_t)min<long>(nsamp, wav_trk_len - idxrec);
+			calibrate_samples(samples, nsamp, t.recfmt, t.gain, float(t.offset), wptr + idxrec);
 		}
 		else if (rt == 'N')
 		{
 			float fval = 0.f;
-			if (!gz.fetch(fval, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			if (!rec.num(fval))
 				continue;
-			}
-			if (nums[tid])
-			{
-				nums[tid]->push_back({dtrec, fval});
-			}
+			if (nums[t.slot])
+				nums[t.slot]->push_back({rec.dt, fval});
 		}
 		else if (rt == 'S')
 		{
-			// skip a 4-byte length field
-			if (!gz.skip(4, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
-				continue;
-			}
-			string sval;
-			if (!gz.fetch_with_len(sval, datalen))
-			{
-				if (!gz.skip(datalen))
-					break;
+			string_view sval;
+			if (!rec.str(sval))
 				continue;
-			}
-			if (strs[tid])
-			{
-				strs[tid]->push_back({dtrec, sval});
-			}
+			if (strs[t.slot])
+				strs[t.slot]->push_back({rec.dt, string(sval)});
 		}
-
-		if (!gz.skip(datalen))
-			break;
 	}
 
 	// Write out CSV.gz files per track
-	map<unsigned short, unsigned long> tid_datasizes;
-	map<unsigned short, unsigned long> tid_compsizes;
+	vector<uint32_t> samples(tids.size(), 0);
+	vector<uint32_t> datasizes(tids.size(), 0);
+	vector<uint32_t> compsizes(tids.size(), 0);
 
-	for (auto tidVal : tids)
+	for (size_t slot = 0; slot < tids.size(); slot++)
 	{
+		unsigned short tidVal = tids[slot];
+		const TrackDesc &t = cat[tidVal];
+		const string &dname = cat.dname(tidVal);
+		const string &tname = cat.tname(tidVal);
+
 		// Use ipath instead of filename
-		auto opath = odir + '/' + ipath + '@' + tid_dnames[tidVal] + '@' + tid_tnames[tidVal] + ".csv.gz";
+		auto opath = odir + '/' + ipath + '@' + dname + '@' + tname + ".csv.gz";
 
 		// open a GZWriter
 		GZWriter gzout(opath.c_str(), "w5b");
+		TextWriter out(gzout);
 
 		// write header line
-		{
-			string hdr = "Time," + tid_dnames[tidVal] + '/' + tid_tnames[tidVal] + '\n';
-			gzout.write(hdr);
-		}
+		out.put("Time,");
+		out.put(dname);
+		out.put('/');
+		out.put(tname);
+		out.put('\n');
 
-		char rt = tid_rectypes[tidVal];
-		unsigned long num_samples = 0;
+		char rt = rectype_char(t);
+		uint32_t num_samples = 0;
 
 		if (rt == 'N')
 		{
-			auto &recs = nums[tidVal];
+			auto &recs = nums[slot];
 			sort(recs->begin(), recs->end(),
 				 [](auto &a, auto &b)
 				 { return a.first < b.first; });
@@ -519,33 +309,36 @@ int main(int argc, char *argv[])
 			{
 				double tsec = rec.first - dtstart;
 				float val = rec.second;
-				string line = num_to_str(tsec) + "," + num_to_str(val) + "\n";
-				gzout.write(line);
+				out.general(tsec);
+				out.put(',');
+				out.general(val);
+				out.put('\n');
 				num_samples++;
 			}
 		}
 		else if (rt == 'S')
 		{
-			auto &recs = strs[tidVal];
+			auto &recs = strs[slot];
 			sort(recs->begin(), recs->end(),
 				 [](auto &a, auto &b)
 				 { return a.first < b.first; });
 			for (auto &rec : *recs)
 			{
 				double tsec = rec.first - dtstart;
-				string line = num_to_str(tsec) + "," + escape_csv(rec.second) + "\n";
-				gzout.write(line);
+				out.general(tsec);
+				out.put(',');
+				out.csv(rec.second);
+				out.put('\n');
 				num_samples++;
 			}
 		}
 		else if (rt == 'W')
 		{
-			float *pstart = wavs[tidVal];
+			float *pstart = wavs[slot];
 			if (!pstart)
 				continue;
-			double sr = tid_srates[tidVal];
+			double sr = t.srate;
 			long wav_trk_len = (long)ceil((dtend - dtstart) * sr);
-			float *pend = pstart + wav_trk_len;
 
 			for (long i = 0; i < wav_trk_len; i++)
 			{
@@ -554,71 +347,77 @@ int main(int argc, char *argv[])
 				// We only store the actual time in the first 2 lines or last line
 				// or just store time on every line, your choice
 				// For now, let's store it on every line:
-				string line = num_to_str(tsec);
-
-				line += ",";
+				out.general(tsec);
+				out.put(',');
 				if (val != FLT_MAX)
 				{
-					line += num_to_str(val);
+					out.general(val);
 					num_samples++;
 				}
-				line += "\n";
-				gzout.write(line);
+				out.put('\n');
 			}
 			delete[] pstart;
-			wavs[tidVal] = nullptr;
+			wavs[slot] = nullptr;
 		}
 
-		tid_samples[tidVal] = num_samples;
-		tid_datasizes[tidVal] = gzout.get_datasize();
-		tid_compsizes[tidVal] = gzout.get_compsize();
+		out.flush();
+		samples[slot] = num_samples;
+		datasizes[slot] = gzout.get_datasize();
+		compsizes[slot] = gzout.get_compsize();
 	}
 
 	// Save tracklist.csv
 	string tracklistPath = odir + "/tracklist.csv";
-	FILE *f = ::fopen(tracklistPath.c_str(), "wt");
-	if (!f)
+	TextWriter f(tracklistPath.c_str());
+	if (!f.good())
 	{
 		fprintf(stderr, "Failed to open %s for writing\n", tracklistPath.c_str());
 	}
 	else
 	{
-		fprintf(f, "tname,samples,unit,mindisp,maxdisp,colors,datasize,compsize,rectype,srate,gain,bias\n");
-		for (auto tidVal : tids)
+		f.put("tname,samples,unit,mindisp,maxdisp,colors,datasize,compsize,rectype,srate,gain,bias\n");
+		for (size_t slot = 0; slot < tids.size(); slot++)
 		{
-			fprintf(f, "%s,%lu,%s,%f,%f,%lu,%lu,%lu,%c,%f,%f,%f\n",
-					(tid_dnames[tidVal] + '/' + tid_tnames[tidVal]).c_str(),
-					tid_samples[tidVal],
-					tid_units[tidVal].c_str(),
-					tid_mindisps[tidVal],
-					tid_maxdisps[tidVal],
-					tid_colors[tidVal],
-					tid_datasizes[tidVal],
-					tid_compsizes[tidVal],
-					tid_rectypes[tidVal],
-					tid_srates[tidVal],
-					tid_gains[tidVal],
-					tid_biases[tidVal]);
+			unsigned short tidVal = tids[slot];
+			const TrackDesc &t = cat[tidVal];
+			// "%s,%u,%s,%f,%f,%u,%u,%u,%c,%f,%f,%f"
+			f.put(cat.dname(tidVal));
+			f.put('/');
+			f.put(cat.tname(tidVal));
+			f.put(',');
+			f.integer(samples[slot]);
+			f.put(',');
+			f.put(cat.unit(tidVal));
+			f.put(',');
+			f.fixed(t.mindisp);
+			f.put(',');
+			f.fixed(t.maxdisp);
+			f.put(',');
+			f.integer(t.col);
+			f.put(',');
+			f.integer(datasizes[slot]);
+			f.put(',');
+			f.integer(compsizes[slot]);
+			f.put(',');
+			f.put(rectype_char(t));
+			f.put(',');
+			f.fixed(t.srate);
+			f.put(',');
+			f.fixed(t.gain);
+			f.put(',');
+			f.fixed(t.offset);
+			f.put('\n');
 		}
-		::fclose(f);
+		f.close();
 	}
 
 	// Clean up
-	for (auto &kv : wavs)
-	{
-		if (kv.second)
-			delete[] kv.second;
-	}
-	for (auto &kv : nums)
-	{
-		if (kv.second)
-			delete kv.second;
-	}
-	for (auto &kv : strs)
-	{
-		if (kv.second)
-			delete kv.second;
-	}
+	for (auto p : wavs)
+		delete[] p;
+	for (auto p : nums)
+		delete p;
+	for (auto p : strs)
+		delete p;
 
 	return 0;
 }
@@ -27,8 +27,10 @@ int main(int argc, char *argv[])
 		VitalFileData data = parseVitalFile(vitalFile, is_short);
 
 		std::cout << "#dgmt," << data.tzBias << "\n";
-		std::cout << "#dtstart," << data.dtStart << "\n";
-		std::cout << "#dtend," << data.dtEnd << "\n";
+		// timestamps in fixed notation, the 6 significant digits of the default lose the seconds
+		std::cout << std::fixed << "#dtstart," << data.dtStart << "\n";
+		std::cout << "#dtend," << data.dtEnd << "\n"
+				  << std::defaultfloat;
 		std::cout << "tname,tid,dname,did,rectype,dtstart,dtend,srate,minval,maxval,cnt,avgval,firstval\n";
 
 		for (auto &kv : data.tracks)
@@ -63,8 +65,8 @@ int main(int argc, char *argv[])
 					  << track.deviceName << ","
 					  << track.deviceId << ","
 					  << stype << ","
-					  << track.dtStart << ","
-					  << track.dtEnd << ","
+					  << std::fixed << track.dtStart << ","
+					  << track.dtEnd << "," << std::defaultfloat
 					  << track.sampleRate << ","
 					  << track.minVal << ","
 					  << track.maxVal << ","
@@ -108,30 +110,24 @@ int main(int argc, char *argv[])
 		}
 
 		// Example: Save EEG1/EEG2 waveforms to CSV
-		std::vector<float> eeg1_waveform, eeg2_waveform;
-		std::vector<double> eeg1_timestamps, eeg2_timestamps;
+		const TrackInfo *eeg1 = nullptr, *eeg2 = nullptr;
 		for (auto &kv : data.tracks)
 		{
 			const auto &track = kv.second;
 			if (track.recType == 1)
 			{ // WAV
 				if (track.trackName == "EEG1_WAV")
-				{
-					eeg1_waveform = track.waveform;
-					eeg1_timestamps = track.waveformTimestamps;
-				}
+					eeg1 = &track;
 				else if (track.trackName == "EEG2_WAV")
-				{
-					eeg2_waveform = track.waveform;
-					eeg2_timestamps = track.waveformTimestamps;
-				}
+					eeg2 = &track;
 			}
 		}
-		if (!eeg1_waveform.empty() || !eeg2_waveform.empty())
+		if ((eeg1 && !eeg1->waveform.empty()) || (eeg2 && !eeg2->waveform.empty()))
 		{
+			TrackInfo none;
 			save_waveforms_to_csv("EEG_Waveforms.csv",
-								  eeg1_timestamps, eeg1_waveform, "EEG1_WAV",
-								  eeg2_timestamps, eeg2_waveform, "EEG2_WAV");
+								  eeg1 ? *eeg1 : none, "EEG1_WAV",
+								  eeg2 ? *eeg2 : none, "EEG2_WAV");
 		}
 	}
 	catch (const std::exception &ex)
@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "VitalLib.h"
+#include "VitalGen.h"
+
+using namespace std;
+
+// parseVitalFile(filename, selectors, t0, t1) against the full parse cut with
+// TrackInfo::sampleIndex, for windows whose edges fall exactly on sample times.
+// ctest runs it; it prints the failures and exits 1 if there are any.
+
+static int g_fails = 0;
+static int g_checks = 0;
+
+static void check(const string &path, const VitalFileData &full, double t0, double t1)
+{
+	VitalFileData win = parseVitalFile(path, set<string>(), t0, t1);
+	for (auto &it : full.tracks)
+	{
+		const TrackInfo &ft = it.second;
+		if (ft.recType != 1)
+			continue;
+		g_checks++;
+		size_t first = ft.sampleIndex(t0), last = max(first, ft.sampleIndex(t1));
+		auto wt = win.tracks.find(it.first);
+		size_t n = wt == win.tracks.end() ? 0 : wt->second.waveform.size();
+		if (n != last - first)
+		{
+			if (g_fails++ < 20)
+				printf("%s %.0f Hz [%.9f, %.9f): %zu samples, expected %zu\n", ft.trackName.c_str(), ft.sampleRate, t0, t1, n, last - first);
+			continue;
+		}
+		if (!n)
+			continue;
+		const TrackInfo &w = wt->second;
+		if (memcmp(w.waveform.data(), &ft.waveform[first], n * sizeof(float)) != 0)
+		{
+			if (g_fails++ < 20)
+				printf("%s %.0f Hz [%.9f, %.9f): the samples differ\n", ft.trackName.c_str(), ft.sampleRate, t0, t1);
+			continue;
+		}
+		if (w.sampleTime(0) < t0 || w.sampleTime(n - 1) >= t1 || w.sampleTime(0) != ft.sampleTime(first))
+		{
+			if (g_fails++ < 20)
+				printf("%s %.0f Hz [%.9f, %.9f): samples from %.9f to %.9f\n", ft.trackName.c_str(), ft.sampleRate, t0, t1, w.sampleTime(0), w.sampleTime(n - 1));
+		}
+	}
+}
+
+int main()
+{
+	for (double srate : {100.0, 500.0, 62.5})
+	{
+		VitalGenSpec spec;
+		spec.hours = 0.1;
+		spec.nwav = 2;
+		spec.nnum = 1;
+		spec.nstr = 0;
+		spec.srate = srate;
+		spec.recfmts = {1, 5};
+		string path = "vital_window_test.vital";
+		VitalGenStats stats;
+		if (!vital_gen(path, spec, stats))
+		{
+			printf("cannot write %s\n", path.c_str());
+			return 1;
+		}
+
+		VitalFileData full = parseVitalFile(path, false);
+		// t0 and t1 on sample times, at record edges and inside records
+		for (double sec : {0.0, 1.0, 3.0, 17.0, 200.0})
+		{
+			for (double frac : {0.0, 0.01, 0.3, 0.7, 0.99})
+			{
+				double t0 = spec.dtstart + sec + frac;
+				check(path, full, t0, spec.dtstart + 200.7);
+				check(path, full, t0, t0 + 1.0);
+				check(path, full, t0, t0 + 0.01);
+			}
+		}
+		check(path, full, spec.dtstart + 200.7, spec.dtstart + 300.3);
+		remove(path.c_str());
+	}
+
+	printf("%d checks: %d failed\n", g_checks, g_fails);
+	return g_fails ? 1 : 0;
+}
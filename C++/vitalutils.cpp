@@ -0,0 +1,212 @@
+#include "vitalutils.h"
+#include "VitalLib.h"
+#include <cmath>
+#include <cstddef>
+#include <exception>
+#include <set>
+#include <string>
+#include <vector>
+
+// The C interface over VitalLib. A vu_file owns a VitalFileData; the buffers handed out
+// are its vectors, so nothing is copied after the parse.
+
+static_assert(sizeof(vu_segment) == sizeof(WaveSegment) &&
+                  offsetof(vu_segment, dtstart) == offsetof(WaveSegment, dtStart) &&
+                  offsetof(vu_segment, srate) == offsetof(WaveSegment, srate) &&
+                  offsetof(vu_segment, offset) == offsetof(WaveSegment, sampleOffset) &&
+                  offsetof(vu_segment, count) == offsetof(WaveSegment, count),
+              "vu_segment is handed out as the WaveSegment array itself");
+
+struct vu_file
+{
+    VitalFileData data;
+    std::vector<const TrackInfo *> tracks; // in tid order
+};
+
+static thread_local std::string last_error;
+
+static void fail(const std::string &msg)
+{
+    last_error = msg;
+}
+
+static vu_file *open_file(VitalFileData &&data)
+{
+    vu_file *f = new vu_file;
+    f->data = std::move(data);
+    for (auto &kv : f->data.tracks)
+        f->tracks.push_back(&kv.second);
+    return f;
+}
+
+static const TrackInfo *get_track(const vu_file *f, std::size_t i)
+{
+    if (!f)
+    {
+        fail("null file");
+        return nullptr;
+    }
+    if (i >= f->tracks.size())
+    {
+        fail("no track " + std::to_string(i));
+        return nullptr;
+    }
+    return f->tracks[i];
+}
+
+int vu_abi_version(void)
+{
+    return VU_ABI_VERSION;
+}
+
+const char *vu_last_error(void)
+{
+    return last_error.c_str();
+}
+
+vu_file *vu_open(const char *path, const char *tracks, double t0, double t1)
+{
+    if (!path)
+    {
+        fail("null path");
+        return nullptr;
+    }
+    try
+    {
+        std::set<std::string> selectors;
+        for (const char *p = tracks; p && *p;)
+        {
+            const char *comma = p;
+            while (*comma && *comma != ',')
+                comma++;
+            if (comma > p)
+                selectors.insert(std::string(p, comma));
+            p = *comma ? comma + 1 : comma;
+        }
+        return open_file(parseVitalFile(path, selectors, t0, t1));
+    }
+    catch (const std::exception &e)
+    {
+        fail(e.what());
+    }
+    return nullptr;
+}
+
+vu_file *vu_open_catalog(const char *path)
+{
+    if (!path)
+    {
+        fail("null path");
+        return nullptr;
+    }
+    try
+    {
+        return open_file(parseVitalFile(path, true));
+    }
+    catch (const std::exception &e)
+    {
+        fail(e.what());
+    }
+    return nullptr;
+}
+
+void vu_close(vu_file *f)
+{
+    delete f;
+}
+
+void vu_header(const vu_file *f, double *tzbias, double *dtstart, double *dtend)
+{
+    if (!f)
+        return;
+    if (tzbias)
+        *tzbias = std::round(f->data.tzBias * 60); // VitalFileData keeps hours
+    if (dtstart)
+        *dtstart = f->data.dtStart;
+    if (dtend)
+        *dtend = f->data.dtEnd;
+}
+
+size_t vu_track_count(const vu_file *f)
+{
+    return f ? f->tracks.size() : 0;
+}
+
+int vu_find_track(const vu_file *f, const char *name)
+{
+    if (!f || !name)
+        return -1;
+    std::string dname, tname = name;
+    auto pos = tname.find('/');
+    if (pos != std::string::npos)
+    {
+        dname = tname.substr(0, pos);
+        tname = tname.substr(pos + 1);
+    }
+    for (std::size_t i = 0; i < f->tracks.size(); i++)
+    {
+        const TrackInfo &tr = *f->tracks[i];
+        if (tr.trackName == tname && (dname.empty() || tr.deviceName == dname))
+            return (int)i;
+    }
+    return -1;
+}
+
+int vu_track_info(const vu_file *f, size_t i, vu_track *info)
+{
+    const TrackInfo *tr = get_track(f, i);
+    if (!tr || !info)
+        return -1;
+    info->tid = tr->tid;
+    info->rectype = tr->recType;
+    info->recfmt = tr->recFmt;
+    info->tname = tr->trackName.c_str();
+    info->dname = tr->deviceName.c_str();
+    info->srate = tr->sampleRate;
+    info->gain = tr->adcGain;
+    info->offset = tr->adcOffset;
+    info->dtstart = tr->dtStart;
+    info->dtend = tr->dtEnd;
+    return 0;
+}
+
+int vu_track_samples(const vu_file *f, size_t i, vu_samples *out)
+{
+    const TrackInfo *tr = get_track(f, i);
+    if (!tr || !out)
+        return -1;
+    *out = vu_samples();
+    out->times = tr->recordTimestamps.data();
+    out->ntimes = tr->recordTimestamps.size();
+    out->segments = reinterpret_cast<const vu_segment *>(tr->waveformSegments.data());
+    out->nsegments = tr->waveformSegments.size();
+    if (tr->recType == 1)
+    {
+        out->values = tr->waveform.data();
+        out->nvalues = tr->waveform.size();
+        out->dtype = VU_DTYPE_FLOAT32;
+    }
+    else if (tr->recType == 2)
+    {
+        out->values = tr->numericValues.data();
+        out->nvalues = tr->numericValues.size();
+        out->dtype = VU_DTYPE_FLOAT32;
+    }
+    return 0;
+}
+
+const char *vu_track_string(const vu_file *f, size_t i, size_t k, size_t *len)
+{
+    const TrackInfo *tr = get_track(f, i);
+    if (!tr)
+        return nullptr;
+    if (k >= tr->stringValues.size())
+    {
+        fail("no record " + std::to_string(k));
+        return nullptr;
+    }
+    std::string_view s = tr->stringValues[k];
+    if (len)
+        *len = s.size();
+    return s.data();
+}
@@ -0,0 +1,141 @@
+#ifndef VITALUTILS_H
+#define VITALUTILS_H
+
+/*
+ * C interface of libvitalutils, for Python (ctypes, cffi), R (.C / .Call) and other
+ * languages that cannot call C++. Sample buffers point into the memory of the open
+ * file, so they can be wrapped without copying, e.g. by numpy.ctypeslib.as_array.
+ * They stay valid until vu_close.
+ *
+ * Every function that can fail returns NULL or -1 and leaves a message for vu_last_error.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+#ifdef VITALUTILS_BUILD
+#define VU_API __declspec(dllexport)
+#else
+#define VU_API __declspec(dllimport)
+#endif
+#else
+#define VU_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Bumped whenever a struct or a signature below changes */
+#define VU_ABI_VERSION 1
+
+/* dtype of vu_samples.values */
+#define VU_DTYPE_NONE 0    /* STR tracks, whose values are read with vu_track_string */
+#define VU_DTYPE_FLOAT32 1 /* every WAV recfmt and NUM values are decoded to float */
+
+typedef struct vu_file vu_file;
+
+typedef struct vu_track
+{
+    uint16_t tid;
+    uint8_t rectype;   /* 1: wav, 2: num, 5: str */
+    uint8_t recfmt;    /* sample format in the file, 1: float ... 8: dword */
+    const char *tname;
+    const char *dname; /* empty if the track has no device */
+    float srate;       /* WAV only */
+    double gain;       /* integer WAV samples were scaled by gain and shifted by offset */
+    double offset;
+    double dtstart;    /* time range of the loaded records, 0 if there are none */
+    double dtend;
+} vu_track;
+
+/* One WAV record: values[offset, offset + count), the first at dtstart and the next ones 1 / srate apart */
+typedef struct vu_segment
+{
+    double dtstart;
+    float srate;
+    uint64_t offset;
+    uint32_t count;
+} vu_segment;
+
+typedef struct vu_samples
+{
+    const void *values;          /* WAV samples or NUM values, nvalues items of dtype */
+    size_t nvalues;
+    int dtype;
+    const double *times;         /* NUM and STR: time of each record, ntimes items */
+    size_t ntimes;
+    const vu_segment *segments;  /* WAV: where each record starts, nsegments items */
+    size_t nsegments;
+} vu_samples;
+
+/**
+ * @brief VU_ABI_VERSION of the library, to check against the header a binding was written for.
+ */
+VU_API int vu_abi_version(void);
+
+/**
+ * @brief The reason of the last failure in this thread.
+ */
+VU_API const char *vu_last_error(void);
+
+/**
+ * @brief Read a vital file in one pass and decode the selected tracks.
+ *
+ * @param path The vital file.
+ * @param tracks Comma separated "DNAME/TNAME" or "TNAME", like vital_recs. NULL or "" for every track.
+ * @param t0 Start of the window in unix time, inclusive. 0 means the start of the file.
+ * @param t1 End of the window, exclusive. 0 means the end of the file.
+ * @return NULL if the file cannot be read.
+ */
+VU_API vu_file *vu_open(const char *path, const char *tracks, double t0, double t1);
+
+/**
+ * @brief Only the header and the track list, without decoding any record.
+ *        Uses the sidecar index when there is a fresh one.
+ */
+VU_API vu_file *vu_open_catalog(const char *path);
+
+/**
+ * @brief Free the file and every buffer taken from it.
+ */
+VU_API void vu_close(vu_file *f);
+
+/**
+ * @brief Header of the file. tzbias is the header's dgmt in minutes, UTC minus
+ * local time (-540 for UTC+9); dtstart and dtend are unix times.
+ */
+VU_API void vu_header(const vu_file *f, double *tzbias, double *dtstart, double *dtend);
+
+/**
+ * @brief Number of tracks. Tracks are numbered from 0 in the order of their tid.
+ */
+VU_API size_t vu_track_count(const vu_file *f);
+
+/**
+ * @brief Index of a track given as "DNAME/TNAME" or "TNAME", or -1.
+ */
+VU_API int vu_find_track(const vu_file *f, const char *name);
+
+/**
+ * @brief Metadata of track i. The strings stay valid until vu_close.
+ */
+VU_API int vu_track_info(const vu_file *f, size_t i, vu_track *info);
+
+/**
+ * @brief The decoded records of track i, without copying.
+ */
+VU_API int vu_track_samples(const vu_file *f, size_t i, vu_samples *out);
+
+/**
+ * @brief Value of the k-th record of STR track i, as it is stored (not null terminated).
+ *        The record time is vu_samples.times[k]. NULL if there is no such record.
+ */
+VU_API const char *vu_track_string(const vu_file *f, size_t i, size_t k, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // VITALUTILS_H
@@ -0,0 +1,90 @@
+import ctypes
+import sys
+import numpy as np
+
+# Loads a vital file through libvitalutils (C++/vitalutils.h) and wraps the samples
+# as numpy arrays without copying. Build the library with
+#   cmake -S C++ -B build && cmake --build build --target vitalutils
+
+
+class vu_track(ctypes.Structure):
+    _fields_ = [('tid', ctypes.c_uint16), ('rectype', ctypes.c_uint8), ('recfmt', ctypes.c_uint8),
+                ('tname', ctypes.c_char_p), ('dname', ctypes.c_char_p), ('srate', ctypes.c_float),
+                ('gain', ctypes.c_double), ('offset', ctypes.c_double),
+                ('dtstart', ctypes.c_double), ('dtend', ctypes.c_double)]
+
+
+class vu_samples(ctypes.Structure):
+    _fields_ = [('values', ctypes.c_void_p), ('nvalues', ctypes.c_size_t), ('dtype', ctypes.c_int),
+                ('times', ctypes.POINTER(ctypes.c_double)), ('ntimes', ctypes.c_size_t),
+                ('segments', ctypes.c_void_p), ('nsegments', ctypes.c_size_t)]
+
+
+VU_ABI_VERSION = 1
+VU_DTYPE_FLOAT32 = 1
+vu_segment = np.dtype([('dtstart', '<f8'), ('srate', '<f4'), ('offset', '<u8'), ('count', '<u4')], align=True)
+
+lib = ctypes.CDLL(sys.argv[2] if len(sys.argv) > 2 else 'libvitalutils.so')
+lib.vu_last_error.restype = ctypes.c_char_p
+lib.vu_open.restype = ctypes.c_void_p
+lib.vu_open.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_double, ctypes.c_double]
+lib.vu_close.argtypes = [ctypes.c_void_p]
+lib.vu_header.argtypes = [ctypes.c_void_p] + [ctypes.POINTER(ctypes.c_double)] * 3
+lib.vu_track_count.restype = ctypes.c_size_t
+lib.vu_track_count.argtypes = [ctypes.c_void_p]
+lib.vu_track_info.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(vu_track)]
+lib.vu_track_samples.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.POINTER(vu_samples)]
+lib.vu_track_string.restype = ctypes.c_void_p
+lib.vu_track_string.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+assert lib.vu_abi_version() == VU_ABI_VERSION
+
+
+class VitalFile:
+    # the arrays point into the library's memory, so they keep this object alive
+    def __init__(self, ipath, track_names=None, dtstart=0, dtend=0):
+        sel = ','.join(track_names).encode() if track_names else None
+        self.h = lib.vu_open(ipath.encode(), sel, dtstart, dtend)
+        if not self.h:
+            raise IOError(lib.vu_last_error().decode())
+        tzbias, dts, dte = ctypes.c_double(), ctypes.c_double(), ctypes.c_double()
+        lib.vu_header(self.h, ctypes.byref(tzbias), ctypes.byref(dts), ctypes.byref(dte))
+        self.dgmt = int(tzbias.value)  # minutes, like vitaldb.VitalFile.dgmt
+        self.dtstart, self.dtend = dts.value, dte.value
+        self.trks = {}
+        for i in range(lib.vu_track_count(self.h)):
+            info = vu_track()
+            smp = vu_samples()
+            lib.vu_track_info(self.h, i, ctypes.byref(info))
+            lib.vu_track_samples(self.h, i, ctypes.byref(smp))
+            name = '{}/{}'.format(info.dname.decode(), info.tname.decode()) if info.dname else info.tname.decode()
+            trk = {'rectype': info.rectype, 'srate': info.srate, 'dtstart': info.dtstart, 'dtend': info.dtend}
+            if smp.dtype == VU_DTYPE_FLOAT32:
+                trk['values'] = self._wrap(smp.values, np.float32, smp.nvalues)
+            trk['times'] = self._wrap(ctypes.cast(smp.times, ctypes.c_void_p).value, np.float64, smp.ntimes)
+            trk['segments'] = self._wrap(smp.segments, vu_segment, smp.nsegments)
+            if info.rectype == 5:
+                n = ctypes.c_size_t()
+                trk['values'] = [ctypes.string_at(lib.vu_track_string(self.h, i, k, ctypes.byref(n)), n.value).decode('utf-8', 'replace')
+                                 for k in range(smp.ntimes)]
+            self.trks[name] = trk
+
+    def _wrap(self, ptr, dtype, n):
+        if not n:
+            return np.empty(0, dtype)
+        buf = (ctypes.c_char * (n * np.dtype(dtype).itemsize)).from_address(ptr)
+        buf._owner = self
+        return np.frombuffer(buf, dtype, n)
+
+    def __del__(self):
+        if getattr(self, 'h', None):
+            lib.vu_close(self.h)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) < 2:
+        print('Usage : python load_vital_capi.py VITAL_PATH [LIBVITALUTILS_PATH]')
+        sys.exit(-1)
+    vf = VitalFile(sys.argv[1])
+    print('dgmt', vf.dgmt, 'min', vf.dtstart, vf.dtend)
+    for name, trk in vf.trks.items():
+        print(name, len(trk['values']) if 'values' in trk else 0, trk['dtstart'], trk['dtend'])